@@ -0,0 +1,597 @@
+// bench.cpp
+//
+
+#include "differentiate.h"
+#include "evaluate.h"
+#include "expression.h"
+#include "parser.h"
+#include "simplify_context.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/resource.h>)
+#   include <sys/resource.h>
+#   define BENCH_HAS_RUSAGE 1
+#else
+#   define BENCH_HAS_RUSAGE 0
+#endif
+
+#ifndef BENCH_CORPUS
+#   define BENCH_CORPUS "bench/corpus.txt"
+#endif
+
+//------------------------------------------------------------------------------
+//  Allocation counters
+//
+//  Global allocations are prefixed with their size so the live heap can be
+//  tracked, and the counters are read before and after each benchmark.
+//
+
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+std::atomic<std::size_t> allocation_bytes{0};
+std::atomic<std::size_t> live_bytes{0};
+std::atomic<std::size_t> peak_live_bytes{0};
+
+constexpr std::size_t header_size = alignof(std::max_align_t);
+
+void* counted_alloc(std::size_t size)
+{
+    void* block = std::malloc(size + header_size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(block) = size;
+    ++allocation_count;
+    allocation_bytes += size;
+    std::size_t live = live_bytes += size;
+    std::size_t peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    return static_cast<char*>(block) + header_size;
+}
+
+void counted_free(void* ptr)
+{
+    if (ptr) {
+        void* block = static_cast<char*>(ptr) - header_size;
+        live_bytes -= *static_cast<std::size_t*>(block);
+        std::free(block);
+    }
+}
+
+} // anonymous namespace
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { counted_free(ptr); }
+
+// over-aligned allocations are counted but not included in the live heap
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    ++allocation_count;
+    allocation_bytes += size;
+    std::size_t a = static_cast<std::size_t>(align);
+    void* ptr = std::aligned_alloc(a, (size + a - 1) / a * a);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new[](std::size_t size, std::align_val_t align) { return operator new(size, align); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+//------------------------------------------------------------------------------
+//! peak resident set size of the process in kilobytes, zero if unknown
+std::size_t peak_rss_kb()
+{
+#if BENCH_HAS_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#   if defined(__APPLE__)
+        return std::size_t(usage.ru_maxrss) / 1024;
+#   else
+        return std::size_t(usage.ru_maxrss);
+#   endif
+    }
+#endif
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//! results are written here so the compiler can't discard the work
+volatile std::size_t sink;
+
+//------------------------------------------------------------------------------
+struct corpus_entry
+{
+    std::string section;
+    std::string text;
+    algebra::expression expr;
+};
+
+//------------------------------------------------------------------------------
+//! corpus with its version, lines are `# corpus <version>`, `[section]`,
+//! comments starting with `#` and one expression per line
+struct corpus
+{
+    std::string version;
+    std::vector<corpus_entry> entries;
+    std::vector<std::string> sections;
+};
+
+//------------------------------------------------------------------------------
+bool load_corpus(char const* path, corpus& out)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::fprintf(stderr, "failed to open %s\n", path);
+        return false;
+    }
+
+    algebra::parser::context context;
+    std::string section = "default";
+    std::string line;
+    for (std::size_t number = 1; std::getline(file, line); ++number) {
+        if (line.compare(0, 9, "# corpus ") == 0) {
+            out.version = line.substr(9);
+        } else if (line.empty() || line[0] == '#') {
+            continue;
+        } else if (line[0] == '[' && line.back() == ']') {
+            section = line.substr(1, line.size() - 2);
+            out.sections.push_back(section);
+        } else {
+            algebra::expression expr = context.parse(line);
+            if (!context.valid()) {
+                std::fprintf(stderr, "%s:%zu: %s\n", path, number, context.error().message.c_str());
+                return false;
+            }
+            out.entries.push_back({section, line, expr});
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//! append `expr` and its subexpressions in preorder
+void subexpressions(algebra::expression const& expr, std::vector<algebra::expression>& out)
+{
+    out.push_back(expr);
+    if (std::holds_alternative<algebra::op>(expr)) {
+        algebra::op const& expr_op = std::get<algebra::op>(expr);
+        subexpressions(expr_op.lhs, out);
+        if (!std::holds_alternative<algebra::empty>((algebra::expression const&)expr_op.rhs)) {
+            subexpressions(expr_op.rhs, out);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//! distinct symbols of `expr` in preorder
+std::vector<algebra::symbol> symbols(algebra::expression const& expr)
+{
+    std::vector<algebra::expression> subexprs;
+    subexpressions(expr, subexprs);
+    std::vector<algebra::symbol> out;
+    for (auto const& e : subexprs) {
+        if (std::holds_alternative<algebra::symbol>(e)
+            && std::find(out.begin(), out.end(), std::get<algebra::symbol>(e)) == out.end()) {
+            out.push_back(std::get<algebra::symbol>(e));
+        }
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! return `expr` with its leaf at preorder index `index` replaced, counting
+//! down `index` past the leaves before it
+algebra::expression replace_leaf(algebra::expression const& expr, std::size_t& index, algebra::expression const& leaf)
+{
+    if (!std::holds_alternative<algebra::op>(expr)) {
+        return index-- == 0 ? leaf : expr;
+    }
+    algebra::op const& expr_op = std::get<algebra::op>(expr);
+    algebra::expression lhs = replace_leaf(expr_op.lhs, index, leaf);
+    if (std::holds_alternative<algebra::empty>((algebra::expression const&)expr_op.rhs)) {
+        return algebra::op{expr_op.type, lhs};
+    }
+    algebra::expression rhs = replace_leaf(expr_op.rhs, index, leaf);
+    return algebra::op{expr_op.type, lhs, rhs};
+}
+
+//------------------------------------------------------------------------------
+//! return `expr` followed by copies with one leaf each replaced by a new
+//! symbol, as in a stream of edits to the same expression
+std::vector<algebra::expression> edits(algebra::expression const& expr, std::size_t count)
+{
+    std::vector<algebra::expression> subexprs;
+    subexpressions(expr, subexprs);
+    std::size_t leaves = std::count_if(subexprs.begin(), subexprs.end(), [](algebra::expression const& e) {
+        return !std::holds_alternative<algebra::op>(e);
+    });
+
+    std::vector<algebra::expression> out{expr};
+    for (std::size_t ii = 1; ii <= count; ++ii) {
+        std::size_t index = ii * leaves / (count + 1);
+        out.push_back(replace_leaf(expr, index, algebra::symbol("w")));
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! benchmark body, returns the number of items processed so results can be
+//! reported per item
+struct benchmark
+{
+    std::string name;
+    std::function<std::size_t()> run;
+};
+
+//------------------------------------------------------------------------------
+struct measurement
+{
+    std::size_t iterations = 0;
+    std::size_t items = 0;
+    double seconds = 0;
+    std::size_t allocations = 0;
+    std::size_t allocated_bytes = 0;
+    std::size_t peak_heap_bytes = 0;
+    std::size_t peak_rss_kb = 0;
+};
+
+//------------------------------------------------------------------------------
+//! run a benchmark once to warm caches, then repeatedly for at least `min_time`
+measurement measure(benchmark const& b, double min_time)
+{
+    using clock = std::chrono::steady_clock;
+    b.run();
+
+    measurement out;
+    std::size_t allocations = allocation_count;
+    std::size_t bytes = allocation_bytes;
+    std::size_t live = live_bytes;
+    peak_live_bytes = live;
+
+    auto start = clock::now();
+    do {
+        out.items += b.run();
+        ++out.iterations;
+        out.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    } while (out.seconds < min_time);
+
+    out.allocations = allocation_count - allocations;
+    out.allocated_bytes = allocation_bytes - bytes;
+    out.peak_heap_bytes = peak_live_bytes - live;
+    out.peak_rss_kb = peak_rss_kb();
+    return out;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // usage: bench [--corpus file] [--filter substring] [--min-time seconds]
+    char const* corpus_path = BENCH_CORPUS;
+    std::string filter;
+    double min_time = 0.25;
+    for (int arg = 1; arg < argc; ++arg) {
+        if (arg + 1 < argc && std::strcmp(argv[arg], "--corpus") == 0) {
+            corpus_path = argv[++arg];
+        } else if (arg + 1 < argc && std::strcmp(argv[arg], "--filter") == 0) {
+            filter = argv[++arg];
+        } else if (arg + 1 < argc && std::strcmp(argv[arg], "--min-time") == 0) {
+            min_time = std::atof(argv[++arg]);
+        } else {
+            std::fprintf(stderr, "usage: bench [--corpus file] [--filter substring] [--min-time seconds]\n");
+            return 1;
+        }
+    }
+
+    corpus c;
+    if (!load_corpus(corpus_path, c)) {
+        return 1;
+    }
+    algebra::resolve_transforms();
+
+    std::vector<algebra::expression> exprs;
+    std::vector<algebra::expression> subexprs;
+    for (auto const& e : c.entries) {
+        exprs.push_back(e.expr);
+        subexpressions(e.expr, subexprs);
+    }
+
+    // candidate transforms of every subexpression, and the bindings of those
+    // which match for substitution, bindings refer into `subexprs`
+    struct candidate
+    {
+        algebra::expression const* expr;
+        algebra::pattern const* source;
+        algebra::pattern const* target;
+    };
+    std::vector<candidate> candidates;
+    std::vector<std::pair<candidate, algebra::bindings>> matches;
+    for (auto const& expr : subexprs) {
+        std::vector<algebra::transform_ref> refs;
+        algebra::transforms_index.retrieve(expr, refs);
+        for (auto const& ref : refs) {
+            algebra::transform const& tr = algebra::transforms[ref.index];
+            candidate cand{&expr, ref.reverse ? &tr.target : &tr.source, ref.reverse ? &tr.source : &tr.target};
+            candidates.push_back(cand);
+            algebra::bindings b;
+            if (algebra::match(*cand.source, expr, b)) {
+                matches.push_back({cand, b});
+            }
+        }
+    }
+
+    std::vector<benchmark> benchmarks;
+
+    for (auto const& section : c.sections) {
+        std::vector<std::string> lines;
+        for (auto const& e : c.entries) {
+            if (e.section == section) {
+                lines.push_back(e.text);
+            }
+        }
+        benchmarks.push_back({"parse/" + section, [lines]() {
+            static algebra::parser::context context;
+            for (auto const& line : lines) {
+                sink = context.parse(line).index();
+            }
+            return lines.size();
+        }});
+    }
+
+    benchmarks.push_back({"match", [&]() {
+        std::size_t matched = 0;
+        for (auto const& cand : candidates) {
+            algebra::bindings b;
+            matched += algebra::match(*cand.source, *cand.expr, b);
+        }
+        sink = matched;
+        return candidates.size();
+    }});
+
+    benchmarks.push_back({"apply_transform_r", [&]() {
+        for (auto const& m : matches) {
+            sink = algebra::apply_transform_r(*m.first.expr, m.first.target->expr, m.second).index();
+        }
+        return matches.size();
+    }});
+
+    // cold enumeration matches every subexpression, warm reuses cached roots
+    benchmarks.push_back({"for_each_rewrite/cold", [&]() {
+        algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+        std::size_t count = 0;
+        for (auto const& expr : exprs) {
+            algebra::for_each_rewrite(expr, cache, [&](algebra::rewrite const&) { ++count; return true; });
+        }
+        sink = count;
+        return exprs.size();
+    }});
+
+    benchmarks.push_back({"for_each_rewrite/warm", [&]() {
+        static algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+        std::size_t count = 0;
+        for (auto const& expr : exprs) {
+            algebra::for_each_rewrite(expr, cache, [&](algebra::rewrite const&) { ++count; return true; });
+        }
+        sink = count;
+        return exprs.size();
+    }});
+
+    benchmarks.push_back({"compare", [&]() {
+        std::size_t less = 0;
+        for (auto const& lhs : exprs) {
+            for (auto const& rhs : exprs) {
+                less += algebra::compare(lhs, rhs) < 0;
+            }
+        }
+        sink = less;
+        return exprs.size() * exprs.size();
+    }});
+
+    // end-to-end with a cold rewrite cache per call
+    std::pair<std::size_t, std::size_t> const limits[] = {{8, 32}, {16, 128}, {32, 256}};
+    for (auto const& limit : limits) {
+        for (auto const& section : c.sections) {
+            std::vector<algebra::expression> inputs;
+            for (auto const& e : c.entries) {
+                if (e.section == section) {
+                    inputs.push_back(e.expr);
+                }
+            }
+            std::string name = "simplify/" + std::to_string(limit.first) + "x" + std::to_string(limit.second) + "/" + section;
+            benchmarks.push_back({name, [inputs, limit]() {
+                algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+                algebra::simplify_options options;
+                options.max_operations = limit.first;
+                options.max_iterations = limit.second;
+                options.trace = false;
+                options.cache = &cache;
+                for (auto const& expr : inputs) {
+                    cache.clear();
+                    sink = algebra::op_count(algebra::simplify(expr, options));
+                }
+                return inputs.size();
+            }});
+        }
+    }
+
+    // larger searches with the frontier and the search state bounded, the
+    // peak heap of each is reported by the bench
+    struct bounded
+    {
+        char const* name;
+        std::size_t beam_width;
+        std::size_t max_memory;
+    };
+    bounded const bounds[] = {{"unbounded", 0, 0}, {"beam64", 64, 0}, {"memory64k", 0, 64 << 10}};
+    for (auto const& bound : bounds) {
+        for (auto const& section : c.sections) {
+            std::vector<algebra::expression> inputs;
+            for (auto const& e : c.entries) {
+                if (e.section == section) {
+                    inputs.push_back(e.expr);
+                }
+            }
+            std::string name = std::string("simplify/64x2048/") + bound.name + "/" + section;
+            benchmarks.push_back({name, [inputs, bound]() {
+                algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+                algebra::simplify_options options;
+                options.max_operations = 64;
+                options.max_iterations = 2048;
+                options.beam_width = bound.beam_width;
+                options.max_memory = bound.max_memory;
+                options.cache = &cache;
+                for (auto const& expr : inputs) {
+                    cache.clear();
+                    sink = algebra::op_count(algebra::simplify(expr, options));
+                }
+                return inputs.size();
+            }});
+        }
+    }
+
+    // streams of single-leaf edits, searched from scratch and incrementally
+    for (auto const& section : c.sections) {
+        std::vector<std::vector<algebra::expression>> streams;
+        for (auto const& e : c.entries) {
+            if (e.section == section) {
+                streams.push_back(edits(e.expr, 4));
+            }
+        }
+        benchmarks.push_back({"edits/simplify/" + section, [streams]() {
+            algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+            algebra::simplify_options options;
+            options.max_operations = 16;
+            options.max_iterations = 128;
+            options.cache = &cache;
+            std::size_t count = 0;
+            for (auto const& stream : streams) {
+                cache.clear();
+                for (auto const& expr : stream) {
+                    sink = algebra::op_count(algebra::simplify(expr, options));
+                    ++count;
+                }
+            }
+            return count;
+        }});
+        benchmarks.push_back({"edits/simplify_context/" + section, [streams]() {
+            algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+            algebra::simplify_options options;
+            options.max_operations = 16;
+            options.max_iterations = 128;
+            options.cache = &cache;
+            std::size_t count = 0;
+            for (auto const& stream : streams) {
+                cache.clear();
+                algebra::simplify_context context(options);
+                for (auto const& expr : stream) {
+                    sink = algebra::op_count(context.simplify(expr));
+                    ++count;
+                }
+            }
+            return count;
+        }});
+    }
+
+    // every partial derivative of each expression, by searching for the
+    // derivative rules, directly, and numerically in reverse mode
+    for (auto const& section : c.sections) {
+        std::vector<algebra::expression> inputs;
+        for (auto const& e : c.entries) {
+            if (e.section == section) {
+                inputs.push_back(e.expr);
+            }
+        }
+        benchmarks.push_back({"jacobian/simplify/" + section, [inputs]() {
+            algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+            algebra::simplify_options options;
+            options.max_operations = 16;
+            options.max_iterations = 128;
+            options.normalize = false;
+            options.cache = &cache;
+            std::size_t count = 0;
+            for (auto const& expr : inputs) {
+                cache.clear();
+                for (auto const& var : symbols(expr)) {
+                    sink = algebra::op_count(algebra::simplify(algebra::op{algebra::op_type::derivative, expr, algebra::expression(var)}, options));
+                    ++count;
+                }
+            }
+            return count;
+        }});
+        benchmarks.push_back({"jacobian/differentiate/" + section, [inputs]() {
+            std::size_t count = 0;
+            for (auto const& expr : inputs) {
+                for (auto const& var : symbols(expr)) {
+                    sink = algebra::op_count(algebra::differentiate(expr, var));
+                    ++count;
+                }
+            }
+            return count;
+        }});
+
+        std::vector<algebra::program> programs;
+        std::size_t slots = 1;
+        for (auto const& expr : inputs) {
+            if (algebra::evaluable(expr)) {
+                programs.emplace_back(expr);
+                slots = std::max(slots, programs.back().slots().size());
+            }
+        }
+        if (!programs.size()) {
+            continue;
+        }
+        benchmarks.push_back({"jacobian/gradient/" + section, [programs, slots]() {
+            std::vector<double> in(slots, 0.5);
+            std::vector<double> gradient(slots);
+            std::size_t count = 0;
+            for (auto const& p : programs) {
+                p.gradient(in.data(), gradient.data());
+                sink = std::size_t(gradient[0] != 0);
+                count += p.slots().size();
+            }
+            return count;
+        }});
+    }
+
+    std::printf("{\n");
+    std::printf("  \"format\": 1,\n");
+    std::printf("  \"corpus\": \"%s\",\n", c.version.c_str());
+    std::printf("  \"expressions\": %zu,\n", c.entries.size());
+    std::printf("  \"results\": [");
+    bool first = true;
+    for (auto const& b : benchmarks) {
+        if (filter.size() && b.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        measurement m = measure(b, min_time);
+        double n = double(std::max<std::size_t>(m.items, 1));
+        std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"items\": %zu, \"ns_per_item\": %.1f, "
+                    "\"allocations_per_item\": %.2f, \"bytes_per_item\": %.1f, \"peak_heap_bytes\": %zu, \"peak_rss_kb\": %zu}",
+                    first ? "" : ",", b.name.c_str(), m.iterations, m.items, m.seconds * 1e9 / n,
+                    double(m.allocations) / n, double(m.allocated_bytes) / n, m.peak_heap_bytes, m.peak_rss_kb);
+        std::fflush(stdout);
+        first = false;
+    }
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
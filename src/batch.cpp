@@ -0,0 +1,127 @@
+// batch.cpp
+//
+
+#include "batch.h"
+
+#include <algorithm>
+#include <optional>
+#include <thread>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+void simplify_batch(
+    std::function<bool(expression&)> const& read,
+    std::function<void(expression const&)> const& write,
+    batch_options const& options)
+{
+    std::size_t workers = options.workers ? options.workers
+                                          : std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    std::size_t window = std::max<std::size_t>(options.queue_size, 1);
+
+    struct item
+    {
+        std::size_t index;
+        expression expr;
+    };
+
+    bounded_queue<item> input(window);
+
+    // results are stored in a ring of `window` slots and the reader never gets
+    // more than `window` expressions ahead of the writer, so slots are unique
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::vector<std::optional<expression>> results(window);
+    std::size_t written = 0;
+    std::size_t total = SIZE_MAX;
+
+    std::thread reader([&]() {
+        std::size_t index = 0;
+        expression expr;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                space.wait(lock, [&]() { return index < written + window; });
+            }
+            if (!read(expr)) {
+                break;
+            }
+            input.push({index++, expr});
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            total = index;
+        }
+        ready.notify_all();
+        input.close();
+    });
+
+    std::vector<std::thread> threads;
+    for (std::size_t ii = 0; ii < workers; ++ii) {
+        threads.emplace_back([&]() {
+            memo<expression, rewrite_set> cache(options.cache);
+            simplify_options worker_options = options.simplify;
+            worker_options.trace = false;
+            worker_options.cache = &cache;
+
+            item next;
+            while (input.pop(next)) {
+                expression result = simplify(next.expr, worker_options);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results[next.index % window] = std::move(result);
+                }
+                ready.notify_all();
+            }
+        });
+    }
+
+    // write results in input order on the calling thread
+    while (true) {
+        expression result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&]() { return written == total || results[written % window]; });
+            if (written == total) {
+                break;
+            }
+            result = std::move(*results[written % window]);
+            results[written % window].reset();
+            ++written;
+        }
+        space.notify_one();
+        write(result);
+    }
+
+    reader.join();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+std::vector<expression> simplify_batch(std::vector<expression> const& exprs, batch_options const& options)
+{
+    std::vector<expression> out;
+    out.reserve(exprs.size());
+
+    std::size_t next = 0;
+    simplify_batch(
+        [&](expression& expr) {
+            if (next >= exprs.size()) {
+                return false;
+            }
+            expr = exprs[next++];
+            return true;
+        },
+        [&](expression const& expr) {
+            out.push_back(expr);
+        },
+        options);
+
+    return out;
+}
+
+} // namespace algebra
@@ -0,0 +1,99 @@
+// batch.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! first-in first-out queue which blocks producers when full
+template<typename T> class bounded_queue
+{
+public:
+    bounded_queue(std::size_t capacity)
+        : _capacity(capacity ? capacity : 1)
+        , _closed(false)
+    {}
+
+    //! wait for space and append a value, returns false if the queue is closed
+    bool push(T value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this]() { return _closed || _values.size() < _capacity; });
+        if (_closed) {
+            return false;
+        }
+        _values.push_back(std::move(value));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    //! wait for a value and remove it, returns false once the queue is closed
+    //! and all values have been removed
+    bool pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this]() { return _closed || _values.size(); });
+        if (!_values.size()) {
+            return false;
+        }
+        value = std::move(_values.front());
+        _values.pop_front();
+        _not_full.notify_one();
+        return true;
+    }
+
+    //! reject further values and wake all waiting threads
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+protected:
+    std::size_t _capacity;
+    bool _closed;
+    std::deque<T> _values;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+};
+
+//------------------------------------------------------------------------------
+//! parameters for `simplify_batch`
+struct batch_options
+{
+    //! options for each expression, `trace` and `cache` are ignored
+    simplify_options simplify;
+    //! number of worker threads, zero uses one per hardware thread
+    std::size_t workers = 0;
+    //! maximum number of expressions read but not yet written
+    std::size_t queue_size = 1024;
+    //! limits for the private rewrite cache of each worker
+    memo_config cache;
+};
+
+//------------------------------------------------------------------------------
+//! simplify a stream of expressions on a pool of workers
+//!
+//! `read` is called from a dedicated reader thread until it returns false, and
+//! `write` is called on the calling thread with each result in input order.
+//! Workers share the built-in transforms but keep their own rewrite caches.
+void simplify_batch(
+    std::function<bool(expression&)> const& read,
+    std::function<void(expression const&)> const& write,
+    batch_options const& options = {});
+
+//------------------------------------------------------------------------------
+std::vector<expression> simplify_batch(std::vector<expression> const& exprs, batch_options const& options = {});
+
+} // namespace algebra
@@ -0,0 +1,298 @@
+// codegen.cpp
+//
+
+#include "codegen.h"
+#include "evaluate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#if __has_include(<dlfcn.h>)
+#   include <dlfcn.h>
+#   include <unistd.h>
+#   define CODEGEN_HAS_DLOPEN 1
+#else
+#   define CODEGEN_HAS_DLOPEN 0
+#endif
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! return a double literal which round-trips `v`
+std::string cpp_literal(double v)
+{
+    if (std::isnan(v)) {
+        return "NAN";
+    } else if (std::isinf(v)) {
+        return v < 0 ? "-HUGE_VAL" : "HUGE_VAL";
+    }
+
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.17g", v);
+    std::string out = buf;
+    if (out.find_first_of(".e") == std::string::npos) {
+        out += ".0";
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! state for emitting the body of the scalar function
+struct cpp_emitter
+{
+    expression_dag const& dag;
+    std::vector<symbol> const& slots;
+    std::vector<std::string> lines;
+    //! name bound to each emitted node, inputs are loaded when they are first
+    //! used and every operation is bound once however often it is used
+    std::vector<std::string> names;
+    std::size_t constants = 0;
+    std::size_t temporaries = 0;
+
+    //------------------------------------------------------------------------------
+    std::string emit_r(std::uint32_t id)
+    {
+        if (names[id].size()) {
+            return names[id];
+        }
+
+        auto const& n = dag.nodes()[id];
+        expression const& expr = n.expr;
+        std::string name;
+        if (std::holds_alternative<op>(expr) && !symbol_count(expr)) {
+            // fold with the evaluator, subexpressions without symbols have
+            // no inputs
+            name = "c" + std::to_string(constants++);
+            lines.push_back("    constexpr double " + name + " = " + cpp_literal(program(expr)(nullptr)) + "; // " + to_string(expr));
+        } else if (std::holds_alternative<op>(expr)) {
+            std::string a = emit_r(n.lhs);
+            std::string b = n.rhs == expression_dag::no_node ? std::string() : emit_r(n.rhs);
+            name = "t" + std::to_string(temporaries++);
+            lines.push_back("    double const " + name + " = " + emit_op(std::get<op>(expr), a, b) + ";");
+        } else if (std::holds_alternative<symbol>(expr)) {
+            auto slot = std::find(slots.begin(), slots.end(), std::get<symbol>(expr));
+            assert(slot != slots.end());
+            std::string index = std::to_string(slot - slots.begin());
+            name = "s" + index;
+            lines.push_back("    double const " + name + " = inputs[" + index + "]; // " + slot->name());
+        } else if (std::holds_alternative<value>(expr)) {
+            name = cpp_literal(std::get<value>(expr));
+        } else if (std::holds_alternative<constant>(expr)) {
+            switch (std::get<constant>(expr)) {
+                case constant::pi: name = cpp_literal(M_PI); break;
+                case constant::e: name = cpp_literal(M_E); break;
+                default: name = "NAN"; break;
+            }
+        } else {
+            assert(0);
+        }
+
+        names[id] = name;
+        return name;
+    }
+
+    //------------------------------------------------------------------------------
+    static std::string emit_op(op const& expr_op, std::string const& a, std::string const& b)
+    {
+        expression const& rhs = expr_op.rhs;
+        switch (expr_op.type) {
+            case op_type::sum: return a + " + " + b;
+            case op_type::difference: return a + " - " + b;
+            case op_type::negative: return "-" + a;
+            case op_type::product: return a + " * " + b;
+            case op_type::quotient: return a + " / " + b;
+            case op_type::reciprocal: return "1.0 / " + a;
+            case op_type::exponent:
+                if (rhs == expression(2.0)) {
+                    return a + " * " + a;
+                }
+                return "std::pow(" + a + ", " + b + ")";
+            case op_type::logarithm:
+                if (rhs == expression(constant::e)) {
+                    return "std::log(" + a + ")";
+                } else if (rhs == expression(2.0)) {
+                    return "std::log2(" + a + ")";
+                } else if (rhs == expression(10.0)) {
+                    return "std::log10(" + a + ")";
+                }
+                return "std::log(" + a + ") / std::log(" + b + ")";
+            case op_type::sine: return "std::sin(" + a + ")";
+            case op_type::cosine: return "std::cos(" + a + ")";
+            case op_type::tangent: return "std::tan(" + a + ")";
+            case op_type::secant: return "1.0 / std::cos(" + a + ")";
+            case op_type::cosecant: return "1.0 / std::sin(" + a + ")";
+            case op_type::cotangent: return "1.0 / std::tan(" + a + ")";
+            case op_type::arcsine: return "std::asin(" + a + ")";
+            case op_type::arccosine: return "std::acos(" + a + ")";
+            case op_type::arctangent: return "std::atan(" + a + ")";
+            case op_type::arcsecant: return "std::acos(1.0 / " + a + ")";
+            case op_type::arccosecant: return "std::asin(1.0 / " + a + ")";
+            case op_type::arccotangent: return "std::atan(1.0 / " + a + ")";
+            default: assert(0); return "NAN";
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+std::string to_cpp(expression const& expr, codegen_options const& options)
+{
+    expression_dag dag(expr);
+    if (!evaluable(dag)) {
+        return "";
+    }
+
+    // slots are assigned the same way as for the evaluator
+    std::vector<symbol> slots = program(dag, options.slots).slots();
+
+    cpp_emitter emitter{dag, slots, {}, std::vector<std::string>(dag.nodes().size())};
+    std::string result = emitter.emit_r(dag.root());
+
+    std::ostringstream out;
+    out << "// generated from " << to_string(expr) << "\n";
+    out << "\n";
+    out << "#include <cmath>\n";
+    out << "#include <cstddef>\n";
+    out << "\n";
+    out << "extern \"C\" double " << options.name << "(double const* inputs)\n";
+    out << "{\n";
+    if (!symbol_count(expr)) {
+        out << "    (void)inputs;\n";
+    }
+    for (auto const& line : emitter.lines) {
+        out << line << "\n";
+    }
+    out << "    return " << result << ";\n";
+    out << "}\n";
+
+    if (options.batch) {
+        out << "\n";
+        out << "extern \"C\" void " << options.name << "_batch(double const* const* columns, std::size_t rows, double* out)\n";
+        out << "{\n";
+        if (!slots.size()) {
+            out << "    (void)columns;\n";
+        }
+        out << "    for (std::size_t ii = 0; ii < rows; ++ii) {\n";
+        out << "        double const inputs[" << std::max<std::size_t>(slots.size(), 1) << "] = {";
+        for (std::size_t ii = 0; ii < slots.size(); ++ii) {
+            out << (ii ? ", " : "") << "columns[" << ii << "][ii]";
+        }
+        out << "};\n";
+        out << "        out[ii] = " << options.name << "(inputs);\n";
+        out << "    }\n";
+        out << "}\n";
+    }
+
+    return out.str();
+}
+
+//------------------------------------------------------------------------------
+native_function::native_function(expression const& expr, codegen_options const& options)
+    : _module(nullptr)
+    , _scalar(nullptr)
+    , _batch(nullptr)
+    , _slots(program(expr, options.slots).slots())
+{
+#if CODEGEN_HAS_DLOPEN
+    std::string source = to_cpp(expr, options);
+    if (!source.size()) {
+        _error = "expression is not evaluable";
+        return;
+    }
+
+    // unique per process and per module so concurrent compiles don't collide
+    static std::atomic<std::size_t> count{0};
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path base = fs::temp_directory_path(ec);
+    if (ec) {
+        _error = "no temporary directory: " + ec.message();
+        return;
+    }
+    base /= "algebra_" + std::to_string(::getpid()) + "_" + std::to_string(count++);
+    fs::path source_path = base.string() + ".cpp";
+    fs::path module_path = base.string() + ".so";
+    fs::path log_path = base.string() + ".log";
+
+    std::ofstream(source_path) << source;
+
+    std::string compiler = options.compiler;
+    if (!compiler.size()) {
+        char const* env = std::getenv("CXX");
+        compiler = env && *env ? env : "c++";
+    }
+    std::string command = compiler + " " + options.flags + " -shared -fPIC"
+        + " -o \"" + module_path.string() + "\""
+        + " \"" + source_path.string() + "\""
+        + " > \"" + log_path.string() + "\" 2>&1";
+
+    if (std::system(command.c_str()) != 0) {
+        std::ifstream log(log_path);
+        std::ostringstream text;
+        text << log.rdbuf();
+        _error = "compilation failed: " + command + "\n" + text.str();
+    } else if (!(_module = dlopen(module_path.c_str(), RTLD_NOW | RTLD_LOCAL))) {
+        _error = std::string("dlopen failed: ") + dlerror();
+    } else {
+        _scalar = reinterpret_cast<scalar_fn>(dlsym(_module, options.name.c_str()));
+        if (options.batch) {
+            _batch = reinterpret_cast<batch_fn>(dlsym(_module, (options.name + "_batch").c_str()));
+        }
+        if (!_scalar) {
+            _error = "missing symbol " + options.name;
+        }
+    }
+
+    // the loaded module stays mapped after its file is removed
+    fs::remove(source_path, ec);
+    fs::remove(module_path, ec);
+    fs::remove(log_path, ec);
+#else
+    (void)expr;
+    (void)options;
+    _error = "loading modules is not supported on this platform";
+#endif
+}
+
+//------------------------------------------------------------------------------
+native_function::~native_function()
+{
+#if CODEGEN_HAS_DLOPEN
+    if (_module) {
+        dlclose(_module);
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+native_function::native_function(native_function&& other)
+    : _module(other._module)
+    , _scalar(other._scalar)
+    , _batch(other._batch)
+    , _slots(std::move(other._slots))
+    , _error(std::move(other._error))
+{
+    other._module = nullptr;
+    other._scalar = nullptr;
+    other._batch = nullptr;
+}
+
+//------------------------------------------------------------------------------
+native_function& native_function::operator=(native_function&& other)
+{
+    // the previous module is released when `other` is destroyed
+    std::swap(_module, other._module);
+    std::swap(_scalar, other._scalar);
+    std::swap(_batch, other._batch);
+    std::swap(_slots, other._slots);
+    std::swap(_error, other._error);
+    return *this;
+}
+
+} // namespace algebra
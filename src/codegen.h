@@ -0,0 +1,78 @@
+// codegen.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <string>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! parameters for `to_cpp` and `native_function`
+struct codegen_options
+{
+    //! name of the generated function, the batch function appends `_batch`
+    std::string name = "evaluate";
+    //! symbols bound to inputs in this order, other symbols follow them in
+    //! order of appearance as for `program`
+    std::vector<symbol> slots;
+    //! also emit a function which evaluates columns of inputs
+    bool batch = true;
+
+    //! compiler used by `native_function`, empty uses $CXX or `c++`
+    std::string compiler;
+    //! flags passed to the compiler in addition to those needed for a module
+    std::string flags = "-O2";
+};
+
+//------------------------------------------------------------------------------
+//! return C++ source for a function evaluating `expr`
+//!
+//! The function is `extern "C" double name(double const* inputs)` with one
+//! input per slot. Its body is straight-line code with one constant per node
+//! of the `expression_dag` so shared subexpressions are computed once, and
+//! subexpressions without symbols are folded into `constexpr` constants. The
+//! batch function is `extern "C" void name_batch(double const* const* columns,
+//! std::size_t rows, double* out)`. Returns an empty string if the expression
+//! is not `evaluable`.
+std::string to_cpp(expression const& expr, codegen_options const& options = {});
+
+//------------------------------------------------------------------------------
+//! expression compiled to native code by the system compiler and loaded into
+//! the process
+class native_function
+{
+public:
+    using scalar_fn = double (*)(double const* inputs);
+    using batch_fn = void (*)(double const* const* columns, std::size_t rows, double* out);
+
+    native_function(expression const& expr, codegen_options const& options = {});
+    ~native_function();
+
+    native_function(native_function&& other);
+    native_function& operator=(native_function&& other);
+    native_function(native_function const&) = delete;
+    native_function& operator=(native_function const&) = delete;
+
+    //! false if generation, compilation or loading failed, see `error`
+    bool valid() const { return _scalar != nullptr; }
+    std::string const& error() const { return _error; }
+
+    //! symbols in input order
+    std::vector<symbol> const& slots() const { return _slots; }
+
+    double operator()(double const* inputs) const { return _scalar(inputs); }
+    //! evaluate columns of inputs, only if `codegen_options::batch` was set
+    void evaluate(double const* const* columns, std::size_t rows, double* out) const { _batch(columns, rows, out); }
+
+protected:
+    void* _module;
+    scalar_fn _scalar;
+    batch_fn _batch;
+    std::vector<symbol> _slots;
+    std::string _error;
+};
+
+} // namespace algebra
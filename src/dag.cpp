@@ -0,0 +1,88 @@
+// dag.cpp
+//
+
+#include "dag.h"
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+expression_dag::expression_dag(expression const& expr)
+{
+    add_r(expr);
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t expression_dag::add(expression const& expr)
+{
+    return add_r(expr);
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t expression_dag::add_r(expression const& expr)
+{
+    auto it = _index.find(expr);
+    if (it != _index.end()) {
+        return it->second;
+    }
+
+    node n{expr, no_node, no_node, 0};
+    if (std::holds_alternative<op>(expr)) {
+        op const& expr_op = std::get<op>(expr);
+        n.lhs = add_r(expr_op.lhs);
+        ++_nodes[n.lhs].uses;
+        if (!std::holds_alternative<empty>((expression const&)expr_op.rhs)) {
+            n.rhs = add_r(expr_op.rhs);
+            ++_nodes[n.rhs].uses;
+        }
+    }
+
+    std::uint32_t id = std::uint32_t(_nodes.size());
+    _nodes.push_back(n);
+    _index[expr] = id;
+    return id;
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::uint32_t> expression_dag::bindings() const
+{
+    std::vector<std::uint32_t> out;
+    for (std::uint32_t id = 0; id < _nodes.size(); ++id) {
+        if (shared(id)) {
+            out.push_back(id);
+        }
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+std::string to_string(expression_dag const& dag)
+{
+    auto const& nodes = dag.nodes();
+
+    // nodes are converted in order so operands are always available, and
+    // shared operations are referred to by name after their binding
+    std::vector<std::string> strings(nodes.size());
+    std::string out;
+    std::size_t bound = 0;
+    for (std::uint32_t id = 0; id < nodes.size(); ++id) {
+        auto const& n = nodes[id];
+        if (std::holds_alternative<op>(n.expr)) {
+            strings[id] = to_string(
+                std::get<op>(n.expr).type,
+                strings[n.lhs],
+                n.rhs == expression_dag::no_node ? std::string() : strings[n.rhs]);
+        } else {
+            strings[id] = to_string(n.expr);
+        }
+
+        if (dag.shared(id)) {
+            std::string name = "#" + std::to_string(bound);
+            out += (bound++ ? ", " : "let ") + name + " = " + strings[id];
+            strings[id] = name;
+        }
+    }
+
+    return bound ? out + " in " + strings[dag.root()] : strings[dag.root()];
+}
+
+} // namespace algebra
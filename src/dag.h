@@ -0,0 +1,70 @@
+// dag.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! expression with each distinct subexpression stored once
+//!
+//! Operands are interned so equal subexpressions already share storage, but
+//! walking an expression as a tree visits every occurrence, which for rewrites
+//! like the product rule is exponential in the nesting depth. Nodes here are
+//! listed once in dependency order with the number of times they are used, so
+//! consumers can bind shared operations to a name or register and compute them
+//! once.
+class expression_dag
+{
+public:
+    static constexpr std::uint32_t no_node = UINT32_MAX;
+
+    struct node
+    {
+        expression expr;    //!< subexpression rooted at this node
+        std::uint32_t lhs;  //!< operand nodes of an operation, or `no_node`
+        std::uint32_t rhs;
+        std::uint32_t uses; //!< number of operations using this node as an operand
+    };
+
+    expression_dag() = default;
+    explicit expression_dag(expression const& expr);
+
+    //! add another root sharing nodes with the expressions already added,
+    //! returns its node
+    std::uint32_t add(expression const& expr);
+
+    //! operands precede the operations using them
+    std::vector<node> const& nodes() const { return _nodes; }
+    //! last node, the root of a DAG constructed from a single expression
+    std::uint32_t root() const { return std::uint32_t(_nodes.size() - 1); }
+
+    //! true for operations used more than once, which should be let-bound
+    bool shared(std::uint32_t id) const
+    {
+        return _nodes[id].uses > 1 && std::holds_alternative<op>(_nodes[id].expr);
+    }
+
+    //! shared operations in dependency order
+    std::vector<std::uint32_t> bindings() const;
+
+protected:
+    std::vector<node> _nodes;
+    std::unordered_map<expression, std::uint32_t> _index;
+
+protected:
+    std::uint32_t add_r(expression const& expr);
+};
+
+//------------------------------------------------------------------------------
+//! return a representation with each shared operation let-bound, e.g.
+//! `let #0 = (x + y) in (sin(#0) * #0)`
+std::string to_string(expression_dag const& dag);
+
+} // namespace algebra
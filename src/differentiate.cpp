@@ -0,0 +1,235 @@
+// differentiate.cpp
+//
+
+#include "differentiate.h"
+
+#include <unordered_map>
+
+namespace algebra {
+
+namespace {
+
+//------------------------------------------------------------------------------
+//! construction of derivative terms, operations on zero and one are removed
+//! since most partial derivatives of a large expression are one of them
+bool is_value(expression const& expr, value v)
+{
+    return std::holds_alternative<value>(expr) && std::get<value>(expr) == v;
+}
+
+expression add(expression const& a, expression const& b)
+{
+    return is_value(a, 0) ? b : is_value(b, 0) ? a : expression(op{op_type::sum, a, b});
+}
+
+//! operand of a negation, or empty
+expression negated(expression const& expr)
+{
+    if (std::holds_alternative<op>(expr) && std::get<op>(expr).type == op_type::negative) {
+        return std::get<op>(expr).lhs;
+    }
+    return {};
+}
+
+expression negate(expression const& a)
+{
+    expression const n = negated(a);
+    return is_value(a, 0) ? a : !std::holds_alternative<empty>(n) ? n : expression(op{op_type::negative, a});
+}
+
+expression subtract(expression const& a, expression const& b)
+{
+    return is_value(b, 0) ? a : is_value(a, 0) ? negate(b) : expression(op{op_type::difference, a, b});
+}
+
+expression multiply(expression const& a, expression const& b)
+{
+    if (is_value(a, 0) || is_value(b, 0)) {
+        return 0.0;
+    }
+    if (is_value(negated(a), 1)) {
+        return negate(b);
+    } else if (is_value(negated(b), 1)) {
+        return negate(a);
+    }
+    return is_value(a, 1) ? b : is_value(b, 1) ? a : expression(op{op_type::product, a, b});
+}
+
+expression divide(expression const& a, expression const& b)
+{
+    expression const n = negated(a);
+    if (!std::holds_alternative<empty>(n)) {
+        return negate(op{op_type::quotient, n, b});
+    }
+    return is_value(a, 0) || is_value(b, 1) ? a : expression(op{op_type::quotient, a, b});
+}
+
+expression power(expression const& a, expression const& b)
+{
+    return is_value(b, 1) ? a : is_value(b, 0) ? expression(1.0) : expression(op{op_type::exponent, a, b});
+}
+
+expression ln(expression const& a)
+{
+    return a == expression(constant::e) ? expression(1.0) : expression(op{op_type::logarithm, a, expression(constant::e)});
+}
+
+expression square_root(expression const& a)
+{
+    return power(a, op{op_type::quotient, expression(1.0), expression(2.0)});
+}
+
+//------------------------------------------------------------------------------
+//! state for differentiating each distinct subexpression once
+struct differentiator
+{
+    symbol var;
+    std::unordered_map<expression, expression> derivatives;
+
+    //------------------------------------------------------------------------------
+    expression derivative_r(expression const& expr)
+    {
+        if (std::holds_alternative<symbol>(expr)) {
+            return std::get<symbol>(expr) == var ? 1.0 : 0.0;
+        } else if (!std::holds_alternative<op>(expr)) {
+            return std::holds_alternative<placeholder>(expr) ? unevaluated(expr) : expression(0.0);
+        } else if (!std::get<op>(expr).symbols && !std::get<op>(expr).placeholders) {
+            return 0.0;
+        }
+
+        auto it = derivatives.find(expr);
+        if (it != derivatives.end()) {
+            return it->second;
+        }
+        expression out = derivative_op(expr);
+        derivatives.emplace(expr, out);
+        return out;
+    }
+
+    //------------------------------------------------------------------------------
+    expression unevaluated(expression const& expr) const
+    {
+        return op{op_type::derivative, expr, expression(var)};
+    }
+
+    //------------------------------------------------------------------------------
+    expression derivative_op(expression const& expr)
+    {
+        op const& expr_op = std::get<op>(expr);
+        expression const& f = expr_op.lhs;
+        expression const& g = expr_op.rhs;
+
+        // derivatives of operands are only taken where they are used
+        auto df = [&]() { return derivative_r(f); };
+        auto dg = [&]() { return derivative_r(g); };
+
+        switch (expr_op.type) {
+            case op_type::equality: return op{op_type::equality, df(), dg()};
+            case op_type::sum: return add(df(), dg());
+            case op_type::difference: return subtract(df(), dg());
+            case op_type::negative: return negate(df());
+            case op_type::product: return add(multiply(df(), g), multiply(f, dg()));
+            case op_type::quotient:
+                return divide(subtract(multiply(df(), g), multiply(f, dg())), power(g, 2.0));
+            case op_type::reciprocal: return negate(divide(df(), power(f, 2.0)));
+
+            case op_type::exponent: {
+                expression const dfv = df();
+                expression const dgv = dg();
+                // power rule for constant exponents, which covers polynomials
+                if (is_value(dgv, 0)) {
+                    // folded here so `x ^ 2` gives `x` rather than `x ^ 1`
+                    expression const exponent = fold(op{op_type::difference, g, expression(1.0)});
+                    return multiply(multiply(g, power(f, exponent)), dfv);
+                }
+                // f^g * (g' ln f + g f' / f)
+                return multiply(expr, add(multiply(dgv, ln(f)), divide(multiply(g, dfv), f)));
+            }
+            case op_type::logarithm: {
+                expression const dfv = df();
+                expression const dgv = dg();
+                if (is_value(dgv, 0)) {
+                    return divide(dfv, multiply(f, ln(g)));
+                }
+                // quotient rule on ln f / ln g
+                return divide(
+                    subtract(multiply(divide(dfv, f), ln(g)), multiply(ln(f), divide(dgv, g))),
+                    power(ln(g), 2.0));
+            }
+
+            // chain rule for functions of one operand
+            case op_type::sine: return multiply(df(), op{op_type::cosine, f});
+            case op_type::cosine: return negate(multiply(df(), op{op_type::sine, f}));
+            case op_type::tangent: return multiply(df(), power(op{op_type::secant, f}, 2.0));
+            case op_type::secant: return multiply(df(), multiply(expr, op{op_type::tangent, f}));
+            case op_type::cosecant: return negate(multiply(df(), multiply(expr, op{op_type::cotangent, f})));
+            case op_type::cotangent: return negate(multiply(df(), power(op{op_type::cosecant, f}, 2.0)));
+            case op_type::arcsine: return divide(df(), square_root(subtract(1.0, power(f, 2.0))));
+            case op_type::arccosine: return negate(divide(df(), square_root(subtract(1.0, power(f, 2.0)))));
+            case op_type::arctangent: return divide(df(), add(1.0, power(f, 2.0)));
+            // f^2 sqrt(1 - f^-2) is |f| sqrt(f^2 - 1) without an absolute value
+            case op_type::arcsecant:
+                return divide(df(), multiply(power(f, 2.0), square_root(subtract(1.0, power(f, op{op_type::negative, expression(2.0)})))));
+            case op_type::arccosecant:
+                return negate(divide(df(), multiply(power(f, 2.0), square_root(subtract(1.0, power(f, op{op_type::negative, expression(2.0)}))))));
+            case op_type::arccotangent: return negate(divide(df(), add(1.0, power(f, 2.0))));
+
+            case op_type::derivative:
+                if (std::holds_alternative<symbol>(g)) {
+                    expression inner = differentiate(f, std::get<symbol>(g));
+                    if (!std::holds_alternative<op>(inner) || std::get<op>(inner).type != op_type::derivative) {
+                        return derivative_r(inner);
+                    }
+                }
+                return unevaluated(expr);
+
+            case op_type::integral:
+            case op_type::differential:
+            default:
+                return unevaluated(expr);
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+//! bottom-up, shared subexpressions are visited once
+expression eliminate_derivatives_r(expression const& expr, std::unordered_map<expression, expression>& eliminated)
+{
+    if (!std::holds_alternative<op>(expr)) {
+        return expr;
+    }
+    auto it = eliminated.find(expr);
+    if (it != eliminated.end()) {
+        return it->second;
+    }
+
+    op const& expr_op = std::get<op>(expr);
+    expression lhs = eliminate_derivatives_r(expr_op.lhs, eliminated);
+    expression rhs = eliminate_derivatives_r(expr_op.rhs, eliminated);
+    expression out;
+    if (expr_op.type == op_type::derivative && std::holds_alternative<symbol>(rhs)) {
+        out = differentiate(lhs, std::get<symbol>(rhs));
+    } else {
+        out = lhs == expr_op.lhs && rhs == expr_op.rhs ? expr : expression(op{expr_op.type, lhs, rhs});
+    }
+    eliminated.emplace(expr, out);
+    return out;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+expression differentiate(expression const& expr, symbol var)
+{
+    differentiator d{var, {}};
+    return fold(d.derivative_r(expr));
+}
+
+//------------------------------------------------------------------------------
+expression eliminate_derivatives(expression const& expr)
+{
+    std::unordered_map<expression, expression> eliminated;
+    return eliminate_derivatives_r(expr, eliminated);
+}
+
+} // namespace algebra
@@ -0,0 +1,25 @@
+// differentiate.h
+//
+
+#pragma once
+#include "expression.h"
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! return the derivative of `expr` with respect to `var`
+//!
+//! Every operation with a numeric derivative is differentiated directly, in
+//! one pass over the distinct subexpressions of `expr` so the size of the
+//! result is linear in the size of its DAG. Derivatives of nested `d/dy(...)`
+//! are evaluated first. Terms with a zero derivative are left out and numbers
+//! are folded, but the result is not otherwise simplified. Integrals and
+//! differentials are left as derivative operations.
+expression differentiate(expression const& expr, symbol var);
+
+//------------------------------------------------------------------------------
+//! return `expr` with every derivative operation with respect to a symbol
+//! replaced by `differentiate` of its operand
+expression eliminate_derivatives(expression const& expr);
+
+} // namespace algebra
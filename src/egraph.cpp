@@ -0,0 +1,602 @@
+// egraph.cpp
+//
+
+#include "egraph.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <string>
+#include <tuple>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+std::size_t egraph::node_hash::operator()(node const& n) const
+{
+    std::size_t h = hash(n.leaf);
+    auto combine = [&h](std::size_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    };
+
+    combine(static_cast<std::size_t>(n.type));
+    combine(n.lhs);
+    combine(n.rhs);
+    return h;
+}
+
+//------------------------------------------------------------------------------
+//! leaves first, then operators grouped by type so they can be matched by range
+bool node_order(egraph::node const& lhs, egraph::node const& rhs)
+{
+    if (lhs.is_op() != rhs.is_op()) {
+        return rhs.is_op();
+    }
+    return lhs.is_op() && lhs.type < rhs.type;
+}
+
+//------------------------------------------------------------------------------
+egraph::class_id egraph::add(expression const& expr)
+{
+    if (std::holds_alternative<op>(expr)) {
+        op const& expr_op = std::get<op>(expr);
+        return add(node{expr_op.type, add(*expr_op.lhs), add(*expr_op.rhs), {}});
+    } else {
+        return add(node{op_type{}, no_class, no_class, expr});
+    }
+}
+
+//------------------------------------------------------------------------------
+egraph::class_id egraph::add(expression const& pattern, substitution const& s)
+{
+    if (std::holds_alternative<op>(pattern)) {
+        op const& pattern_op = std::get<op>(pattern);
+        return add(node{pattern_op.type, add(*pattern_op.lhs, s), add(*pattern_op.rhs, s), {}});
+    } else if (std::holds_alternative<placeholder>(pattern)) {
+        std::size_t index = static_cast<std::size_t>(std::get<placeholder>(pattern));
+        assert(s.mask & (1u << index));
+        return find(s.classes[index]);
+    } else {
+        return add(pattern);
+    }
+}
+
+//------------------------------------------------------------------------------
+egraph::class_id egraph::add(node n)
+{
+    n = canonical(n);
+    auto it = _memo.find(n);
+    if (it != _memo.end()) {
+        return find(it->second);
+    }
+
+    class_id id = static_cast<class_id>(_classes.size());
+    _parent.push_back(id);
+    _classes.push_back({{n}});
+    _memo.emplace(n, id);
+    ++_size;
+    return id;
+}
+
+//------------------------------------------------------------------------------
+egraph::class_id egraph::find(class_id id) const
+{
+    class_id root = id;
+    while (_parent[root] != root) {
+        root = _parent[root];
+    }
+    while (_parent[id] != root) {
+        class_id next = _parent[id];
+        _parent[id] = root;
+        id = next;
+    }
+    return root;
+}
+
+//------------------------------------------------------------------------------
+bool egraph::merge(class_id a, class_id b)
+{
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+        return false;
+    }
+
+    // keep the larger class to move fewer nodes
+    if (_classes[a].nodes.size() < _classes[b].nodes.size()) {
+        std::swap(a, b);
+    }
+
+    _parent[b] = a;
+    auto& nodes = _classes[a].nodes;
+    nodes.insert(nodes.end(), _classes[b].nodes.begin(), _classes[b].nodes.end());
+    _classes[b].nodes.clear();
+    _classes[b].nodes.shrink_to_fit();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void egraph::rebuild()
+{
+    // re-canonicalize every node, nodes which become identical are congruent
+    // so their classes are merged and the process repeats until nothing changes
+    while (true) {
+        std::vector<std::pair<class_id, class_id>> merges;
+
+        _memo.clear();
+        _size = 0;
+        for (class_id id = 0; id < _classes.size(); ++id) {
+            if (find(id) != id) {
+                continue;
+            }
+
+            auto& nodes = _classes[id].nodes;
+            std::size_t kept = 0;
+            for (std::size_t ii = 0; ii < nodes.size(); ++ii) {
+                node n = canonical(nodes[ii]);
+                auto result = _memo.emplace(n, id);
+                if (result.second) {
+                    nodes[kept++] = n;
+                } else if (result.first->second != id) {
+                    // the other class keeps the node until they are merged
+                    merges.emplace_back(result.first->second, id);
+                }
+            }
+            nodes.resize(kept);
+            std::stable_sort(nodes.begin(), nodes.end(), node_order);
+            _size += kept;
+        }
+
+        if (!merges.size()) {
+            break;
+        }
+        for (auto const& m : merges) {
+            merge(m.first, m.second);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+egraph::node egraph::canonical(node n) const
+{
+    if (n.is_op()) {
+        n.lhs = find(n.lhs);
+        n.rhs = find(n.rhs);
+    }
+    return n;
+}
+
+//------------------------------------------------------------------------------
+void egraph::match(expression const& pattern, std::function<bool(class_id, substitution const&)> const& fn) const
+{
+    match_stack pending;
+    for (class_id id = 0; id < _classes.size(); ++id) {
+        if (find(id) != id) {
+            continue;
+        }
+
+        substitution s;
+        pending.assign(1, {&pattern, id});
+        bool more = match_r(pending, s, [&](substitution const& result) {
+            return fn(id, result);
+        });
+        if (!more) {
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool egraph::match_r(match_stack& pending, substitution& s, std::function<bool(substitution const&)> const& fn) const
+{
+    // every subpattern has been matched
+    if (!pending.size()) {
+        return fn(s);
+    }
+
+    auto const next = pending.back();
+    pending.pop_back();
+
+    expression const& pattern = *next.first;
+    class_id id = find(next.second);
+    bool more = true;
+
+    if (!(placeholder_mask(pattern) & ~s.mask)) {
+        // fully bound subpatterns are looked up instead of enumerated
+        if (lookup(pattern, s) == id) {
+            more = match_r(pending, s, fn);
+        }
+    } else if (std::holds_alternative<op>(pattern)) {
+        op const& pattern_op = std::get<op>(pattern);
+        auto const& nodes = _classes[id].nodes;
+        node key{pattern_op.type, 0, 0, {}};
+        auto range = std::equal_range(nodes.begin(), nodes.end(), key, node_order);
+        for (auto it = range.first; more && it != range.second; ++it) {
+            pending.emplace_back(&*pattern_op.rhs, it->rhs);
+            pending.emplace_back(&*pattern_op.lhs, it->lhs);
+            more = match_r(pending, s, fn);
+            pending.resize(pending.size() - 2);
+        }
+    } else if (std::holds_alternative<placeholder>(pattern)) {
+        std::size_t index = static_cast<std::size_t>(std::get<placeholder>(pattern));
+        std::uint32_t bit = 1u << index;
+        if (s.mask & bit) {
+            if (find(s.classes[index]) == id) {
+                more = match_r(pending, s, fn);
+            }
+        } else {
+            s.classes[index] = id;
+            s.mask |= bit;
+            more = match_r(pending, s, fn);
+            s.mask &= ~bit;
+        }
+    } else {
+        for (node const& n : _classes[id].nodes) {
+            if (n.is_op()) {
+                break;
+            } else if (n.leaf == pattern) {
+                more = match_r(pending, s, fn);
+                break;
+            }
+        }
+    }
+
+    pending.push_back(next);
+    return more;
+}
+
+//------------------------------------------------------------------------------
+egraph::class_id egraph::lookup(expression const& pattern, substitution const& s) const
+{
+    node n{op_type{}, no_class, no_class, {}};
+    if (std::holds_alternative<op>(pattern)) {
+        op const& pattern_op = std::get<op>(pattern);
+        n.type = pattern_op.type;
+        n.lhs = lookup(pattern_op.lhs, s);
+        n.rhs = lookup(pattern_op.rhs, s);
+        if (n.lhs == no_class || n.rhs == no_class) {
+            return no_class;
+        }
+    } else if (std::holds_alternative<placeholder>(pattern)) {
+        return find(s.classes[static_cast<std::size_t>(std::get<placeholder>(pattern))]);
+    } else {
+        n.leaf = pattern;
+    }
+
+    auto it = _memo.find(n);
+    return it == _memo.end() ? no_class : find(it->second);
+}
+
+//------------------------------------------------------------------------------
+expression egraph::extract(class_id root, cost_model const& model) const
+{
+    // relax class costs until no cheaper node is found, a node is never chosen
+    // through its own class since operators never cost less than operands
+    constexpr double unknown = std::numeric_limits<double>::infinity();
+    std::vector<double> cost(_classes.size(), unknown);
+    std::vector<node const*> best(_classes.size(), nullptr);
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (class_id id = 0; id < _classes.size(); ++id) {
+            if (find(id) != id) {
+                continue;
+            }
+            for (node const& n : _classes[id].nodes) {
+                double n_cost = 0;
+                if (n.is_op()) {
+                    double lhs_cost = cost[find(n.lhs)];
+                    double rhs_cost = cost[find(n.rhs)];
+                    if (lhs_cost == unknown || rhs_cost == unknown) {
+                        continue;
+                    }
+                    n_cost = model.weight(n.type) + lhs_cost + rhs_cost;
+                }
+                if (n_cost < cost[id]) {
+                    cost[id] = n_cost;
+                    best[id] = &n;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<std::optional<expression>> built(_classes.size());
+    std::function<expression(class_id)> build = [&](class_id id) -> expression {
+        id = find(id);
+        if (!built[id]) {
+            node const* n = best[id];
+            assert(n);
+            if (n->is_op()) {
+                built[id] = op{n->type, build(n->lhs), build(n->rhs)};
+            } else {
+                built[id] = n->leaf;
+            }
+        }
+        return *built[id];
+    };
+
+    return build(root);
+}
+
+//------------------------------------------------------------------------------
+std::vector<egraph::class_id> egraph::classes() const
+{
+    std::vector<class_id> out;
+    for (class_id id = 0; id < _classes.size(); ++id) {
+        if (find(id) == id) {
+            out.push_back(id);
+        }
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+value const* egraph::value_of(class_id id) const
+{
+    for (node const& n : _classes[find(id)].nodes) {
+        if (!n.is_op() && std::holds_alternative<value>(n.leaf)) {
+            return &std::get<value>(n.leaf);
+        }
+    }
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+bool egraph::is_zero(class_id id) const
+{
+    value const* v = value_of(id);
+    return v && *v == 0.0;
+}
+
+//------------------------------------------------------------------------------
+bool egraph::fold_values()
+{
+    std::vector<std::pair<class_id, expression>> folds;
+    std::vector<std::pair<class_id, class_id>> identities;
+
+    for (class_id id : classes()) {
+        if (value_of(id)) {
+            continue;
+        }
+
+        for (node const& n : _classes[id].nodes) {
+            if (!n.is_op()) {
+                continue;
+            }
+
+            // identities involving zero, the rules for these are not matched
+            // since placeholders are never bound to zero
+            if (n.type == op_type::product && (is_zero(n.lhs) || is_zero(n.rhs))) {
+                folds.emplace_back(id, 0.0);
+                break;
+            } else if (n.type == op_type::sum && is_zero(n.lhs)) {
+                identities.emplace_back(id, n.rhs);
+                break;
+            } else if ((n.type == op_type::sum || n.type == op_type::difference) && is_zero(n.rhs)) {
+                identities.emplace_back(id, n.lhs);
+                break;
+            } else if (n.type == op_type::difference && find(n.lhs) == find(n.rhs)) {
+                folds.emplace_back(id, 0.0);
+                break;
+            } else if (n.type == op_type::negative && is_zero(n.lhs)) {
+                folds.emplace_back(id, 0.0);
+                break;
+            } else if (n.type == op_type::exponent && is_zero(n.rhs)) {
+                folds.emplace_back(id, 1.0);
+                break;
+            }
+
+            value const* lhs = value_of(n.lhs);
+            value const* rhs = value_of(n.rhs);
+            if (!lhs || !rhs) {
+                continue;
+            }
+
+            value v;
+            switch (n.type) {
+                case op_type::sum: v = *lhs + *rhs; break;
+                case op_type::difference: v = *lhs - *rhs; break;
+                case op_type::product: v = *lhs * *rhs; break;
+                case op_type::quotient: v = *lhs / *rhs; break;
+                case op_type::exponent: v = std::pow(*lhs, *rhs); break;
+                default: continue;
+            }
+            if (!std::isfinite(v)) {
+                continue;
+            }
+
+            // values are never negative, negation is an operator
+            if (v < 0.0) {
+                folds.emplace_back(id, op{op_type::negative, expression(-v)});
+            } else {
+                folds.emplace_back(id, v);
+            }
+            break;
+        }
+    }
+
+    bool changed = false;
+    for (auto const& f : folds) {
+        changed |= merge(f.first, add(f.second));
+    }
+    for (auto const& i : identities) {
+        changed |= merge(i.first, i.second);
+    }
+    return changed;
+}
+
+//------------------------------------------------------------------------------
+//! identities which only hold on the principal branch and equate different
+//! values when merged as equalities, e.g. `((-1) ^ 2) ^ 0.5 = (-1) ^ 1`
+constexpr char const* partial_identities[] = {
+    "((b ^ x) ^ y) = (b ^ (x * y))",
+};
+
+//------------------------------------------------------------------------------
+bool is_partial(transform const& tr)
+{
+    std::string str = to_string(tr.source.expr) + " = " + to_string(tr.target.expr);
+    for (auto partial : partial_identities) {
+        if (str == partial) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool contains(expression const& expr, op_type type)
+{
+    if (std::holds_alternative<op>(expr)) {
+        op const& expr_op = std::get<op>(expr);
+        return expr_op.type == type || contains(expr_op.lhs, type) || contains(expr_op.rhs, type);
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+expression simplify_egraph(expression const& expr, simplify_options const& options, simplify_statistics* statistics)
+{
+    resolve_transforms();
+
+    struct rule
+    {
+        expression const* source;
+        expression const* target;
+        std::ptrdiff_t growth;
+        std::size_t limit = 1000;       //!< matches allowed per round
+        std::size_t banned_until = 0;   //!< first round the rule may be used again
+        std::size_t bans = 0;
+    };
+
+    // many rules only hold for non-zero operands, e.g. `b ^ x * b ^ y` for
+    // `b = 0` and `x = -y`, which in a graph of equalities quickly equates
+    // zero with everything else. Placeholders are never bound to zero and
+    // the identities for zero are applied by `fold_values` instead.
+    //
+    // a source which is a bare placeholder matches every class, so those
+    // directions only add larger forms of everything in the graph. Rules are
+    // also never used to introduce derivatives, every class would be taken as
+    // a variable of differentiation and merging by those nonsense equalities
+    // eventually equates unrelated classes.
+    std::vector<rule> rules;
+    auto add_rule = [&rules](pattern const& source, pattern const& target) {
+        if (std::holds_alternative<op>(source.expr)
+                && (contains(source.expr, op_type::derivative) || !contains(target.expr, op_type::derivative))) {
+            std::ptrdiff_t growth = std::ptrdiff_t(op_count(target.expr)) - std::ptrdiff_t(op_count(source.expr));
+            rules.push_back({&source.expr, &target.expr, growth});
+        }
+    };
+    for (auto const& tr : transforms) {
+        if (is_partial(tr)) {
+            continue;
+        }
+        if (tr.forward) {
+            add_rule(tr.source, tr.target);
+        }
+        if (tr.reverse) {
+            add_rule(tr.target, tr.source);
+        }
+    }
+
+    // apply rules which grow expressions least first, so that when the node
+    // budget runs out in the middle of a round the simplifying ones have run
+    std::stable_sort(rules.begin(), rules.end(), [](rule const& lhs, rule const& rhs) {
+        return lhs.growth < rhs.growth;
+    });
+
+    egraph graph;
+    egraph::class_id root = graph.add(expr);
+    graph.fold_values();
+    graph.rebuild();
+
+    std::size_t rounds = 0;
+    simplify_status status = simplify_status::complete;
+    for (std::size_t ii = 0; graph.size() < options.max_nodes; ++ii) {
+        if (ii >= options.max_iterations) {
+            status = simplify_status::iterations;
+            break;
+        }
+        status = options.interrupted();
+        if (status != simplify_status::complete) {
+            break;
+        }
+        ++rounds;
+
+        // find all matches before applying any so every rule sees the same graph
+        std::vector<std::tuple<rule const*, egraph::class_id, egraph::substitution>> matches;
+        bool banned = false;
+        for (auto& r : rules) {
+            if (r.banned_until > ii) {
+                banned = true;
+                continue;
+            }
+
+            // associativity and commutativity match combinatorially many
+            // times as classes grow, rules which exceed their limit are
+            // skipped for exponentially longer with exponentially larger
+            // limits so they can't starve the others of the node budget
+            std::size_t first = matches.size();
+            graph.match(*r.source, [&](egraph::class_id id, egraph::substitution const& s) {
+                for (std::size_t jj = 0; jj < placeholder_count; ++jj) {
+                    if (s.mask & (1u << jj) && graph.is_zero(s.classes[jj])) {
+                        return true;
+                    }
+                }
+                matches.emplace_back(&r, id, s);
+                return matches.size() - first <= r.limit;
+            });
+            if (matches.size() - first > r.limit) {
+                matches.resize(first);
+                r.banned_until = ii + (std::size_t(1) << r.bans);
+                r.limit <<= 1;
+                ++r.bans;
+                banned = true;
+            }
+        }
+
+        bool changed = false;
+        for (auto const& m : matches) {
+            if (graph.size() >= options.max_nodes) {
+                break;
+            }
+            changed |= graph.merge(std::get<1>(m), graph.add(*std::get<0>(m)->target, std::get<2>(m)));
+        }
+        changed |= graph.fold_values();
+        graph.rebuild();
+
+        // saturated, every rule is already satisfied by the graph
+        if (!changed && !banned) {
+            break;
+        }
+
+        // only banned rules can change the graph, skip to the first of them
+        if (!changed) {
+            std::size_t next = SIZE_MAX;
+            for (auto& r : rules) {
+                if (r.banned_until > ii) {
+                    next = std::min(next, r.banned_until);
+                }
+            }
+            ii = next - 1;
+        }
+    }
+
+    expression best = graph.extract(root, options.cost);
+    if (statistics) {
+        statistics->status = status;
+        statistics->expanded = rounds;
+        statistics->closed = graph.size();
+    }
+    if (options.trace) {
+        printf("(%zu) %s\n", op_count(expr), to_string(expr).c_str());
+        printf("(%zu) %s\n", op_count(best), to_string(best).c_str());
+    }
+    return best;
+}
+
+} // namespace algebra
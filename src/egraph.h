@@ -0,0 +1,118 @@
+// egraph.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! equivalence classes of expressions for equality saturation
+//!
+//! Each class is a set of nodes known to be equal, and the operands of a node
+//! are classes rather than expressions, so a graph with `n` nodes can represent
+//! exponentially many equivalent expressions. Classes are merged by `merge` and
+//! congruence is restored in bulk by `rebuild`.
+class egraph
+{
+public:
+    using class_id = std::uint32_t;
+
+    static constexpr class_id no_class = UINT32_MAX;
+
+    //! expression node with operand classes, leaves have no operands
+    struct node
+    {
+        op_type type;
+        class_id lhs;
+        class_id rhs;
+        expression leaf;    //!< non-op value, empty for operators
+
+        bool is_op() const { return lhs != no_class; }
+        bool operator==(node const& other) const
+        {
+            return type == other.type && lhs == other.lhs && rhs == other.rhs && leaf == other.leaf;
+        }
+    };
+
+    //! classes bound to each placeholder by a pattern match
+    struct substitution
+    {
+        std::array<class_id, placeholder_count> classes;
+        std::uint32_t mask = 0;
+    };
+
+public:
+    //! add an expression and return its class
+    class_id add(expression const& expr);
+    //! add an expression with placeholders replaced by classes
+    class_id add(expression const& pattern, substitution const& s);
+
+    //! return the canonical class of `id`
+    class_id find(class_id id) const;
+    //! merge two classes, returns false if they were already equal
+    bool merge(class_id a, class_id b);
+    //! restore canonical operands and merge congruent nodes
+    void rebuild();
+
+    //! call `fn` with the class and bindings of every way `pattern` matches an
+    //! expression in the graph until it returns false, the graph must have been
+    //! rebuilt since the last merge
+    void match(expression const& pattern, std::function<bool(class_id, substitution const&)> const& fn) const;
+
+    //! return the cheapest expression in class `id` under `cost`
+    expression extract(class_id id, cost_model const& cost = {}) const;
+
+    //! canonical classes in order of creation
+    std::vector<class_id> classes() const;
+    //! total number of nodes in all classes
+    std::size_t size() const { return _size; }
+
+    //! merge operations on two values with their results and apply the
+    //! additive and multiplicative identities of zero, returns true if any
+    //! classes were merged
+    bool fold_values();
+
+    //! value of the first value leaf in class `id`, if any
+    value const* value_of(class_id id) const;
+    //! class `id` is equal to the value zero
+    bool is_zero(class_id id) const;
+
+protected:
+    struct node_hash
+    {
+        std::size_t operator()(node const& n) const;
+    };
+
+    struct eclass
+    {
+        std::vector<node> nodes;
+    };
+
+    mutable std::vector<class_id> _parent; //!< union-find forest, compressed by `find`
+    std::vector<eclass> _classes;
+    std::unordered_map<node, class_id, node_hash> _memo;
+    std::size_t _size = 0;
+
+protected:
+    class_id add(node n);
+    node canonical(node n) const;
+    //! subpatterns and the classes they must match
+    using match_stack = std::vector<std::pair<expression const*, class_id>>;
+
+    //! return the class of a pattern with every placeholder bound, if any
+    class_id lookup(expression const& pattern, substitution const& s) const;
+    bool match_r(match_stack& pending, substitution& s, std::function<bool(substitution const&)> const& fn) const;
+};
+
+//------------------------------------------------------------------------------
+//! simplify by equality saturation, see `simplify_engine::egraph`
+expression simplify_egraph(expression const& expr, simplify_options const& options, simplify_statistics* statistics = nullptr);
+
+} // namespace algebra
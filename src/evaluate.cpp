@@ -0,0 +1,460 @@
+// evaluate.cpp
+//
+
+#include "evaluate.h"
+#include "vecmath.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+bool evaluable(expression_dag const& dag)
+{
+    for (auto const& n : dag.nodes()) {
+        if (std::holds_alternative<op>(n.expr)) {
+            switch (std::get<op>(n.expr).type) {
+                case op_type::equality:
+                case op_type::derivative:
+                case op_type::integral:
+                case op_type::differential:
+                    return false;
+                default:
+                    break;
+            }
+        } else if (std::holds_alternative<constant>(n.expr)) {
+            if (std::get<constant>(n.expr) == constant::i) {
+                return false;
+            }
+        } else if (!std::holds_alternative<value>(n.expr) && !std::holds_alternative<symbol>(n.expr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool evaluable(expression const& expr)
+{
+    return evaluable(expression_dag(expr));
+}
+
+//------------------------------------------------------------------------------
+//! true for op types which ignore `rhs`
+bool is_unary(op_type type)
+{
+    return type == op_type::negative
+        || type == op_type::reciprocal
+        || (type >= op_type::sine && type <= op_type::arccotangent);
+}
+
+//------------------------------------------------------------------------------
+//! numeric value of a constant
+double constant_value(constant c)
+{
+    switch (c) {
+        case constant::pi: return M_PI;
+        case constant::e: return M_E;
+        default: return std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+//------------------------------------------------------------------------------
+program::program(expression const& expr, std::vector<symbol> const& slots)
+    : program(expression_dag(expr), slots)
+{}
+
+//------------------------------------------------------------------------------
+program::program(expression_dag const& dag, std::vector<symbol> const& slots)
+    : _valid(evaluable(dag))
+    , _slots(slots)
+    , _registers(slots.size(), 0.0)
+    , _result(0)
+{
+    if (!_valid) {
+        _result = constant_register(std::numeric_limits<double>::quiet_NaN());
+        return;
+    }
+
+    // assign slots, then constants and then shared operations so temporaries
+    // can follow them, leaves are in order of appearance in the expression
+    auto const& nodes = dag.nodes();
+    std::vector<std::uint32_t> registers(nodes.size(), unassigned);
+    for (std::uint32_t id = 0; id < nodes.size(); ++id) {
+        if (std::holds_alternative<symbol>(nodes[id].expr)) {
+            registers[id] = slot(std::get<symbol>(nodes[id].expr));
+        }
+    }
+    for (std::uint32_t id = 0; id < nodes.size(); ++id) {
+        if (std::holds_alternative<value>(nodes[id].expr)) {
+            registers[id] = constant_register(std::get<value>(nodes[id].expr));
+        } else if (std::holds_alternative<constant>(nodes[id].expr)) {
+            registers[id] = constant_register(constant_value(std::get<constant>(nodes[id].expr)));
+        }
+    }
+
+    // shared operations keep their own register so that they are computed
+    // once, it is reserved here and written when the operation is first used
+    std::uint32_t next_temp = std::uint32_t(_registers.size());
+    std::vector<std::uint32_t> shared(nodes.size(), unassigned);
+    for (std::uint32_t id : dag.bindings()) {
+        shared[id] = next_temp++;
+    }
+
+    std::uint32_t max_temp = next_temp;
+    _result = compile_r(dag, dag.root(), registers, shared, next_temp, max_temp);
+    _registers.resize(max_temp, 0.0);
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t program::compile_r(
+    expression_dag const& dag,
+    std::uint32_t id,
+    std::vector<std::uint32_t>& registers,
+    std::vector<std::uint32_t> const& shared,
+    std::uint32_t& next_temp,
+    std::uint32_t& max_temp)
+{
+    if (registers[id] != unassigned) {
+        return registers[id];
+    }
+
+    auto const& n = dag.nodes()[id];
+    assert(std::holds_alternative<op>(n.expr));
+    op const& expr_op = std::get<op>(n.expr);
+
+    // operands leave at most their own result in a temporary, so the result
+    // of this operation can overwrite the first of them
+    std::uint32_t const base = next_temp;
+    std::uint32_t const lhs = compile_r(dag, n.lhs, registers, shared, next_temp, max_temp);
+    std::uint32_t const rhs = is_unary(expr_op.type) ? lhs : compile_r(dag, n.rhs, registers, shared, next_temp, max_temp);
+
+    std::uint32_t dst = base;
+    if (shared[id] != unassigned) {
+        // later uses read the reserved register
+        dst = registers[id] = shared[id];
+        next_temp = base;
+    } else {
+        next_temp = base + 1;
+        max_temp = std::max(max_temp, next_temp);
+    }
+
+    // replace calls to pow with arithmetic for common constant exponents
+    if (expr_op.type == op_type::exponent && std::holds_alternative<value>((expression const&)expr_op.rhs)) {
+        value exp = std::get<value>((expression const&)expr_op.rhs);
+        if (exp == 2.0) {
+            _instructions.push_back({op_type::product, dst, lhs, lhs});
+            return dst;
+        } else if (exp == -1.0) {
+            _instructions.push_back({op_type::reciprocal, dst, lhs, lhs});
+            return dst;
+        }
+    }
+
+    _instructions.push_back({expr_op.type, dst, lhs, rhs});
+    return dst;
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t program::slot(symbol sym)
+{
+    auto it = std::find(_slots.begin(), _slots.end(), sym);
+    if (it != _slots.end()) {
+        return std::uint32_t(it - _slots.begin());
+    }
+
+    // slots precede every other register
+    assert(_registers.size() == _slots.size());
+    _slots.push_back(sym);
+    _registers.push_back(0.0);
+    return std::uint32_t(_slots.size() - 1);
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t program::constant_register(double value)
+{
+    for (std::size_t ii = _slots.size(); ii < _registers.size(); ++ii) {
+        if (_registers[ii] == value || (std::isnan(_registers[ii]) && std::isnan(value))) {
+            return std::uint32_t(ii);
+        }
+    }
+    _registers.push_back(value);
+    return std::uint32_t(_registers.size() - 1);
+}
+
+//------------------------------------------------------------------------------
+double program::evaluate(double const* inputs, double* r) const
+{
+    std::copy(inputs, inputs + _slots.size(), r);
+    std::copy(_registers.begin() + _slots.size(), _registers.end(), r + _slots.size());
+
+    for (eval_instruction const& in : _instructions) {
+        double const a = r[in.lhs];
+        double const b = r[in.rhs];
+        double x;
+        switch (in.type) {
+            case op_type::sum: x = a + b; break;
+            case op_type::difference: x = a - b; break;
+            case op_type::negative: x = -a; break;
+            case op_type::product: x = a * b; break;
+            case op_type::quotient: x = a / b; break;
+            case op_type::reciprocal: x = 1.0 / a; break;
+            case op_type::exponent: x = std::pow(a, b); break;
+            case op_type::logarithm: x = std::log(a) / std::log(b); break;
+            case op_type::sine: x = std::sin(a); break;
+            case op_type::cosine: x = std::cos(a); break;
+            case op_type::tangent: x = std::tan(a); break;
+            case op_type::secant: x = 1.0 / std::cos(a); break;
+            case op_type::cosecant: x = 1.0 / std::sin(a); break;
+            case op_type::cotangent: x = 1.0 / std::tan(a); break;
+            case op_type::arcsine: x = std::asin(a); break;
+            case op_type::arccosine: x = std::acos(a); break;
+            case op_type::arctangent: x = std::atan(a); break;
+            case op_type::arcsecant: x = std::acos(1.0 / a); break;
+            case op_type::arccosecant: x = std::asin(1.0 / a); break;
+            case op_type::arccotangent: x = std::atan(1.0 / a); break;
+            default: assert(0); x = std::numeric_limits<double>::quiet_NaN(); break;
+        }
+        r[in.dst] = x;
+    }
+
+    return r[_result];
+}
+
+//------------------------------------------------------------------------------
+double program::operator()(double const* inputs) const
+{
+    constexpr std::size_t fixed_registers = 64;
+    if (_registers.size() <= fixed_registers) {
+        std::array<double, fixed_registers> r;
+        return evaluate(inputs, r.data());
+    } else {
+        std::vector<double> r(_registers.size());
+        return evaluate(inputs, r.data());
+    }
+}
+
+//------------------------------------------------------------------------------
+double program::operator()(std::vector<double> const& inputs) const
+{
+    assert(inputs.size() >= _slots.size());
+    return (*this)(inputs.data());
+}
+
+//------------------------------------------------------------------------------
+double program::gradient(double const* inputs, double* gradient) const
+{
+    if (!_valid) {
+        std::fill(gradient, gradient + _slots.size(), std::numeric_limits<double>::quiet_NaN());
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // registers are reused by later instructions so the operands of each
+    // instruction are recorded as it is evaluated
+    std::vector<double> r(_registers.size());
+    std::copy(inputs, inputs + _slots.size(), r.begin());
+    std::copy(_registers.begin() + _slots.size(), _registers.end(), r.begin() + _slots.size());
+    std::vector<std::array<double, 3>> tape(_instructions.size());
+    for (std::size_t ii = 0; ii < _instructions.size(); ++ii) {
+        eval_instruction const& in = _instructions[ii];
+        double const a = r[in.lhs];
+        double const b = r[in.rhs];
+        double x;
+        switch (in.type) {
+            case op_type::sum: x = a + b; break;
+            case op_type::difference: x = a - b; break;
+            case op_type::negative: x = -a; break;
+            case op_type::product: x = a * b; break;
+            case op_type::quotient: x = a / b; break;
+            case op_type::reciprocal: x = 1.0 / a; break;
+            case op_type::exponent: x = std::pow(a, b); break;
+            case op_type::logarithm: x = std::log(a) / std::log(b); break;
+            case op_type::sine: x = std::sin(a); break;
+            case op_type::cosine: x = std::cos(a); break;
+            case op_type::tangent: x = std::tan(a); break;
+            case op_type::secant: x = 1.0 / std::cos(a); break;
+            case op_type::cosecant: x = 1.0 / std::sin(a); break;
+            case op_type::cotangent: x = 1.0 / std::tan(a); break;
+            case op_type::arcsine: x = std::asin(a); break;
+            case op_type::arccosine: x = std::acos(a); break;
+            case op_type::arctangent: x = std::atan(a); break;
+            case op_type::arcsecant: x = std::acos(1.0 / a); break;
+            case op_type::arccosecant: x = std::asin(1.0 / a); break;
+            case op_type::arccotangent: x = std::atan(1.0 / a); break;
+            default: assert(0); x = std::numeric_limits<double>::quiet_NaN(); break;
+        }
+        tape[ii] = {a, b, x};
+        r[in.dst] = x;
+    }
+    double const result = r[_result];
+
+    // the adjoint of a register belongs to the value last written to it, so
+    // it is consumed and cleared by the instruction which wrote that value
+    std::vector<double> adjoint(_registers.size(), 0.0);
+    adjoint[_result] = 1.0;
+    for (std::size_t ii = _instructions.size(); ii-- > 0; ) {
+        eval_instruction const& in = _instructions[ii];
+        double const a = tape[ii][0];
+        double const b = tape[ii][1];
+        double const x = tape[ii][2];
+        double const d = adjoint[in.dst];
+        adjoint[in.dst] = 0.0;
+        if (d == 0.0) {
+            continue;
+        }
+
+        double da = 0.0;
+        double db = 0.0;
+        switch (in.type) {
+            case op_type::sum: da = 1.0; db = 1.0; break;
+            case op_type::difference: da = 1.0; db = -1.0; break;
+            case op_type::negative: da = -1.0; break;
+            case op_type::product: da = b; db = a; break;
+            case op_type::quotient: da = 1.0 / b; db = -x / b; break;
+            case op_type::reciprocal: da = -x * x; break;
+            case op_type::exponent:
+                da = b == 0.0 ? 0.0 : b * std::pow(a, b - 1.0);
+                db = a > 0.0 ? x * std::log(a) : 0.0;
+                break;
+            case op_type::logarithm:
+                da = 1.0 / (a * std::log(b));
+                db = -x / (b * std::log(b));
+                break;
+            case op_type::sine: da = std::cos(a); break;
+            case op_type::cosine: da = -std::sin(a); break;
+            case op_type::tangent: da = 1.0 + x * x; break;
+            case op_type::secant: da = x * std::tan(a); break;
+            case op_type::cosecant: da = -x / std::tan(a); break;
+            case op_type::cotangent: da = -(1.0 + x * x); break;
+            case op_type::arcsine: da = 1.0 / std::sqrt(1.0 - a * a); break;
+            case op_type::arccosine: da = -1.0 / std::sqrt(1.0 - a * a); break;
+            case op_type::arctangent: da = 1.0 / (1.0 + a * a); break;
+            case op_type::arcsecant: da = 1.0 / (a * a * std::sqrt(1.0 - 1.0 / (a * a))); break;
+            case op_type::arccosecant: da = -1.0 / (a * a * std::sqrt(1.0 - 1.0 / (a * a))); break;
+            case op_type::arccotangent: da = -1.0 / (1.0 + a * a); break;
+            default: assert(0); break;
+        }
+
+        // unary operations repeat their operand as `rhs`
+        adjoint[in.lhs] += d * da;
+        if (!is_unary(in.type)) {
+            adjoint[in.rhs] += d * db;
+        }
+    }
+
+    std::copy(adjoint.begin(), adjoint.begin() + _slots.size(), gradient);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+//! number of rows evaluated together by each instruction
+constexpr std::size_t block_size = 256;
+
+//------------------------------------------------------------------------------
+//! apply one instruction to `n` rows, `t` is scratch space for `n` values
+VECMATH_TARGETS
+void evaluate_block(op_type type, double const* a, double const* b, double* d, double* t, std::size_t n, bool exact)
+{
+    switch (type) {
+        case op_type::sum: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = a[ii] + b[ii]; } return;
+        case op_type::difference: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = a[ii] - b[ii]; } return;
+        case op_type::negative: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = -a[ii]; } return;
+        case op_type::product: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = a[ii] * b[ii]; } return;
+        case op_type::quotient: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = a[ii] / b[ii]; } return;
+        case op_type::reciprocal: for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = 1.0 / a[ii]; } return;
+        default: break;
+    }
+
+    if (exact) {
+        for (std::size_t ii = 0; ii < n; ++ii) {
+            switch (type) {
+                case op_type::exponent: d[ii] = std::pow(a[ii], b[ii]); break;
+                case op_type::logarithm: d[ii] = std::log(a[ii]) / std::log(b[ii]); break;
+                case op_type::sine: d[ii] = std::sin(a[ii]); break;
+                case op_type::cosine: d[ii] = std::cos(a[ii]); break;
+                case op_type::tangent: d[ii] = std::tan(a[ii]); break;
+                case op_type::secant: d[ii] = 1.0 / std::cos(a[ii]); break;
+                case op_type::cosecant: d[ii] = 1.0 / std::sin(a[ii]); break;
+                case op_type::cotangent: d[ii] = 1.0 / std::tan(a[ii]); break;
+                default: break;
+            }
+        }
+    } else {
+        switch (type) {
+            case op_type::exponent: vecmath::pow(a, b, d, n); break;
+            case op_type::logarithm:
+                vecmath::log(b, t, n);
+                vecmath::log(a, d, n);
+                for (std::size_t ii = 0; ii < n; ++ii) { d[ii] /= t[ii]; }
+                break;
+            case op_type::sine: vecmath::sin(a, d, n); break;
+            case op_type::cosine: vecmath::cos(a, d, n); break;
+            case op_type::tangent:
+                vecmath::sincos(a, d, t, n);
+                for (std::size_t ii = 0; ii < n; ++ii) { d[ii] /= t[ii]; }
+                break;
+            case op_type::secant:
+                vecmath::cos(a, d, n);
+                for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = 1.0 / d[ii]; }
+                break;
+            case op_type::cosecant:
+                vecmath::sin(a, d, n);
+                for (std::size_t ii = 0; ii < n; ++ii) { d[ii] = 1.0 / d[ii]; }
+                break;
+            case op_type::cotangent:
+                vecmath::sincos(a, t, d, n);
+                for (std::size_t ii = 0; ii < n; ++ii) { d[ii] /= t[ii]; }
+                break;
+            default: break;
+        }
+    }
+
+    // inverse functions have no approximations
+    for (std::size_t ii = 0; ii < n; ++ii) {
+        switch (type) {
+            case op_type::arcsine: d[ii] = std::asin(a[ii]); break;
+            case op_type::arccosine: d[ii] = std::acos(a[ii]); break;
+            case op_type::arctangent: d[ii] = std::atan(a[ii]); break;
+            case op_type::arcsecant: d[ii] = std::acos(1.0 / a[ii]); break;
+            case op_type::arccosecant: d[ii] = std::asin(1.0 / a[ii]); break;
+            case op_type::arccotangent: d[ii] = std::atan(1.0 / a[ii]); break;
+            default: break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void program::evaluate(double const* const* columns, std::size_t rows, double* out, bool exact) const
+{
+    std::size_t const slots = _slots.size();
+
+    // one block per register that isn't a slot, and one for scratch space
+    std::vector<double> blocks((_registers.size() - slots + 1) * block_size);
+    std::vector<double*> r(_registers.size());
+    for (std::size_t ii = slots; ii < _registers.size(); ++ii) {
+        r[ii] = blocks.data() + (ii - slots) * block_size;
+        std::fill(r[ii], r[ii] + block_size, _registers[ii]);
+    }
+    double* t = blocks.data() + (_registers.size() - slots) * block_size;
+
+    for (std::size_t base = 0; base < rows; base += block_size) {
+        std::size_t const n = std::min(block_size, rows - base);
+
+        // slots are read from the columns in place
+        for (std::size_t ii = 0; ii < slots; ++ii) {
+            r[ii] = const_cast<double*>(columns[ii]) + base;
+        }
+
+        for (eval_instruction const& in : _instructions) {
+            evaluate_block(in.type, r[in.lhs], r[in.rhs], r[in.dst], t, n, exact);
+        }
+
+        std::copy(r[_result], r[_result] + n, out + base);
+    }
+}
+
+} // namespace algebra
@@ -0,0 +1,102 @@
+// evaluate.h
+//
+
+#pragma once
+#include "dag.h"
+#include "expression.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! return true if every term of `expr` has a numeric value, i.e. it has no
+//! equalities, derivatives, integrals, placeholders or imaginary units
+bool evaluable(expression const& expr);
+bool evaluable(expression_dag const& dag);
+
+//------------------------------------------------------------------------------
+//! single instruction of a compiled expression, `dst = type(lhs, rhs)`
+struct eval_instruction
+{
+    op_type type;
+    std::uint32_t dst;
+    std::uint32_t lhs;
+    std::uint32_t rhs;  //!< unused by unary operations
+};
+
+//------------------------------------------------------------------------------
+//! expression compiled into register bytecode for repeated evaluation
+//!
+//! Registers hold the symbol slots first, then the constants of the expression,
+//! then one register for each shared operation of its `expression_dag` which is
+//! computed once, and then temporaries, which are reused once their value has
+//! been consumed so the register file stays about as large as the expression is
+//! deep. Leaves are never copied, instructions read their registers directly.
+class program
+{
+public:
+    //! compile `expr`, symbols in `slots` are bound in that order and any other
+    //! symbols are bound to the slots following them in order of appearance
+    program(expression const& expr, std::vector<symbol> const& slots = {});
+    program(expression_dag const& dag, std::vector<symbol> const& slots = {});
+
+    //! false if the expression has terms without a numeric value, e.g.
+    //! equalities, derivatives, integrals or the imaginary unit, in which case
+    //! evaluation always returns NaN
+    bool valid() const { return _valid; }
+
+    //! symbols in slot order
+    std::vector<symbol> const& slots() const { return _slots; }
+    //! number of registers needed for `evaluate`
+    std::size_t register_count() const { return _registers.size(); }
+    std::vector<eval_instruction> const& instructions() const { return _instructions; }
+
+    //! evaluate with one input per slot, `registers` must have space for
+    //! `register_count` values and is overwritten
+    double evaluate(double const* inputs, double* registers) const;
+    //! evaluate with one input per slot, allocates if the register file is
+    //! larger than a small fixed buffer
+    double operator()(double const* inputs) const;
+    double operator()(std::vector<double> const& inputs) const;
+
+    //! evaluate with one input per slot and write the partial derivative of
+    //! the result with respect to each slot to `gradient`
+    //!
+    //! Derivatives are accumulated in reverse over the instructions after
+    //! evaluating them once, so the cost is a small multiple of `evaluate`
+    //! whatever the number of slots. Allocates the register file and a record
+    //! of the operands of each instruction.
+    double gradient(double const* inputs, double* gradient) const;
+
+    //! evaluate `rows` bindings given as one column of inputs per slot
+    //!
+    //! Rows are evaluated in blocks, each instruction is applied to a whole
+    //! block before the next so that arithmetic is vectorized. Transcendental
+    //! functions use the approximations in vecmath.h unless `exact` is set.
+    void evaluate(double const* const* columns, std::size_t rows, double* out, bool exact = false) const;
+
+protected:
+    bool _valid;
+    std::vector<symbol> _slots;
+    //! initial register file, constants are stored after the slots
+    std::vector<double> _registers;
+    std::vector<eval_instruction> _instructions;
+    std::uint32_t _result;
+
+protected:
+    static constexpr std::uint32_t unassigned = UINT32_MAX;
+
+    std::uint32_t compile_r(
+        expression_dag const& dag,
+        std::uint32_t id,
+        std::vector<std::uint32_t>& registers,
+        std::vector<std::uint32_t> const& shared,
+        std::uint32_t& next_temp,
+        std::uint32_t& max_temp);
+    std::uint32_t slot(symbol sym);
+    std::uint32_t constant_register(double value);
+};
+
+} // namespace algebra
@@ -2,193 +2,60 @@
 //
 
 #include "expression.h"
-#include "parser.h"
+#include "differentiate.h"
+#include "egraph.h"
+#include "persistent_cache.h"
+#include "thread_pool.h"
+#include "transform.h"
 
+#include <algorithm>
 #include <cassert>
-#include <map>
-#include <queue>
-#include <set>
+#include <chrono>
+#include <cmath>
+#include <memory_resource>
+#include <numeric>
+#include <unordered_map>
 
 namespace algebra {
 
-char const* transform_strings[] = {
-    // associativity of addition
-    "(x + y) + z = x + (y + z)",
-
-    // associativity of multiplication
-    "(x * y) * z = x * (y * z)",
-
-    // commutativity of addition
-    "x + y = y + x",
-
-    // commutativity of multiplication
-    "x * y = y * x",
-
-    // distributivity of multiplication over addition
-    "a * (x + y) = a * x + a * y",
-
-    // additive identity
-    "x + 0 = x",
-
-    // multiplicative identity
-    "x * 1 = x",
-
-    // multiplicative kernel
-    "x * 0 = 0",
-
-    // additive inverse
-    "x + (-x) = 0",
-    "-x = 0 - x",
-    "x + (-y) = x - y",
-
-    // multiplicative inverse
-    "x * (x^-1) = 1",
-    "1/x = 1 / x",
-    "x * (1/y) = x / y",
-
-    "x + x = x * 2",
-    "x * x = x ^ 2",
-
-    //
-    //  exponentiation and logarithms
-    //
-
-    "log(x * y, b) = log(x, b) + log(y, b)",
-
-    // change of base
-    "log(x, b) = log(x, y) / log(b, y)",
-
-    "b ^ log(x, b) = x",
-
-    // exponentiation identity
-    "b ^ x * b ^ y = b ^ (x + y)",
-
-    "(b ^ x) ^ y = b ^ (x * y)",
-
-    // distributivity over multiplication
-    "(x * y) ^ n = (x ^ n) * (y ^ n)",
-
-    "x ^ 0 = 1",
-
-    "x ^ 1 = x",
-
-    "log(1, x) = 0",
-
-    //
-    //  complex numbers
-    //
-
-    // fundamental property of i
-    "i ^ 2 = -1",
-    // euler's formula
-    "e ^ (i * x) = cos(x) + i * sin(x)",
-
-    //
-    //  trigonometry
-    //
-
-    "sin(0) = 0",
-    "cos(0) = 1",
-    "sin(pi/2) = 1",
-    "cos(pi/2) = 0",
-
-    "tan(x) = sin(x) / cos(x)",
-    "sec(x) = 1 / cos(x)",
-    "csc(x) = 1 / sin(x)",
-    "cot(x) = 1 / tan(x)",
-    "1 = sin(x) ^ 2 + cos(x) ^ 2",
-
-    "sin(-x) = -sin(x)",
-    "cos(-x) = cos(x)",
-    "tan(-x) = -tan(x)",
-
-    "sin(pi/2 - x) = cos(x)",
-    "cos(pi/2 - x) = sin(x)",
-    "tan(pi/2 - x) = cot(x)",
-
-    "sin(pi - x) = sin(x)",
-    "cos(pi - x) = -cos(x)",
-    "tan(pi - x) = -tan(x)",
-
-    "sin(2pi - x) = sin(-x)",
-    "cos(2pi - x) = cos(-x)",
-    "tan(2pi - x) = tan(-x)",
-
-    "sin(x + y) = sin(x) * cos(y) + cos(x) * sin(y)",
-
-    "sin(x - y) = sin(x) * cos(y) - cos(x) * sin(y)",
-
-    "cos(x + y) = cos(x) * cos(y) - sin(x) * sin(y)",
-    "cos(x - y) = cos(x) * cos(y) + sin(x) * sin(y)",
-
-    "sin(2pi + x) = sin(x)",
-    "cos(2pi + x) = cos(x)",
-    "tan(2pi + x) = tan(x)",
-
-    "sin(2x) = 2 * sin(x) * cos(x)",
-    "cos(2x) = cos(x) ^ 2 - sin(x) ^ 2",
-    "cos(2x) = 2 * cos(x) ^ 2 - 1",
-
-    "sin(3x) = 3 * sin(x) - 4 * sin(x) ^ 3",
-    "cos(3x) = 4 * cos(x) ^ 3 - 3 * cos(x)",
-
-    "sin(x) ^ 2 = (1 - cos(2x)) / 2",
-    "cos(x) ^ 2 = (1 + cos(2x)) / 2",
-
-    //
-    //  differentiation
-    //
-
-    "d/dx(f + g) = d/dx(f) + d/dx(g)",
-    "d/dx(f - g) = d/dx(f) - d/dx(g)",
-
-    // product rule
-    "d/dx(f * g) = d/dx(f) * g + f * d/dx(g)",
-
-    // quotient rule
-    "d/dx(f / g) = (d/dx(f) * g - f * d/dx(g)) / g^2",
-
-    // chain rule
-    //"d/dx(f(g)) = d/dx(f)(g) * d/dx(g)",
-
-    // power rule
-    "d/dx(x ^ r) = r * x ^ (r - 1)", // (r != 0),
-
-    "d/dx(sin(x)) = cos(x)",
-    "d/dx(cos(x)) = -sin(x)",
-    "d/dx(tan(x)) = sec(x) ^ 2",
-
-    "d/dx(sin(f)) = d/dx(f) * cos(f)",
-    "d/dx(cos(f)) = d/dx(f) * -sin(f)",
-    "d/dx(tan(f)) = d/dx(f) * sec(f) ^ 2",
-};
-
-std::vector<transform> transforms;
+//------------------------------------------------------------------------------
+std::string to_string(op_type type, std::string const& lhs, std::string const& rhs)
+{
+    switch (type) {
+        case op_type::equality: return lhs + " = " + rhs;
+        case op_type::sum: return std::string("(") + lhs + " + " + rhs + ")";
+        case op_type::difference: return std::string("(") + lhs + " - " + rhs + ")";
+        case op_type::negative: return std::string("(-") + lhs + ")";
+        case op_type::product: return std::string("(") + lhs + " * " + rhs + ")";
+        case op_type::quotient: return std::string("(") + lhs + " / " + rhs + ")";
+        case op_type::reciprocal: return std::string("(1/") + lhs + ")";
+        case op_type::exponent: return std::string("(") + lhs + " ^ " + rhs + ")";
+        case op_type::logarithm: return std::string("log(") + lhs + ", " + rhs + ")";
+        case op_type::sine: return std::string("sin(") + lhs + ")";
+        case op_type::cosine: return std::string("cos(") + lhs + ")";
+        case op_type::tangent: return std::string("tan(") + lhs + ")";
+        case op_type::secant: return std::string("sec(") + lhs + ")";
+        case op_type::cosecant: return std::string("csc(") + lhs + ")";
+        case op_type::cotangent: return std::string("cot(") + lhs + ")";
+        case op_type::arcsine: return std::string("asin(") + lhs + ")";
+        case op_type::arccosine: return std::string("acos(") + lhs + ")";
+        case op_type::arctangent: return std::string("atan(") + lhs + ")";
+        case op_type::arcsecant: return std::string("asec(") + lhs + ")";
+        case op_type::arccosecant: return std::string("acsc(") + lhs + ")";
+        case op_type::arccotangent: return std::string("acot(") + lhs + ")";
+        case op_type::derivative: return std::string("d/d") + rhs + "(" + lhs + ")";
+        case op_type::integral: return std::string("int(") + lhs + ", " + rhs + ")";
+        case op_type::differential: return std::string("d(") + lhs + ")";
+        default: assert(0); return "";
+    }
+}
 
 //------------------------------------------------------------------------------
 std::string to_string(expression const& in)
 {
     if (std::holds_alternative<op>(in)) {
         op const& in_op = std::get<op>(in);
-        switch (in_op.type) {
-            case op_type::equality: return to_string(in_op.lhs) + " = " + to_string(in_op.rhs);
-            case op_type::sum: return std::string("(") + to_string(in_op.lhs) + " + " + to_string(in_op.rhs) + ")";
-            case op_type::difference: return std::string("(") + to_string(in_op.lhs) + " - " + to_string(in_op.rhs) + ")";
-            case op_type::negative: return std::string("(-") + to_string(in_op.lhs) + ")";
-            case op_type::product: return std::string("(") + to_string(in_op.lhs) + " * " + to_string(in_op.rhs) + ")";
-            case op_type::quotient: return std::string("(") + to_string(in_op.lhs) + " / " + to_string(in_op.rhs) + ")";
-            case op_type::reciprocal: return std::string("(1/") + to_string(in_op.lhs) + ")";
-            case op_type::exponent: return std::string("(") + to_string(in_op.lhs) + " ^ " + to_string(in_op.rhs) + ")";
-            case op_type::logarithm: return std::string("log(") + to_string(in_op.lhs) + ", " + to_string(in_op.rhs) + ")";
-            case op_type::sine: return std::string("sin(") + to_string(in_op.lhs) + ")";
-            case op_type::cosine: return std::string("cos(") + to_string(in_op.lhs) + ")";
-            case op_type::tangent: return std::string("tan(") + to_string(in_op.lhs) + ")";
-            case op_type::secant: return std::string("sec(") + to_string(in_op.lhs) + ")";
-            case op_type::cosecant: return std::string("csc(") + to_string(in_op.lhs) + ")";
-            case op_type::cotangent: return std::string("cot(") + to_string(in_op.lhs) + ")";
-            case op_type::derivative: return std::string("d/d") + to_string(in_op.rhs) + "(" + to_string(in_op.lhs) + ")";
-            default: assert(0); return "";
-        }
+        return to_string(in_op.type, to_string(in_op.lhs), to_string(in_op.rhs));
     } else if (std::holds_alternative<value>(in)) {
         char buf[256];
         std::snprintf(buf, 256, "%g", std::get<value>(in));
@@ -203,7 +70,7 @@ std::string to_string(expression const& in)
             default: assert(0); return "";
         }
     } else if (std::holds_alternative<symbol>(in)) {
-        return std::get<symbol>(in);
+        return std::get<symbol>(in).name();
     } else if (std::holds_alternative<placeholder>(in)) {
         return std::string({'a' + static_cast<char>(std::get<placeholder>(in))});
     } else if (std::holds_alternative<empty>(in)) {
@@ -214,154 +81,143 @@ std::string to_string(expression const& in)
 }
 
 //------------------------------------------------------------------------------
-bool match_r(expression const& lhs, expression const& rhs, std::map<placeholder, expression>& placeholders)
+std::size_t hash(expression const& expr)
 {
-    // compare placeholders
-    if (std::holds_alternative<placeholder>(lhs) && std::holds_alternative<placeholder>(rhs)) {
-        return std::get<placeholder>(lhs) == std::get<placeholder>(rhs);
-    } else if (std::holds_alternative<placeholder>(lhs) || std::holds_alternative<placeholder>(rhs)) {
-        if (std::holds_alternative<placeholder>(lhs)) {
-            auto pl = placeholders.find(std::get<placeholder>(lhs));
-            if (pl != placeholders.end()) {
-                std::map<placeholder, expression> rhs_placeholders = placeholders;
-                if (!match_r(pl->second, rhs, rhs_placeholders)) {
-                    return false;
-                }
-                placeholders = rhs_placeholders;
-                return true;
-            } else {
-                placeholders[std::get<placeholder>(lhs)] = rhs;
-                return true;
-            }
-        } else {
-            return match_r(rhs, lhs, placeholders);
-        }
-
-    // compare values
-    } else if (std::holds_alternative<value>(lhs) && std::holds_alternative<value>(rhs)) {
-        return std::get<value>(lhs) == std::get<value>(rhs);
-
-    // compare constants
-    } else if (std::holds_alternative<constant>(lhs) && std::holds_alternative<constant>(rhs)) {
-        return std::get<constant>(lhs) == std::get<constant>(rhs);
-
-    // compare symbols
-    } else if (std::holds_alternative<symbol>(lhs) && std::holds_alternative<symbol>(rhs)) {
-        return std::get<symbol>(lhs) == std::get<symbol>(rhs);
-
-    // compare ops
-    } else if (std::holds_alternative<op>(lhs) && std::holds_alternative<op>(rhs)) {
-        op const& lhs_op = std::get<op>(lhs);
-        op const& rhs_op = std::get<op>(rhs);
+    std::size_t h = expr.index();
+    auto combine = [&h](std::size_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    };
 
-        if (lhs_op.type != rhs_op.type) {
-            return false;
-        }
-
-        std::map<placeholder, expression> op_placeholders = placeholders;
-        if (!match_r(lhs_op.lhs, rhs_op.lhs, op_placeholders)) {
-            return false;
-        }
-        if (!match_r(lhs_op.rhs, rhs_op.rhs, op_placeholders)) {
-            return false;
-        }
-        placeholders = std::move(op_placeholders);
-        return true;
-
-    // compare empty
-    } else if (std::holds_alternative<empty>(lhs) && std::holds_alternative<empty>(rhs)) {
-        return true;
-
-    // no match
-    } else {
-        return false;
+    if (std::holds_alternative<op>(expr)) {
+        op const& expr_op = std::get<op>(expr);
+        combine(static_cast<std::size_t>(expr_op.type));
+        combine(expr_op.lhs.hash());
+        combine(expr_op.rhs.hash());
+    } else if (std::holds_alternative<value>(expr)) {
+        // every NaN is equal, whatever its payload
+        value v = std::get<value>(expr);
+        combine(std::isnan(v) ? 0 : std::hash<value>()(v));
+    } else if (std::holds_alternative<constant>(expr)) {
+        combine(static_cast<std::size_t>(std::get<constant>(expr)));
+    } else if (std::holds_alternative<symbol>(expr)) {
+        combine(std::get<symbol>(expr).hash());
+    } else if (std::holds_alternative<placeholder>(expr)) {
+        combine(static_cast<std::size_t>(std::get<placeholder>(expr)));
     }
+    return h;
 }
 
 //------------------------------------------------------------------------------
-//! return the total number of operations in the expression
+op::op(op_type type, ptr<expression> lhs, ptr<expression> rhs)
+    : type(type)
+    , depth(std::uint16_t(std::min<std::size_t>(1 + std::max(algebra::depth(*lhs), algebra::depth(*rhs)), UINT16_MAX)))
+    , ops(1 + std::uint32_t(op_count(*lhs) + op_count(*rhs)))
+    , lhs(std::move(lhs))
+    , rhs(std::move(rhs))
+    // operands have been moved into the members
+    , placeholders(placeholder_mask(*this->lhs) | placeholder_mask(*this->rhs))
+    , symbols(std::uint32_t(symbol_count(*this->lhs) + symbol_count(*this->rhs)))
+{}
+
+//------------------------------------------------------------------------------
 std::size_t op_count(expression const& expr)
 {
     if (std::holds_alternative<op>(expr)) {
-        op const& expr_op = std::get<op>(expr);
-        return 1 + op_count(expr_op.lhs) + op_count(expr_op.rhs);
+        return std::get<op>(expr).ops;
     } else {
         return 0;
     }
 }
 
 //------------------------------------------------------------------------------
-void placeholder_count_r(expression const& expr, std::set<placeholder>& placeholders)
+bool cost_model::uniform() const
 {
-    if (std::holds_alternative<op>(expr)) {
-        op const& expr_op = std::get<op>(expr);
-        placeholder_count_r(expr_op.lhs, placeholders);
-        placeholder_count_r(expr_op.rhs, placeholders);
-    } else if (std::holds_alternative<placeholder>(expr)) {
-        placeholders.insert(std::get<placeholder>(expr));
-    }
+    return std::all_of(weights.begin(), weights.end(), [](double w) { return w == 1.0; });
 }
 
 //------------------------------------------------------------------------------
-//! return the number of unique placeholders in the expression
-std::set<placeholder> enumerate_placeholders(expression const& expr)
+double cost_model::operator()(expression const& expr) const
 {
-    std::set<placeholder> placeholders;
-    placeholder_count_r(expr, placeholders);
-    return placeholders;
+    if (uniform()) {
+        return double(op_count(expr));
+    }
+
+    struct visitor
+    {
+        cost_model const& model;
+        double operator()(expression const& expr) const
+        {
+            if (!std::holds_alternative<op>(expr)) {
+                return 0;
+            }
+            op const& expr_op = std::get<op>(expr);
+            return model.weight(expr_op.type) + (*this)(expr_op.lhs) + (*this)(expr_op.rhs);
+        }
+    };
+    return visitor{*this}(expr);
 }
 
 //------------------------------------------------------------------------------
-bool match_placeholders(std::map<placeholder, expression> const& map, std::set<placeholder> const& set)
+double lower_bound(expression const& expr, cost_model const& cost)
 {
-    if (map.size() != set.size()) {
-        return false;
+    if (!std::holds_alternative<op>(expr)) {
+        return 0;
     }
-    for (auto const& p : set) {
-        if (map.find(p) == map.end()) {
-            return false;
-        }
+    op const& expr_op = std::get<op>(expr);
+    if (rewritable(expr_op.type)) {
+        return 0;
     }
-    return true;
+    return cost.weight(expr_op.type) + lower_bound(expr_op.lhs, cost) + lower_bound(expr_op.rhs, cost);
 }
 
 //------------------------------------------------------------------------------
-bool match(expression const& lhs, expression const& rhs, std::map<placeholder, expression>& placeholders)
+std::size_t depth(expression const& expr)
 {
-    std::map<placeholder, expression> expr_placeholders = placeholders;
-    if (match_r(lhs, rhs, expr_placeholders)) {
-        placeholders = std::move(expr_placeholders);
-        return true;
+    if (std::holds_alternative<op>(expr)) {
+        return std::get<op>(expr).depth;
+    } else {
+        return 0;
     }
-    return false;
 }
 
 //------------------------------------------------------------------------------
-bool match(expression const& lhs, expression const& rhs)
+std::uint32_t placeholder_mask(expression const& expr)
 {
-    std::map<placeholder, expression> placeholders;
-    if (match_r(lhs, rhs, placeholders)) {
-        return true;
+    if (std::holds_alternative<op>(expr)) {
+        return std::get<op>(expr).placeholders;
+    } else if (std::holds_alternative<placeholder>(expr)) {
+        return 1u << static_cast<int>(std::get<placeholder>(expr));
+    } else {
+        return 0;
     }
-    return false;
 }
 
 //------------------------------------------------------------------------------
-expression apply_transform_r(
-    expression const& source,
-    expression const& target,
-    std::map<placeholder, expression> const& placeholders)
+std::size_t symbol_count(expression const& expr)
 {
-    // replace placeholders
-    if (std::holds_alternative<placeholder>(target)) {
-        return placeholders.at(std::get<placeholder>(target));
-    } else if (std::holds_alternative<op>(target)) {
-        op const& target_op = std::get<op>(target);
-        return op{target_op.type, apply_transform_r(source, target_op.lhs, placeholders),
-                                  apply_transform_r(source, target_op.rhs, placeholders)};
+    if (std::holds_alternative<op>(expr)) {
+        return std::get<op>(expr).symbols;
+    } else if (std::holds_alternative<symbol>(expr)) {
+        return 1;
     } else {
-        return target;
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+std::size_t interned_bytes()
+{
+    return ptr<expression>::interned_bytes() + ptr<std::string, false>::interned_bytes();
+}
+
+//------------------------------------------------------------------------------
+//! interned operands are equal if and only if they are identical
+int compare(ptr<expression> const& lhs, ptr<expression> const& rhs)
+{
+    if (lhs == rhs) {
+        return 0;
     }
+    return compare(*lhs, *rhs);
 }
 
 //------------------------------------------------------------------------------
@@ -413,10 +269,12 @@ int compare(expression const& lhs, expression const& rhs)
             } else {
                 return 1;
             }
-        // compare symbols lexicographically
+        // compare symbols lexicographically, equal names share an id
         } else if (std::holds_alternative<symbol>(lhs)) {
             assert(std::holds_alternative<symbol>(rhs));
-            return std::get<symbol>(lhs).compare(std::get<symbol>(rhs));
+            symbol const& lhs_sym = std::get<symbol>(lhs);
+            symbol const& rhs_sym = std::get<symbol>(rhs);
+            return lhs_sym == rhs_sym ? 0 : lhs_sym.name().compare(rhs_sym.name());
         // compare placeholders by enum value
         } else if (std::holds_alternative<placeholder>(lhs)) {
             assert(std::holds_alternative<placeholder>(rhs));
@@ -431,205 +289,1386 @@ int compare(expression const& lhs, expression const& rhs)
 }
 
 //------------------------------------------------------------------------------
-struct expression_cmp
+bool associative(op_type type)
 {
-    bool operator()(expression const& lhs, expression const& rhs) const
-    {
-        return compare(lhs, rhs) < 0;
-    }
-};
+    return type == op_type::sum || type == op_type::product;
+}
 
 //------------------------------------------------------------------------------
-// convert symbols into placeholders so they can be used for substitution
-expression convert_placeholders(expression const& expr)
+//! append the terms of a sum or product of `type`, `expr` itself if it isn't
+//! one
+void flatten(op_type type, expression const& expr, std::vector<expression>& terms)
 {
-    if (std::holds_alternative<op>(expr)) {
+    if (std::holds_alternative<op>(expr) && std::get<op>(expr).type == type) {
         op const& expr_op = std::get<op>(expr);
-        return op{expr_op.type, convert_placeholders(expr_op.lhs), convert_placeholders(expr_op.rhs)};
-    } else if (std::holds_alternative<symbol>(expr)) {
-        symbol s = std::get<symbol>(expr);
-        assert(s.length() == 1 && s[0] >= 'a' && s[0] <= 'z');
-        return static_cast<placeholder>(static_cast<int>(placeholder::x) + (s[0] - 'a'));
+        flatten(type, expr_op.lhs, terms);
+        flatten(type, expr_op.rhs, terms);
     } else {
-        return expr;
+        terms.push_back(expr);
+    }
+}
+
+//------------------------------------------------------------------------------
+std::size_t term_count(op_type type, expression const& expr)
+{
+    if (std::holds_alternative<op>(expr) && std::get<op>(expr).type == type) {
+        op const& expr_op = std::get<op>(expr);
+        return term_count(type, expr_op.lhs) + term_count(type, expr_op.rhs);
     }
+    return 1;
 }
 
 //------------------------------------------------------------------------------
-bool resolve_transforms()
+//! return the terms in `[begin, end)` nested to the right
+expression chain(op_type type, std::vector<expression>::const_iterator begin, std::vector<expression>::const_iterator end)
 {
-    if (transforms.size()) {
-        return true;
+    assert(begin != end);
+    expression out = *--end;
+    while (end != begin) {
+        out = op{type, *--end, out};
     }
+    return out;
+}
 
-    for (char const* str : transform_strings) {
-        expression expr = parse(str);
+//------------------------------------------------------------------------------
+//! exact value `num / den`, times pi if `pi` is set, in lowest terms with a
+//! positive denominator
+struct exact_value
+{
+    std::int64_t num;
+    std::int64_t den;
+    bool pi;
+};
 
-        assert(std::holds_alternative<op>(expr));
-        assert(std::get<op>(expr).type == op_type::equality);
+//! integers up to this magnitude are exact as values
+constexpr double exact_limit = 9007199254740992.0;
 
-        op const& expr_op = std::get<op>(expr);
-        transforms.push_back({convert_placeholders(expr_op.lhs), convert_placeholders(expr_op.rhs)});
+//------------------------------------------------------------------------------
+bool exact_mul(std::int64_t a, std::int64_t b, std::int64_t& out)
+{
+    // the floating point product is exact whenever the integer product is
+    if (std::fabs(double(a) * double(b)) >= exact_limit) {
+        return false;
     }
-
+    out = a * b;
     return true;
 }
 
 //------------------------------------------------------------------------------
-std::set<expression, expression_cmp> enumerate_transforms(expression const& expr)
+bool exact_add(std::int64_t a, std::int64_t b, std::int64_t& out)
 {
-    static std::map<expression, std::set<expression, expression_cmp>, expression_cmp> cached;
-
-    std::set<expression, expression_cmp> out;
+    out = a + b;
+    return std::fabs(double(out)) < exact_limit;
+}
 
-    resolve_transforms();
+//------------------------------------------------------------------------------
+bool make_exact(std::int64_t num, std::int64_t den, bool pi, exact_value& out)
+{
+    if (den == 0) {
+        return false;
+    } else if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    std::int64_t g = std::gcd(num, den);
+    out = {num / g, den / g, pi && num != 0};
+    return true;
+}
 
-    {
-        auto it = cached.find(expr);
-        if (it != cached.end()) {
-            return it->second;
-        }
+//------------------------------------------------------------------------------
+bool exact_sum(exact_value const& a, exact_value const& b, exact_value& out)
+{
+    std::int64_t lhs, rhs, num, den;
+    if (a.pi != b.pi && a.num && b.num) {
+        return false;
     }
+    return exact_mul(a.num, b.den, lhs) && exact_mul(b.num, a.den, rhs)
+        && exact_add(lhs, rhs, num) && exact_mul(a.den, b.den, den)
+        && make_exact(num, den, a.pi || b.pi, out);
+}
 
-    for (auto const& tr : transforms) {
-        std::set<placeholder> source_placeholders = enumerate_placeholders(tr.source);
-        std::set<placeholder> target_placeholders = enumerate_placeholders(tr.target);
-        std::set<placeholder> merged_placeholders;
-        merged_placeholders.insert(source_placeholders.begin(), source_placeholders.end());
-        merged_placeholders.insert(target_placeholders.begin(), target_placeholders.end());
+//------------------------------------------------------------------------------
+bool exact_product(exact_value const& a, exact_value const& b, exact_value& out)
+{
+    std::int64_t num, den;
+    return !(a.pi && b.pi)
+        && exact_mul(a.num, b.num, num) && exact_mul(a.den, b.den, den)
+        && make_exact(num, den, a.pi || b.pi, out);
+}
 
-        std::map<placeholder, expression> expr_placeholders;
+//------------------------------------------------------------------------------
+bool exact_quotient(exact_value const& a, exact_value const& b, exact_value& out)
+{
+    std::int64_t num, den;
+    return (!b.pi || a.pi)
+        && exact_mul(a.num, b.den, num) && exact_mul(a.den, b.num, den)
+        && make_exact(num, den, a.pi && !b.pi, out);
+}
 
-        assert(source_placeholders.size() == merged_placeholders.size()
-            || target_placeholders.size() == merged_placeholders.size());
+//------------------------------------------------------------------------------
+//! evaluate `expr` exactly if it is an arithmetic expression on integers and
+//! pi whose value is a rational multiple of pi or a rational
+bool to_exact(expression const& expr, exact_value& out)
+{
+    if (std::holds_alternative<value>(expr)) {
+        value v = std::get<value>(expr);
+        return v == std::trunc(v) && std::fabs(v) < exact_limit && make_exact(std::int64_t(v), 1, false, out);
+    } else if (std::holds_alternative<constant>(expr)) {
+        return std::get<constant>(expr) == constant::pi && make_exact(1, 1, true, out);
+    } else if (!std::holds_alternative<op>(expr) || std::get<op>(expr).symbols || std::get<op>(expr).placeholders) {
+        return false;
+    }
 
-        if (source_placeholders.size() == merged_placeholders.size()) {
-            if (match(expr, tr.source, expr_placeholders) && match_placeholders(expr_placeholders, merged_placeholders)) {
-                auto expr_tr = apply_transform_r(expr, tr.target, expr_placeholders);
-                assert(match(expr_tr, tr.target, expr_placeholders));
-                assert(enumerate_placeholders(expr_tr).size() == 0);
-                //printf("    %-40s %-20s  =>  %20s\n", to_string(expr_tr).c_str(), to_string(tr.source).c_str(), to_string(tr.target).c_str());
-                //for (auto const& pl : expr_placeholders) {
-                //    printf("    %50s %s: %s\n", "", to_string(pl.first).c_str(), to_string(pl.second).c_str());
-                //}
-                out.insert(expr_tr);
+    op const& expr_op = std::get<op>(expr);
+    exact_value lhs, rhs;
+    if (!to_exact(expr_op.lhs, lhs)) {
+        return false;
+    }
+    switch (expr_op.type) {
+        case op_type::negative: return make_exact(-lhs.num, lhs.den, lhs.pi, out);
+        case op_type::reciprocal: return !lhs.pi && make_exact(lhs.den, lhs.num, false, out);
+        default: break;
+    }
+    if (!to_exact(expr_op.rhs, rhs)) {
+        return false;
+    }
+    switch (expr_op.type) {
+        case op_type::sum: return exact_sum(lhs, rhs, out);
+        case op_type::difference: return exact_sum(lhs, {-rhs.num, rhs.den, rhs.pi}, out);
+        case op_type::product: return exact_product(lhs, rhs, out);
+        case op_type::quotient: return exact_quotient(lhs, rhs, out);
+        case op_type::exponent: {
+            // integer powers by repeated multiplication
+            if (rhs.pi || rhs.den != 1 || lhs.pi || std::abs(rhs.num) > 64 || (lhs.num == 0 && rhs.num < 0)) {
+                return false;
             }
-        }
-
-        if (target_placeholders.size() == merged_placeholders.size()) {
-            if (match(expr, tr.target, expr_placeholders) && match_placeholders(expr_placeholders, merged_placeholders)) {
-                auto expr_tr = apply_transform_r(expr, tr.source, expr_placeholders);
-                assert(match(expr_tr, tr.source, expr_placeholders));
-                assert(enumerate_placeholders(expr_tr).size() == 0);
-                //printf("    %-40s %-20s  =>  %20s\n", to_string(expr_tr).c_str(), to_string(tr.target).c_str(), to_string(tr.source).c_str());
-                //for (auto const& pl : expr_placeholders) {
-                //    printf("    %50s %s: %s\n", "", to_string(pl.first).c_str(), to_string(pl.second).c_str());
-                //}
-                out.insert(expr_tr);
+            exact_value power{1, 1, false};
+            for (std::int64_t ii = 0; ii < std::abs(rhs.num); ++ii) {
+                if (!exact_product(power, lhs, power)) {
+                    return false;
+                }
             }
+            return rhs.num < 0 ? make_exact(power.den, power.num, false, out) : (out = power, true);
         }
+        default: return false;
     }
+}
 
-    // transform subexpressions
-    if (std::holds_alternative<op>(expr)) {
-        op const& expr_op = std::get<op>(expr);
-        auto lhs_tr = enumerate_transforms(expr_op.lhs);
-        for (auto const& tr : lhs_tr) {
-            out.insert(op{expr_op.type, tr, expr_op.rhs});
-        }
-        auto rhs_tr = enumerate_transforms(expr_op.rhs);
-        for (auto const& tr : rhs_tr) {
-            out.insert(op{expr_op.type, expr_op.lhs, tr});
-        }
-
-        // simplify algebraic value expressions
-        if (std::holds_alternative<value>((expression const&)expr_op.lhs) && std::holds_alternative<value>((expression const&)expr_op.rhs)) {
-            value lhs = std::get<value>((expression const&)expr_op.lhs);
-            value rhs = std::get<value>((expression const&)expr_op.rhs);
-
-            switch (expr_op.type) {
-                case op_type::sum: out.insert(lhs + rhs); break;
-                case op_type::difference:
-                    if (lhs < rhs) {
-                        out.insert(op{op_type::reciprocal, rhs - lhs});
-                    } else {
-                        out.insert(lhs - rhs);
-                    }
-                    break;
-                case op_type::product: out.insert(lhs * rhs); break;
-                case op_type::quotient: out.insert(lhs / rhs); break;
-                case op_type::exponent: out.insert(std::pow(lhs, rhs)); break;
-            }
-        }
+//------------------------------------------------------------------------------
+//! return the canonical form of an exact value, e.g. `-((pi * 3) / 2)`
+expression from_exact(exact_value const& v)
+{
+    value n = value(std::abs(v.num));
+    expression out = !v.pi ? expression(n)
+        : n == 1.0 ? expression(constant::pi)
+        : expression(op{op_type::product, expression(constant::pi), expression(n)});
+    if (v.den != 1) {
+        out = op{op_type::quotient, out, expression(value(v.den))};
+    }
+    if (v.num < 0) {
+        out = op{op_type::negative, out};
     }
-
-    cached[expr] = out;
     return out;
 }
 
-struct expression_queue_cmp
+//------------------------------------------------------------------------------
+//! return `expr` with the exact terms of a sum or product combined, zero
+//! and one removed from the other terms and products with a zero factor
+//! replaced by zero, or `expr` if nothing was folded
+expression fold_terms(op_type type, expression const& expr)
 {
-    bool operator()(expression const& lhs, expression const& rhs) const
-    {
-        return op_count(lhs) > op_count(rhs);
+    std::vector<expression> terms;
+    flatten(type, expr, terms);
+
+    // rational and pi multiple terms of a sum are collected separately
+    std::vector<expression> out;
+    exact_value acc[2];
+    expression first[2];
+    std::size_t count[2] = {0, 0};
+    bool zero = false;
+    bool undefined = false;
+    for (auto const& term : terms) {
+        exact_value v, next;
+        if (!to_exact(term, v)) {
+            undefined |= term == expression(constant::undefined);
+            out.push_back(term);
+            continue;
+        }
+        zero |= type == op_type::product && v.num == 0;
+        std::size_t const group = type == op_type::sum && v.pi;
+        if (!count[group]) {
+            acc[group] = v;
+            first[group] = term;
+            ++count[group];
+        } else if (type == op_type::sum ? exact_sum(acc[group], v, next) : exact_product(acc[group], v, next)) {
+            acc[group] = next;
+            ++count[group];
+        } else {
+            out.push_back(term);
+        }
     }
-};
+
+    // an undefined factor is not cancelled by zero
+    if (zero && !undefined) {
+        return 0.0;
+    }
+
+    // only reordering the terms is not folding, it would take the place of
+    // reductions which apply to `expr`
+    bool folded = false;
+    for (std::size_t group = 0; group < 2; ++group) {
+        exact_value const& v = acc[group];
+        bool const identity = type == op_type::sum ? v.num == 0 : v.num == 1 && v.den == 1 && !v.pi;
+        if (!count[group]) {
+            continue;
+        } else if (identity) {
+            folded = true;
+        } else {
+            expression term = from_exact(v);
+            folded |= count[group] > 1 || term != first[group];
+            out.push_back(term);
+        }
+    }
+    if (!folded) {
+        return expr;
+    }
+    if (!out.size()) {
+        out.push_back(expression(type == op_type::sum ? 0.0 : 1.0));
+    }
+
+    std::stable_sort(out.begin(), out.end(), [](expression const& lhs, expression const& rhs) {
+        return compare(lhs, rhs) < 0;
+    });
+    return chain(type, out.begin(), out.end());
+}
 
 //------------------------------------------------------------------------------
-void traceback(expression const& expr, std::map<expression, expression, expression_cmp> const& trace)
+expression fold_root(expression const& expr)
 {
-    auto prev = trace.find(expr);
-    if (prev != trace.end()) {
-        traceback(prev->second, trace);
+    if (!std::holds_alternative<op>(expr)) {
+        return empty{};
     }
-    printf("(%zu) %s\n", op_count(expr), to_string(expr).c_str());
+
+    exact_value v;
+    if (to_exact(expr, v)) {
+        expression out = from_exact(v);
+        return out == expr ? expression{} : out;
+    }
+
+    op const& expr_op = std::get<op>(expr);
+    if (associative(expr_op.type)) {
+        expression out = fold_terms(expr_op.type, expr);
+        if (out != expr) {
+            return out;
+        }
+    }
+
+    // values which aren't integers are folded in floating point
+    if (std::holds_alternative<value>((expression const&)expr_op.lhs) && std::holds_alternative<value>((expression const&)expr_op.rhs)) {
+        value lhs = std::get<value>((expression const&)expr_op.lhs);
+        value rhs = std::get<value>((expression const&)expr_op.rhs);
+
+        // values are never negative, negation is an operator
+        switch (expr_op.type) {
+            case op_type::sum: return lhs + rhs;
+            case op_type::difference:
+                if (lhs < rhs) {
+                    return op{op_type::negative, expression(rhs - lhs)};
+                } else {
+                    return lhs - rhs;
+                }
+            case op_type::product: return lhs * rhs;
+            case op_type::quotient: return rhs == 0.0 ? expression(constant::undefined) : expression(lhs / rhs);
+            case op_type::exponent: return std::pow(lhs, rhs);
+            default: break;
+        }
+    }
+    return empty{};
 }
 
 //------------------------------------------------------------------------------
-expression simplify(expression const& expr, std::size_t max_operations, std::size_t max_iterations)
+//! return `expr` folded, or an empty expression if nothing was folded so that
+//! unchanged subexpressions are not copied
+expression fold_r(expression const& expr)
 {
-    std::set<expression, expression_cmp> closed;
-    std::priority_queue<expression, std::vector<expression>, expression_queue_cmp> queue;
-    std::map<expression, expression, expression_cmp> trace;
-
-    queue.push(expr);
-    closed.insert(expr);
+    if (!std::holds_alternative<op>(expr)) {
+        return empty{};
+    }
 
-    // smallest expression found in search
-    expression best = expr;
-    std::size_t best_ops = op_count(best);
+    op const& expr_op = std::get<op>(expr);
+    expression lhs = fold_r(expr_op.lhs);
+    expression rhs = fold_r(expr_op.rhs);
+    if (std::holds_alternative<empty>(lhs) && std::holds_alternative<empty>(rhs)) {
+        return fold_root(expr);
+    }
 
-    for (std::size_t ii = 0; ii < max_iterations && queue.size(); ++ii) {
-        auto const next = queue.top();
-        queue.pop();
-        //printf("%s\n", to_string(next).c_str());
+    expression out = op{expr_op.type,
+        std::holds_alternative<empty>(lhs) ? expr_op.lhs : ptr<expression>(lhs),
+        std::holds_alternative<empty>(rhs) ? expr_op.rhs : ptr<expression>(rhs)};
+    expression folded = fold_root(out);
+    return std::holds_alternative<empty>(folded) ? out : folded;
+}
 
-        std::size_t next_ops = op_count(next);
-        if (next_ops < best_ops) {
-            best = next;
-            best_ops = next_ops;
-        }
+//------------------------------------------------------------------------------
+expression fold(expression const& expr)
+{
+    expression out = fold_r(expr);
+    return std::holds_alternative<empty>(out) ? expr : out;
+}
 
-        // exceeded maximum complexity
-        if (next_ops >= max_operations) {
-            break;
-        // can't get any simpler than zero
-        } else if (next_ops == 0) {
-            break;
-        }
+//------------------------------------------------------------------------------
+//! return `expr` in canonical form, or an empty expression if it already is
+expression canonical_r(expression const& expr)
+{
+    if (!std::holds_alternative<op>(expr)) {
+        return empty{};
+    }
 
-        auto transforms = enumerate_transforms(next);
-        for (auto const& next_tr : transforms) {
-            if (closed.find(next_tr) == closed.end()) {
-                queue.push(next_tr);
-                closed.insert(next_tr);
-                trace[next_tr] = next;
+    op const& expr_op = std::get<op>(expr);
+    if (associative(expr_op.type)) {
+        std::vector<expression> terms;
+        flatten(expr_op.type, expr, terms);
+        for (auto& term : terms) {
+            expression next = canonical_r(term);
+            if (!std::holds_alternative<empty>(next)) {
+                term = std::move(next);
             }
         }
+        std::stable_sort(terms.begin(), terms.end(), [](expression const& lhs, expression const& rhs) {
+            return compare(lhs, rhs) < 0;
+        });
+        expression out = chain(expr_op.type, terms.begin(), terms.end());
+        return out == expr ? expression{} : out;
     }
 
-    traceback(best, trace);
-    return best;
+    expression lhs = canonical_r(expr_op.lhs);
+    expression rhs = canonical_r(expr_op.rhs);
+    if (std::holds_alternative<empty>(lhs) && std::holds_alternative<empty>(rhs)) {
+        return empty{};
+    }
+    return op{expr_op.type,
+        std::holds_alternative<empty>(lhs) ? expr_op.lhs : ptr<expression>(lhs),
+        std::holds_alternative<empty>(rhs) ? expr_op.rhs : ptr<expression>(rhs)};
 }
 
-} // namespace algebra
+//------------------------------------------------------------------------------
+expression canonical(expression const& expr)
+{
+    expression out = canonical_r(expr);
+    return std::holds_alternative<empty>(out) ? expr : out;
+}
+
+//------------------------------------------------------------------------------
+//! return `term` inserted into the sorted terms of `terms`, reusing the
+//! operations after it
+expression insert_term(op_type type, expression const& term, expression const& terms)
+{
+    if (!std::holds_alternative<op>(terms) || std::get<op>(terms).type != type) {
+        return compare(term, terms) <= 0 ? op{type, term, terms} : op{type, terms, term};
+    }
+    op const& terms_op = std::get<op>(terms);
+    if (compare(term, (expression const&)terms_op.lhs) <= 0) {
+        return op{type, term, terms};
+    }
+    return op{type, terms_op.lhs, insert_term(type, term, terms_op.rhs)};
+}
+
+//------------------------------------------------------------------------------
+bool is_chain(op_type type, expression const& expr)
+{
+    return std::holds_alternative<op>(expr) && std::get<op>(expr).type == type;
+}
+
+//------------------------------------------------------------------------------
+expression canonical_op(op_type type, expression const& lhs, expression const& rhs)
+{
+    if (!associative(type)) {
+        return op{type, lhs, rhs};
+    }
+
+    // a single term is inserted, numbers are only folded if it is one since
+    // the other operand's numbers are already folded
+    if (!is_chain(type, lhs) || !is_chain(type, rhs)) {
+        expression const& term = is_chain(type, lhs) ? rhs : lhs;
+        expression out = insert_term(type, term, &term == &lhs ? rhs : lhs);
+        return !symbol_count(term) && !placeholder_mask(term) ? fold_terms(type, out) : out;
+    }
+
+    // both operands are sorted so their terms only need to be merged
+    std::vector<expression> lhs_terms;
+    std::vector<expression> rhs_terms;
+    flatten(type, lhs, lhs_terms);
+    flatten(type, rhs, rhs_terms);
+    std::vector<expression> terms;
+    terms.reserve(lhs_terms.size() + rhs_terms.size());
+    std::merge(lhs_terms.begin(), lhs_terms.end(), rhs_terms.begin(), rhs_terms.end(), std::back_inserter(terms),
+        [](expression const& lhs, expression const& rhs) {
+            return compare(lhs, rhs) < 0;
+        });
+    // only fold if numbers could be combined or removed, or zero is a factor
+    std::size_t numbers = 0;
+    bool identity = false;
+    for (auto const& term : terms) {
+        if (!symbol_count(term) && !placeholder_mask(term)) {
+            ++numbers;
+            identity |= term == expression(type == op_type::sum ? 0.0 : 1.0)
+                || (type == op_type::product && term == expression(0.0));
+        }
+    }
+    expression out = chain(type, terms.begin(), terms.end());
+    return numbers > 1 || identity ? fold_terms(type, out) : out;
+}
+
+//------------------------------------------------------------------------------
+memo<expression, rewrite_set>& rewrite_cache()
+{
+    static memo<expression, rewrite_set> cache;
+    return cache;
+}
+
+//------------------------------------------------------------------------------
+//! approximate memory use of a rewrite set, for cache accounting
+std::size_t rewrite_set_bytes(rewrite_set const& set)
+{
+    return sizeof(rewrite_set) + set.capacity() * sizeof(rewrite);
+}
+
+//------------------------------------------------------------------------------
+void rewrite_statistics::record(std::size_t rule, bool matched)
+{
+    if (attempts.size() <= rule) {
+        attempts.resize(rule + 1);
+        matches.resize(rule + 1);
+    }
+    ++attempts[rule];
+    matches[rule] += matched;
+}
+
+//------------------------------------------------------------------------------
+rewrite_statistics& rewrite_statistics::operator+=(rewrite_statistics const& other)
+{
+    memo_hits += other.memo_hits;
+    memo_misses += other.memo_misses;
+    folds += other.folds;
+    if (attempts.size() < other.attempts.size()) {
+        attempts.resize(other.attempts.size());
+        matches.resize(other.matches.size());
+    }
+    for (std::size_t ii = 0; ii < other.attempts.size(); ++ii) {
+        attempts[ii] += other.attempts[ii];
+        matches[ii] += other.matches[ii];
+    }
+    match_seconds += other.match_seconds;
+    rewrite_seconds += other.rewrite_seconds;
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+using stopwatch = std::chrono::steady_clock;
+
+//------------------------------------------------------------------------------
+//! return the seconds elapsed since `start` and restart it
+double seconds_since(stopwatch::time_point& start)
+{
+    auto now = stopwatch::now();
+    double out = std::chrono::duration<double>(now - start).count();
+    start = now;
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! append the rewrites of an operation on some terms of a sum or product to
+//! `out`, with the terms returned by `rest` added back to each result. The
+//! remaining terms are only built once something matches. If `terms` is not
+//! zero only patterns of that many terms are tried.
+template<typename rest_fn> void pair_rewrites(
+    expression const& subject,
+    rest_fn const& rest,
+    std::size_t terms,
+    std::vector<transform_ref>& candidates,
+    rewrite_set& out,
+    rewrite_statistics* stats)
+{
+    expression remaining;
+    bool built = false;
+
+    candidates.clear();
+    transforms_index.retrieve(subject, candidates);
+
+    for (auto const& ref : candidates) {
+        transform const& tr = transforms[ref.index];
+        pattern const& source = ref.reverse ? tr.target : tr.source;
+        pattern const& target = ref.reverse ? tr.source : tr.target;
+        if (terms && term_count(std::get<op>(subject).type, source.expr) != terms) {
+            continue;
+        }
+
+        // matching and substitution are only timed when counting
+        bindings expr_bindings;
+        stopwatch::time_point start = stats ? stopwatch::now() : stopwatch::time_point{};
+        bool matched = match(source, subject, expr_bindings);
+        if (stats) {
+            stats->match_seconds += seconds_since(start);
+            stats->record(ref.index, matched);
+        }
+        if (matched) {
+            auto expr_tr = apply_transform_r(subject, target.expr, expr_bindings);
+            if (stats) {
+                stats->rewrite_seconds += seconds_since(start);
+            }
+            assert(match(expr_tr, target.expr, expr_bindings));
+            assert(!placeholder_mask(expr_tr));
+            //printf("    %-40s %-20s  =>  %20s\n", to_string(expr_tr).c_str(), to_string(source.expr).c_str(), to_string(target.expr).c_str());
+
+            // substitution may nest sums or products in the result, and
+            // leave operations on numbers which are folded immediately
+            expr_tr = fold(canonical(expr_tr));
+            if (!built) {
+                remaining = rest();
+                built = true;
+            }
+            if (!std::holds_alternative<empty>(remaining)) {
+                expr_tr = canonical_op(std::get<op>(subject).type, expr_tr, remaining);
+            }
+            out.push_back({0, ref.index, ref.reverse, expr_tr});
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//! return the rewrites of the root of `expr`, operands are not rewritten
+//!
+//! Sums and products are matched modulo the order and grouping of their
+//! terms, each ordered pair of terms is rewritten as if it were the operation
+//! and the remaining terms are added back to the result. Patterns of more
+//! terms are matched against each combination of as many terms, both are
+//! canonical so the terms of a combination are in the order of the pattern's.
+std::shared_ptr<rewrite_set const> root_rewrites(expression const& expr, memo<expression, rewrite_set>& cache, rewrite_statistics* stats)
+{
+    if (auto cached = cache.find(expr)) {
+        if (stats) {
+            ++stats->memo_hits;
+        }
+        return cached;
+    }
+    if (stats) {
+        ++stats->memo_misses;
+    }
+
+    rewrite_set out;
+    std::vector<transform_ref> candidates;
+
+    if (std::holds_alternative<op>(expr) && associative(std::get<op>(expr).type)) {
+        op_type const type = std::get<op>(expr).type;
+        std::vector<expression> terms;
+        flatten(type, expr, terms);
+
+        std::vector<expression> others;
+        for (std::size_t ii = 0; ii < terms.size(); ++ii) {
+            for (std::size_t jj = 0; jj < terms.size(); ++jj) {
+                if (ii == jj) {
+                    continue;
+                }
+                auto rest = [&]() {
+                    others.clear();
+                    for (std::size_t kk = 0; kk < terms.size(); ++kk) {
+                        if (kk != ii && kk != jj) {
+                            others.push_back(terms[kk]);
+                        }
+                    }
+                    return others.size() ? chain(type, others.begin(), others.end()) : expression{};
+                };
+                pair_rewrites(op{type, terms[ii], terms[jj]}, rest, 0, candidates, out, stats);
+            }
+        }
+
+        std::uint32_t const arities = pattern_arities(type);
+        std::vector<std::size_t> chosen;
+        std::vector<expression> subset;
+        for (std::size_t count = 3; count <= terms.size() && count < 32; ++count) {
+            if (!(arities & (std::uint32_t(1) << count))) {
+                continue;
+            }
+            // combinations in lexicographic order of their indices
+            chosen.resize(count);
+            for (std::size_t ii = 0; ii < count; ++ii) {
+                chosen[ii] = ii;
+            }
+            for (;;) {
+                subset.clear();
+                for (std::size_t ii : chosen) {
+                    subset.push_back(terms[ii]);
+                }
+                auto rest = [&]() {
+                    others.clear();
+                    for (std::size_t kk = 0, ii = 0; kk < terms.size(); ++kk) {
+                        if (ii < count && chosen[ii] == kk) {
+                            ++ii;
+                        } else {
+                            others.push_back(terms[kk]);
+                        }
+                    }
+                    return others.size() ? chain(type, others.begin(), others.end()) : expression{};
+                };
+                pair_rewrites(chain(type, subset.begin(), subset.end()), rest, count, candidates, out, stats);
+
+                std::size_t ii = count;
+                while (ii && chosen[ii - 1] == terms.size() - count + ii - 1) {
+                    --ii;
+                }
+                if (!ii) {
+                    break;
+                }
+                ++chosen[ii - 1];
+                for (std::size_t jj = ii; jj < count; ++jj) {
+                    chosen[jj] = chosen[jj - 1] + 1;
+                }
+            }
+        }
+    } else {
+        pair_rewrites(expr, []() { return expression{}; }, 0, candidates, out, stats);
+    }
+
+    // simplify algebraic value expressions
+    expression folded = fold_root(expr);
+    if (!std::holds_alternative<empty>(folded)) {
+        out.push_back({0, rewrite::folded, false, folded});
+        if (stats) {
+            ++stats->folds;
+        }
+    }
+
+    std::size_t bytes = rewrite_set_bytes(out);
+    return cache.insert(expr, std::make_shared<rewrite_set const>(std::move(out)), bytes);
+}
+
+//------------------------------------------------------------------------------
+//! operation enclosing the subexpression being rewritten
+struct rewrite_parent
+{
+    op const* parent;
+    bool rhs;   //!< subexpression is the right operand
+};
+
+//------------------------------------------------------------------------------
+bool for_each_rewrite_r(
+    expression const& expr,
+    bool tail,
+    std::size_t& position,
+    std::vector<rewrite_parent>& parents,
+    memo<expression, rewrite_set>& cache,
+    std::function<bool(rewrite const&)> const& fn,
+    rewrite_statistics* stats)
+{
+    std::size_t const expr_position = position++;
+
+    // the terms of a sum or product nested in the right operand of another
+    // were already paired at the root of the outer one
+    if (!tail) {
+        auto roots = root_rewrites(expr, cache, stats);
+        for (rewrite const& root : *roots) {
+            // substitute the rewritten subexpression into each enclosing
+            // operation, merging terms so the result stays canonical
+            expression result = root.result;
+            for (auto it = parents.rbegin(); it != parents.rend(); ++it) {
+                op const& p = *it->parent;
+                result = it->rhs ? canonical_op(p.type, p.lhs, result) : canonical_op(p.type, result, p.rhs);
+            }
+            if (!fn({expr_position, root.rule, root.reverse, result})) {
+                return false;
+            }
+        }
+    }
+
+    // transform subexpressions
+    if (std::holds_alternative<op>(expr)) {
+        op const& expr_op = std::get<op>(expr);
+        bool const rhs_tail = associative(expr_op.type)
+            && std::holds_alternative<op>((expression const&)expr_op.rhs)
+            && std::get<op>((expression const&)expr_op.rhs).type == expr_op.type;
+        parents.push_back({&expr_op, false});
+        if (!for_each_rewrite_r(expr_op.lhs, false, position, parents, cache, fn, stats)) {
+            return false;
+        }
+        parents.back().rhs = true;
+        if (!for_each_rewrite_r(expr_op.rhs, rhs_tail, position, parents, cache, fn, stats)) {
+            return false;
+        }
+        parents.pop_back();
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool for_each_rewrite(
+    expression const& expr,
+    memo<expression, rewrite_set>& cache,
+    std::function<bool(rewrite const&)> const& fn,
+    rewrite_statistics* statistics)
+{
+    resolve_transforms();
+
+    std::size_t position = 0;
+    std::vector<rewrite_parent> parents;
+    return for_each_rewrite_r(expr, false, position, parents, cache, fn, statistics);
+}
+
+//------------------------------------------------------------------------------
+bool for_each_rewrite(expression const& expr, std::function<bool(rewrite const&)> const& fn)
+{
+    return for_each_rewrite(expr, rewrite_cache(), fn);
+}
+
+//------------------------------------------------------------------------------
+//! return the result of folding the root of `expr`, or else of the first
+//! reduction which lowers its cost, or an empty expression if there is none
+expression reduce_root(expression const& expr, cost_model const& cost, std::vector<transform_ref>& candidates)
+{
+    // folding is applied regardless of cost since it only terminates in exact
+    // canonical values
+    expression folded = fold_root(expr);
+    if (!std::holds_alternative<empty>(folded)) {
+        return folded;
+    }
+
+    double const expr_cost = cost(expr);
+
+    candidates.clear();
+    reductions_index.retrieve(expr, candidates);
+    for (auto const& ref : candidates) {
+        transform const& tr = transforms[ref.index];
+        bindings expr_bindings;
+        if (match(tr.source, expr, expr_bindings)) {
+            // patterns reduce the operation count, but not necessarily the
+            // weighted cost
+            expression result = apply_transform_r(expr, tr.target.expr, expr_bindings);
+            if (cost(result) < expr_cost) {
+                return result;
+            }
+        }
+    }
+    return empty{};
+}
+
+//------------------------------------------------------------------------------
+expression normalize_r(
+    expression const& expr,
+    cost_model const& cost,
+    std::unordered_map<expression, expression>& normal,
+    std::vector<transform_ref>& candidates,
+    std::size_t& reductions)
+{
+    if (!std::holds_alternative<op>(expr)) {
+        return expr;
+    }
+    auto it = normal.find(expr);
+    if (it != normal.end()) {
+        return it->second;
+    }
+
+    op const& expr_op = std::get<op>(expr);
+    expression lhs = normalize_r(expr_op.lhs, cost, normal, candidates, reductions);
+    expression rhs = normalize_r(expr_op.rhs, cost, normal, candidates, reductions);
+    expression out = lhs == expr_op.lhs && rhs == expr_op.rhs ? expr : expression(op{expr_op.type, lhs, rhs});
+
+    // derivatives are taken directly instead of by the differentiation rules,
+    // the result has fewer derivative operations so this terminates too
+    if (expr_op.type == op_type::derivative && std::holds_alternative<symbol>(rhs)) {
+        expression derivative = differentiate(lhs, std::get<symbol>(rhs));
+        if (derivative != out) {
+            ++reductions;
+            out = normalize_r(derivative, cost, normal, candidates, reductions);
+            normal.emplace(expr, out);
+            return out;
+        }
+    }
+
+    // substitution builds new operations from the bound operands so the result
+    // is normalized again, which terminates since every reduction lowers the
+    // cost
+    expression reduced = reduce_root(out, cost, candidates);
+    if (!std::holds_alternative<empty>(reduced)) {
+        ++reductions;
+        out = normalize_r(reduced, cost, normal, candidates, reductions);
+    }
+
+    normal.emplace(expr, out);
+    return out;
+}
+
+//------------------------------------------------------------------------------
+expression normalize(expression const& expr, cost_model const& cost, std::size_t* reductions)
+{
+    resolve_transforms();
+
+    std::unordered_map<expression, expression> normal;
+    std::vector<transform_ref> candidates;
+    std::size_t count = 0;
+    expression out = normalize_r(expr, cost, normal, candidates, count);
+    if (reductions) {
+        *reductions += count;
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! expression reached by the search and the node it was rewritten from, so
+//! derivations are chains of indices rather than copies of each expression
+struct search_node
+{
+    static constexpr std::uint32_t no_parent = UINT32_MAX;
+
+    expression expr;
+    std::uint32_t parent;
+};
+
+//------------------------------------------------------------------------------
+//! expressions reached by the search, as indices into its node table
+//!
+//! Slots are probed linearly from the hash of the node's expression and hold
+//! 4 bytes each, so with a budget the table is allocated once and its size is
+//! known up front. Entries are only removed by `clear`.
+struct closed_set
+{
+    static constexpr std::uint32_t no_node = UINT32_MAX;
+
+    std::pmr::vector<search_node> const& nodes;
+    std::pmr::vector<std::uint32_t> slots;
+    std::size_t count = 0;
+
+    std::size_t size() const { return count; }
+
+    //! room for `n` nodes without growing
+    void reserve(std::size_t n)
+    {
+        if (2 * n > slots.size()) {
+            rehash(2 * n);
+        }
+    }
+
+    void clear()
+    {
+        std::fill(slots.begin(), slots.end(), no_node);
+        count = 0;
+    }
+
+    bool contains(expression const& expr) const
+    {
+        if (!slots.size()) {
+            return false;
+        }
+        for (std::size_t ii = start(expr); ; ii = ii + 1 < slots.size() ? ii + 1 : 0) {
+            if (slots[ii] == no_node) {
+                return false;
+            } else if (nodes[slots[ii]].expr == expr) {
+                return true;
+            }
+        }
+    }
+
+    //! add a node whose expression is not already contained
+    void insert(std::uint32_t node)
+    {
+        if (2 * (count + 1) > slots.size()) {
+            rehash(std::max<std::size_t>(2 * slots.size(), 16));
+        }
+        place(node);
+        ++count;
+    }
+
+    std::size_t start(expression const& expr) const
+    {
+        // golden ratio multiplication spreads hashes of nearby ids
+        return std::size_t((std::uint64_t(hash(expr)) * 0x9e3779b97f4a7c15ull) >> 32) % slots.size();
+    }
+
+    void place(std::uint32_t node)
+    {
+        std::size_t ii = start(nodes[node].expr);
+        while (slots[ii] != no_node) {
+            ii = ii + 1 < slots.size() ? ii + 1 : 0;
+        }
+        slots[ii] = node;
+    }
+
+    void rehash(std::size_t size)
+    {
+        std::pmr::vector<std::uint32_t> old(size, no_node, slots.get_allocator());
+        old.swap(slots);
+        for (std::uint32_t node : old) {
+            if (node != no_node) {
+                place(node);
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+//! frontier node ordered by its priority, then by its cost
+struct queue_entry
+{
+    double priority;
+    double cost;
+    std::uint32_t node;
+};
+
+//------------------------------------------------------------------------------
+struct expression_queue_cmp
+{
+    bool operator()(queue_entry const& lhs, queue_entry const& rhs) const
+    {
+        if (lhs.priority != rhs.priority) {
+            return lhs.priority > rhs.priority;
+        }
+        return lhs.cost > rhs.cost;
+    }
+};
+
+//------------------------------------------------------------------------------
+//! forwards to another resource and records the most bytes outstanding
+struct counting_resource : std::pmr::memory_resource
+{
+    std::pmr::memory_resource* upstream = std::pmr::new_delete_resource();
+    std::size_t bytes = 0;
+    std::size_t peak = 0;
+
+    void* do_allocate(std::size_t size, std::size_t alignment) override
+    {
+        void* p = upstream->allocate(size, alignment);
+        bytes += size;
+        peak = std::max(peak, bytes);
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t size, std::size_t alignment) override
+    {
+        upstream->deallocate(p, size, alignment);
+        bytes -= size;
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+//------------------------------------------------------------------------------
+simplify_status simplify_options::interrupted() const
+{
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        return simplify_status::cancelled;
+    } else if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline) {
+        return simplify_status::deadline;
+    }
+    return simplify_status::complete;
+}
+
+//------------------------------------------------------------------------------
+void traceback(std::uint32_t node, std::pmr::vector<search_node> const& nodes)
+{
+    std::vector<std::uint32_t> chain;
+    for (; node != search_node::no_parent; node = nodes[node].parent) {
+        chain.push_back(node);
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        expression const& expr = nodes[*it].expr;
+        printf("(%zu) %s\n", op_count(expr), to_string(expr).c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+//! number of nodes which fit in `max_memory` bytes of search state, each node
+//! has an entry in the node table, the closed set and possibly the frontier
+std::size_t node_budget(std::size_t max_memory)
+{
+    // two slots of the closed set and one for remapping while forgetting
+    std::size_t const node_bytes = sizeof(search_node) + sizeof(queue_entry) + 3 * sizeof(std::uint32_t);
+    // enough for the derivations of a few rounds of expansion to survive
+    return std::max<std::size_t>(max_memory / node_bytes, 64);
+}
+
+//------------------------------------------------------------------------------
+expression simplify_search(expression const& expr, simplify_options const& options, simplify_statistics* stats)
+{
+    // search state is allocated from an arena which is released all at once
+    // on return, interned nodes once the last expression referring to them
+    // is since results and cached rewrites outlive the search. With a memory
+    // budget half of it is for the tables, which are allocated once at the
+    // largest size which fits and never grow, and half for the expressions
+    // interned meanwhile. Once those take more than their half fewer nodes
+    // are kept.
+    std::size_t const max_nodes = options.max_memory ? node_budget(options.max_memory / 2) : SIZE_MAX;
+    std::size_t node_limit = max_nodes;
+    // counted across the process, including what other threads intern
+    std::size_t const interned_start = ptr<expression>::interned_count();
+    auto interned_growth = [&]() {
+        std::size_t const count = ptr<expression>::interned_count();
+        return count > interned_start ? (count - interned_start) * ptr<expression>::interned_node_bytes() : 0;
+    };
+    std::size_t peak_memory = 0;
+    counting_resource counter;
+    std::pmr::monotonic_buffer_resource arena(&counter);
+
+    std::pmr::vector<search_node> nodes(&arena);
+    closed_set closed{nodes, std::pmr::vector<std::uint32_t>(&arena)};
+    //! heap ordered by `expression_queue_cmp`
+    std::pmr::vector<queue_entry> queue(&arena);
+    std::pmr::vector<std::uint32_t> remap(&arena);
+    if (options.max_memory) {
+        nodes.reserve(max_nodes);
+        closed.reserve(max_nodes);
+        queue.reserve(max_nodes);
+        remap.reserve(max_nodes);
+    }
+    memo<expression, rewrite_set>& cache = options.cache ? *options.cache : rewrite_cache();
+
+    // the calling thread expands one node per round alongside the workers,
+    // which are shared with other searches rather than started per call
+    std::size_t threads = std::max<std::size_t>(options.threads, 1);
+    thread_pool* pool = nullptr;
+    if (threads > 1) {
+        pool = options.pool ? options.pool : &shared_thread_pool();
+    }
+
+    expression_queue_cmp const cmp;
+    // best-first search orders candidates by their cost, A* by the bound on
+    // the cost of anything reachable from them
+    auto push = [&](std::uint32_t node, double cost) {
+        expression const& next = nodes[node].expr;
+        queue.push_back({options.astar ? lower_bound(next, options.cost) : cost, cost, node});
+        std::push_heap(queue.begin(), queue.end(), cmp);
+    };
+
+    // keep the `count` candidates which would be dequeued first
+    std::size_t pruned = 0;
+    auto prune = [&](std::size_t count) {
+        if (queue.size() <= count) {
+            return;
+        }
+        std::nth_element(queue.begin(), queue.begin() + count, queue.end(),
+            [&](queue_entry const& lhs, queue_entry const& rhs) { return cmp(rhs, lhs); });
+        pruned += queue.size() - count;
+        queue.resize(count);
+        std::make_heap(queue.begin(), queue.end(), cmp);
+    };
+
+    nodes.push_back({expr, search_node::no_parent});
+    closed.insert(0);
+    push(0, options.cost(expr));
+
+    // cheapest expression found in search
+    std::uint32_t best = 0;
+    double best_cost = options.cost(expr);
+
+    std::pmr::vector<expression> batch(&arena);
+    std::pmr::vector<std::uint32_t> batch_nodes(&arena);
+    // filled concurrently by the workers, which the arena does not allow
+    std::vector<std::vector<expression>> expanded(threads);
+    // counted per thread and summed on return
+    std::vector<rewrite_statistics> rewrite_stats(stats ? threads : 0);
+
+    // forget every node which is not pending, being expanded or on the
+    // derivation of one of those or of the best expression, so it may be
+    // reached and expanded again. The frontier is pruned until at most half
+    // of the budget remains in use.
+    std::size_t forgotten = 0;
+    auto compact = [&]() {
+        remap.assign(nodes.size(), search_node::no_parent);
+        std::size_t live = 0;
+        auto mark = [&](std::uint32_t node, bool chain) {
+            if (!chain) {
+                nodes[node].parent = search_node::no_parent;
+            }
+            for (; node != search_node::no_parent && remap[node] == search_node::no_parent; node = nodes[node].parent) {
+                remap[node] = 0;
+                ++live;
+            }
+        };
+        for (bool chain = true; ; ) {
+            mark(best, chain);
+            for (std::uint32_t node : batch_nodes) {
+                mark(node, chain);
+            }
+            for (auto const& entry : queue) {
+                mark(entry.node, chain);
+            }
+            if (live <= node_limit / 2 || (!queue.size() && (live < nodes.size() || !chain))) {
+                break;
+            }
+            std::fill(remap.begin(), remap.end(), search_node::no_parent);
+            live = 0;
+            // derivations alone fill the budget, only their ends are kept
+            if (!queue.size()) {
+                chain = false;
+            }
+            prune(queue.size() / 2);
+        }
+
+        // parents precede their children so nodes are moved down in place
+        closed.clear();
+        std::uint32_t next = 0;
+        for (std::uint32_t ii = 0; ii < nodes.size(); ++ii) {
+            if (remap[ii] != search_node::no_parent) {
+                std::uint32_t const parent = nodes[ii].parent;
+                nodes[next] = {nodes[ii].expr, parent == search_node::no_parent ? parent : remap[parent]};
+                closed.insert(next);
+                remap[ii] = next++;
+            }
+        }
+        forgotten += nodes.size() - next;
+        nodes.resize(next);
+
+        best = remap[best];
+        for (auto& node : batch_nodes) {
+            node = remap[node];
+        }
+        for (auto& entry : queue) {
+            entry.node = remap[entry.node];
+        }
+    };
+
+    simplify_status status = simplify_status::complete;
+    std::size_t generated = 0;
+    std::size_t ii = 0;
+    while (queue.size()) {
+        if (ii >= options.max_iterations) {
+            status = simplify_status::iterations;
+            break;
+        }
+        status = options.interrupted();
+        if (status != simplify_status::complete) {
+            break;
+        }
+
+        std::size_t const interned = interned_growth();
+        peak_memory = std::max(peak_memory, counter.bytes + interned);
+        if (options.max_memory) {
+            std::size_t const remaining = options.max_memory - std::min(interned, options.max_memory);
+            node_limit = std::min(max_nodes, node_budget(remaining));
+        }
+
+        bool finished = false;
+
+        // take up to one node per thread from the front of the queue
+        batch.clear();
+        batch_nodes.clear();
+        while (batch.size() < threads && ii < options.max_iterations && queue.size()) {
+            queue_entry const top = queue.front();
+            expression const& next = nodes[top.node].expr;
+
+            // exceeded maximum complexity or can't get any cheaper, expand
+            // nodes that were dequeued before this one first
+            bool const done = options.astar
+                ? top.priority >= best_cost
+                : op_count(next) >= options.max_operations || top.cost <= 0;
+            if (done && batch.size()) {
+                break;
+            }
+
+            std::pop_heap(queue.begin(), queue.end(), cmp);
+            queue.pop_back();
+            ++ii;
+
+            if (top.cost < best_cost) {
+                best = top.node;
+                best_cost = top.cost;
+                if (options.on_improve) {
+                    options.on_improve(next, best_cost);
+                }
+            }
+
+            if (done) {
+                finished = true;
+                break;
+            }
+
+            // the bound is not monotonic in the operation count so A* skips
+            // large candidates rather than stopping at them
+            if (options.astar && op_count(next) >= options.max_operations) {
+                continue;
+            }
+
+            if (options.on_expand) {
+                options.on_expand(next, top.cost);
+            }
+            batch.push_back(next);
+            batch_nodes.push_back(top.node);
+        }
+
+        if (finished) {
+            break;
+        }
+
+        // expand in parallel, the closed set is only read during expansion
+        auto expand = [&](std::size_t jj) {
+            expanded[jj].clear();
+            for_each_rewrite(batch[jj], cache, [&](rewrite const& next_tr) {
+                if (!closed.contains(next_tr.result)) {
+                    expanded[jj].push_back(next_tr.result);
+                    // nothing is cheaper, the remaining rewrites are not needed
+                    if (options.cost(next_tr.result) <= 0) {
+                        return false;
+                    }
+                }
+                return true;
+            }, stats ? &rewrite_stats[jj] : nullptr);
+        };
+
+        if (pool && batch.size() > 1) {
+            pool->parallel_for(batch.size(), expand);
+        } else {
+            for (std::size_t jj = 0; jj < batch.size(); ++jj) {
+                expand(jj);
+            }
+        }
+
+        // merge in dequeue order so the result does not depend on scheduling
+        for (std::size_t jj = 0; jj < batch.size(); ++jj) {
+            for (auto const& next_tr : expanded[jj]) {
+                if (closed.contains(next_tr)) {
+                    continue;
+                }
+                if (nodes.size() >= node_limit) {
+                    compact();
+                }
+                std::uint32_t const node = std::uint32_t(nodes.size());
+                nodes.push_back({next_tr, batch_nodes[jj]});
+                closed.insert(node);
+                // candidates which can't beat the best stay closed so they
+                // are not bounded again when reached by another path
+                if (options.astar && lower_bound(next_tr, options.cost) >= best_cost) {
+                    continue;
+                }
+                push(node, options.cost(next_tr));
+                ++generated;
+            }
+        }
+
+        if (stats) {
+            stats->expanded += batch.size();
+            stats->frontier_peak = std::max(stats->frontier_peak, queue.size());
+        }
+
+        // the frontier is allowed to grow to twice the beam between prunings
+        // so each costs constant time per candidate
+        if (options.beam_width && queue.size() > 2 * options.beam_width) {
+            prune(options.beam_width);
+        }
+    }
+
+    if (stats) {
+        stats->status = status;
+        stats->generated = generated;
+        stats->closed = closed.size();
+        stats->pruned = pruned;
+        stats->forgotten = forgotten;
+        stats->peak_memory = std::max(counter.peak, peak_memory);
+        for (auto const& s : rewrite_stats) {
+            stats->rewrites += s;
+        }
+    }
+
+    if (options.trace) {
+        traceback(best, nodes);
+    }
+    return nodes[best].expr;
+}
+
+//------------------------------------------------------------------------------
+expression simplify_with(expression const& expr, simplify_options const& options, simplify_statistics* stats)
+{
+    if (options.results) {
+        expression cached = options.results->find(expr, options);
+        if (!std::holds_alternative<empty>(cached)) {
+            if (stats) {
+                stats->cached = true;
+            }
+            if (options.trace) {
+                printf("(%zu) %s\n", op_count(cached), to_string(cached).c_str());
+            }
+            return cached;
+        }
+    }
+
+    // reductions are applied unconditionally so only what remains is searched
+    expression start = expr;
+    if (options.normalize) {
+        start = normalize(start, options.cost, stats ? &stats->reductions : nullptr);
+    }
+    // the search matches sums and products modulo order, the e-graph applies
+    // commutativity and associativity as rules
+    if (options.engine == simplify_engine::search) {
+        start = canonical(start);
+    }
+    if (options.trace && start != expr) {
+        printf("(%zu) %s\n", op_count(expr), to_string(expr).c_str());
+    }
+    // the first improvement is usually the reduced input, the search only
+    // reports what it finds after that
+    if (options.on_improve && options.engine == simplify_engine::search && start != expr) {
+        double const start_cost = options.cost(start);
+        if (start_cost < options.cost(expr)) {
+            options.on_improve(start, start_cost);
+        }
+    }
+
+    expression best = options.engine == simplify_engine::egraph
+        ? simplify_egraph(start, options, stats)
+        : simplify_search(start, options, stats);
+
+    // the result of an interrupted search depends on timing, it is only
+    // returned
+    if (options.results && options.interrupted() == simplify_status::complete) {
+        options.results->insert(expr, options, best);
+    }
+    return best;
+}
+
+//------------------------------------------------------------------------------
+expression simplify(expression const& expr, simplify_options const& options)
+{
+    return simplify_with(expr, options, nullptr);
+}
+
+//------------------------------------------------------------------------------
+expression simplify(expression const& expr, simplify_options const& options, simplify_statistics& statistics)
+{
+    statistics = {};
+    stopwatch::time_point start = stopwatch::now();
+    expression best = simplify_with(expr, options, &statistics);
+    statistics.seconds = seconds_since(start);
+    statistics.interned_bytes = interned_bytes();
+    return best;
+}
+
+//------------------------------------------------------------------------------
+expression simplify(expression const& expr, std::size_t max_operations, std::size_t max_iterations)
+{
+    simplify_options options;
+    options.max_operations = max_operations;
+    options.max_iterations = max_iterations;
+    return simplify(expr, options);
+}
+
+//------------------------------------------------------------------------------
+std::future<simplify_result> simplify_async(expression const& expr, simplify_options const& options)
+{
+    return std::async(std::launch::async, [expr, options]() {
+        simplify_result result;
+        result.best = simplify(expr, options, result.statistics);
+        return result;
+    });
+}
+
+} // namespace algebra
+
+//------------------------------------------------------------------------------
+bool ptr_traits<algebra::expression>::permanent(algebra::expression const& expr)
+{
+    // small integers are as common as symbols, other values are unbounded
+    if (std::holds_alternative<algebra::value>(expr)) {
+        algebra::value v = std::get<algebra::value>(expr);
+        return v == std::trunc(v) && v <= 1024.0;
+    }
+    return !std::holds_alternative<algebra::op>(expr);
+}
@@ -2,18 +2,39 @@
 //
 
 #pragma once
+#include "memo.h"
 #include "ptr.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
+#include <vector>
+
+namespace algebra {
+class expression;
+} // namespace algebra
+
+//------------------------------------------------------------------------------
+//! leaves other than values are bounded by the symbols and constants in use
+//! and referred to by nearly every operation, so they are never reclaimed
+template<> struct ptr_traits<algebra::expression>
+{
+    static bool permanent(algebra::expression const& expr);
+};
 
 namespace algebra {
 
 //------------------------------------------------------------------------------
 //! operations and functions
-enum class op_type
+enum class op_type : std::uint8_t
 {
     equality,       //!< `lhs` = `rhs`
     sum,            //!< `lhs` + `rhs`
@@ -41,11 +62,15 @@ enum class op_type
     differential,   //!< differential of `lhs` for integration
 };
 
+constexpr std::size_t op_type_count = static_cast<std::size_t>(op_type::differential) + 1;
+
 class expression;
+class persistent_cache;
+class thread_pool;
 
 //------------------------------------------------------------------------------
 //! common constant and transcendental values
-enum class constant
+enum class constant : std::uint8_t
 {
     undefined,  //!< e.g. divide by zero
     pi,         //!<
@@ -55,31 +80,84 @@ enum class constant
 
 //------------------------------------------------------------------------------
 //! operator
+//!
+//! Fields are ordered to pack into 24 bytes since operators make up most of
+//! the interned nodes visited while matching.
 struct op
 {
+    op(op_type type, ptr<expression> lhs, ptr<expression> rhs = {});
+
     op_type type;
+
+    //
+    //  summary of operands, computed once at construction
+    //
+
+    std::uint16_t depth;        //!< number of operations on the longest path to a leaf, saturating
+    std::uint32_t ops;          //!< total number of operations including this one
+
     ptr<expression> lhs;
     ptr<expression> rhs;
+
+    std::uint32_t placeholders; //!< bitmask of placeholders, see `placeholder_mask`
+    std::uint32_t symbols;      //!< number of symbol leaves
 };
 
+static_assert(sizeof(op) == 24, "unexpected operator layout");
+
+//! operands are interned so operators can be compared by identity
+inline bool operator==(op const& lhs, op const& rhs)
+{
+    return lhs.type == rhs.type && lhs.lhs == rhs.lhs && lhs.rhs == rhs.rhs;
+}
+
 //------------------------------------------------------------------------------
 //! placeholder value for pattern matching and substitution
-enum class placeholder
+enum class placeholder : std::uint8_t
 {
     a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, q, r, s, t, u, v, w, x, y, z,
 };
 
+constexpr std::size_t placeholder_count = 26;
+
 //------------------------------------------------------------------------------
 //! empty expression for unused operands
 struct empty {};
 
+inline bool operator==(empty, empty) { return true; }
+
 //------------------------------------------------------------------------------
 //! scalar value
 using value = double;
 
 //------------------------------------------------------------------------------
 //! variable/symbol
-using symbol = std::string;
+//!
+//! Names are interned so a symbol is a trivially copyable id, symbols with
+//! the same name compare equal by identity and the name is only needed for
+//! printing and ordering.
+class symbol
+{
+public:
+    explicit symbol(std::string_view name)
+        : _name(std::string(name))
+    {}
+
+    //! stable identifier of the interned name
+    std::size_t id() const { return _name.id(); }
+    //! cached hash of the name
+    std::size_t hash() const { return _name.hash(); }
+    std::string const& name() const { return *_name; }
+
+    bool operator==(symbol const& other) const { return _name == other._name; }
+    bool operator!=(symbol const& other) const { return _name != other._name; }
+
+protected:
+    //! names are few and kept for the life of the process
+    ptr<std::string, false> _name;
+};
+
+static_assert(std::is_trivially_copyable_v<symbol>, "symbols should not own their names");
 
 //------------------------------------------------------------------------------
 using expression_base = std::variant<empty, op, constant, value, symbol, placeholder>;
@@ -87,17 +165,335 @@ class expression : public expression_base
 {
 public:
     using expression_base::expression_base;
+
+    //! shallow equality, interned operands are compared by identity. NaN
+    //! values are equal to each other so that they are interned once.
+    bool operator==(expression const& other) const
+    {
+        if (std::holds_alternative<value>(*this) && std::holds_alternative<value>(other)) {
+            value lhs = std::get<value>(*this);
+            value rhs = std::get<value>(other);
+            return lhs == rhs || (std::isnan(lhs) && std::isnan(rhs));
+        }
+        return static_cast<expression_base const&>(*this) == other;
+    }
+    bool operator!=(expression const& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+//------------------------------------------------------------------------------
+//! structural hash, uses the cached hashes of interned operands
+std::size_t hash(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return a human-readable representation of the expression
+std::string to_string(expression const& expr);
+//! return a human-readable representation of an operation on operands which
+//! have already been converted
+std::string to_string(op_type type, std::string const& lhs, std::string const& rhs);
+
+//------------------------------------------------------------------------------
+//! total order on expressions, returns a negative value if `lhs` is ordered
+//! before `rhs`, zero if they are equal and a positive value otherwise
+int compare(expression const& lhs, expression const& rhs);
+
+//------------------------------------------------------------------------------
+//! true for sums and products, whose terms may be reordered and regrouped
+bool associative(op_type type);
+//! number of terms of a sum or product of `type`, 1 if `expr` isn't one
+std::size_t term_count(op_type type, expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return `expr` with the terms of every sum and product flattened, sorted by
+//! `compare` and nested to the right, e.g. `(c + a) + b` is `a + (b + c)`
+expression canonical(expression const& expr);
+//! return the canonical operation of `type` on canonical operands, which
+//! merges their terms if it is a sum or product and combines their numbers
+//! as `fold` does
+expression canonical_op(op_type type, expression const& lhs, expression const& rhs);
+
+//------------------------------------------------------------------------------
+//! return `expr` with arithmetic on integers and pi evaluated exactly
+//!
+//! Results are rationals and rational multiples of pi in the form the rules
+//! are written in, e.g. `6 / 4` is `3 / 2` and `pi / 2 + pi` is
+//! `(pi * 3) / 2`, negative results are negations. The numbers in a sum or
+//! product are combined and zero and one are removed from them. Operations
+//! on values which are not integers are evaluated in floating point, and
+//! division by zero is `constant::undefined`.
+expression fold(expression const& expr);
+//! return the result of `fold` at the root of `expr` whose operands are
+//! already folded, or an empty expression if it doesn't change
+expression fold_root(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return the total number of operations in the expression
+std::size_t op_count(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return the number of operations on the longest path to a leaf
+std::size_t depth(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return a bitmask with bit `n` set if placeholder `n` is in the expression
+std::uint32_t placeholder_mask(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return the number of symbol leaves in the expression
+std::size_t symbol_count(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! approximate bytes held by the process-wide tables of interned operations
+//! and symbol names. Operations are reclaimed once no expression refers to
+//! them, the tables keep the size of the most interned at once.
+std::size_t interned_bytes();
+
+//------------------------------------------------------------------------------
+//! expression reachable from another by a single transform
+struct rewrite
+{
+    //! value of `rule` for rewrites which fold an operation on two values
+    static constexpr std::size_t folded = SIZE_MAX;
+
+    std::size_t position;   //!< preorder index of the rewritten subexpression
+    std::size_t rule;       //!< index into `transforms`, or `folded`
+    bool reverse;           //!< `rule` was applied from target to source
+    expression result;      //!< rewritten expression
+};
+
+//------------------------------------------------------------------------------
+//! rewrites of the root of an expression, at position zero
+using rewrite_set = std::vector<rewrite>;
+
+//------------------------------------------------------------------------------
+//! bounded cache of root rewrites shared by all calls to `simplify`, limits can
+//! be changed with `configure` while no other thread is simplifying
+memo<expression, rewrite_set>& rewrite_cache();
+
+//------------------------------------------------------------------------------
+//! counters for the rewrites enumerated by `for_each_rewrite`
+struct rewrite_statistics
+{
+    std::size_t memo_hits = 0;      //!< root rewrites found in the cache
+    std::size_t memo_misses = 0;    //!< root rewrites enumerated by matching
+    std::size_t folds = 0;          //!< operations on two values folded
+    //! candidate matches tried for each transform, indexed as `transforms`
+    std::vector<std::size_t> attempts;
+    //! candidate matches which succeeded for each transform
+    std::vector<std::size_t> matches;
+    double match_seconds = 0;       //!< time spent matching patterns
+    double rewrite_seconds = 0;     //!< time spent substituting matches
+
+    void record(std::size_t rule, bool matched);
+    rewrite_statistics& operator+=(rewrite_statistics const& other);
+};
+
+//------------------------------------------------------------------------------
+//! call `fn` with each rewrite of `expr` by a single transform, root rewrites
+//! first and then those of operands in preorder, until it returns false, and
+//! return false if it did. Rewrites are produced one at a time so results may
+//! repeat. Only the root rewrites of each subexpression are cached. Counters
+//! are added to `statistics` if it is not null, which also times matching.
+//!
+//! Sums and products are rewritten modulo the order and grouping of their
+//! terms, and results are `canonical` if `expr` is.
+bool for_each_rewrite(
+    expression const& expr,
+    memo<expression, rewrite_set>& cache,
+    std::function<bool(rewrite const&)> const& fn,
+    rewrite_statistics* statistics = nullptr);
+bool for_each_rewrite(expression const& expr, std::function<bool(rewrite const&)> const& fn);
+
+//------------------------------------------------------------------------------
+//! cost of an expression as the sum of the weights of its operations
+//!
+//! All weights are one by default, which is the same as `op_count`. Leaves
+//! have no cost and weights must not be negative.
+struct cost_model
+{
+    cost_model() { weights.fill(1.0); }
+
+    std::array<double, op_type_count> weights;
+
+    double weight(op_type type) const { return weights[static_cast<std::size_t>(type)]; }
+    //! true if every weight is one so the cost is the cached `op_count`
+    bool uniform() const;
+    double operator()(expression const& expr) const;
+};
+
+//------------------------------------------------------------------------------
+//! return a lower bound on the cost of every expression the built-in
+//! transforms can reach from `expr`
+//!
+//! Operations which no transform or value folding can rewrite at the root,
+//! e.g. equalities and inverse trigonometric functions, remain in every
+//! rewrite along with the bounds of their operands. Any other operation may
+//! be collapsed, so its bound is zero.
+double lower_bound(expression const& expr, cost_model const& cost);
+
+//------------------------------------------------------------------------------
+//! apply reducing transforms and `fold`, bottom-up until neither applies,
+//! and replace derivatives with respect to a symbol by `differentiate`
+//!
+//! Only oriented transforms whose target has fewer operations than their
+//! source are used, and only where they lower `cost`, so each subexpression
+//! is visited once plus once per reduction and the result does not depend on
+//! the search limits. Adds the number of reductions to `reductions` if it is
+//! not null.
+expression normalize(expression const& expr, cost_model const& cost = {}, std::size_t* reductions = nullptr);
+
+//------------------------------------------------------------------------------
+//! algorithm used by `simplify`
+enum class simplify_engine
+{
+    //! best-first search over rewritten expressions, each rewrite is a state
+    search,
+    //! equality saturation, rules are applied to classes of equal expressions
+    //! until nothing changes or `max_nodes` is reached, then the smallest
+    //! expression is extracted. Does not use `threads`, `max_operations` or
+    //! the rewrite cache.
+    egraph,
+};
+
+//------------------------------------------------------------------------------
+//! why `simplify` stopped
+enum class simplify_status
+{
+    //! no candidate was left which could improve within `max_operations`,
+    //! or the e-graph saturated or reached `max_nodes`
+    complete,
+    iterations, //!< stopped at `max_iterations`
+    deadline,   //!< stopped at `simplify_options::deadline`
+    cancelled,  //!< stopped by `simplify_options::cancel`
+};
+
+//------------------------------------------------------------------------------
+//! parameters for `simplify`
+struct simplify_options
+{
+    simplify_engine engine = simplify_engine::search;
+    //! cost minimized by the search and by extraction from the e-graph
+    cost_model cost;
+    //! order the search by `lower_bound` instead of cost, and discard
+    //! candidates whose bound can't improve on the best expression found
+    bool astar = false;
+    //! apply `normalize` before searching, so only expressions which no
+    //! reduction applies to are searched
+    bool normalize = true;
+    std::size_t max_operations = SIZE_MAX;  //!< stop at the first candidate with this many operations
+    //! maximum number of candidates to expand, or rounds of rule application
+    //! for `simplify_engine::egraph`
+    std::size_t max_iterations = SIZE_MAX;
+    //! maximum number of nodes in the e-graph for `simplify_engine::egraph`
+    std::size_t max_nodes = 1 << 12;
+    //! keep about this many candidates pending, discarding the most expensive
+    //! once there are twice as many, 0 keeps every candidate. Discarded
+    //! candidates stay closed so they are not reached again.
+    std::size_t beam_width = 0;
+    //! bytes of search state and of expressions interned during the search,
+    //! 0 is unbounded. The node table, closed set and frontier are allocated
+    //! once at the largest size which fits in half, and when they are full,
+    //! or the expressions interned since the search started take more than
+    //! the other half, every expression which is not pending or on the
+    //! derivation of one which is, or of the best, is forgotten so it may be
+    //! reached again. Interned expressions are counted across the process so
+    //! include those of concurrent searches. The rewrites of the candidates
+    //! expanded in one round are held in addition to this. Not used by
+    //! `simplify_engine::egraph`, and `cache` is shared and not counted.
+    std::size_t max_memory = 0;
+    //! stop searching at this time and return the best expression found, it
+    //! is checked once per round of expansion
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    //! stop searching once this is set, e.g. by another thread
+    std::atomic<bool> const* cancel = nullptr;
+    //! number of threads expanding candidates in parallel, the calling thread
+    //! is one of them. The result depends on the thread count but not on
+    //! scheduling, so it is deterministic for any given count.
+    std::size_t threads = 1;
+    //! workers for `threads` greater than one, which are shared with other
+    //! searches, null uses `shared_thread_pool`
+    thread_pool* pool = nullptr;
+    //! print the derivation of the result to stdout
+    bool trace = false;
+    //! called with each candidate and its cost as it is expanded, not
+    //! called by `simplify_engine::egraph`
+    std::function<void(expression const& expr, double cost)> on_expand;
+    //! called with each expression cheaper than those found before it,
+    //! starting with the result of `normalize` if it is cheaper than the
+    //! input, not called by `simplify_engine::egraph`
+    std::function<void(expression const& expr, double cost)> on_improve;
+    //! rewrite cache to use instead of `rewrite_cache`, e.g. one per thread
+    memo<expression, rewrite_set>* cache = nullptr;
+    //! results of previous calls, if `expr` was simplified with the same
+    //! options the result is returned without searching, otherwise it is
+    //! inserted unless the search was stopped by `deadline` or `cancel`
+    persistent_cache* results = nullptr;
+
+    //! return `deadline` or `cancelled` if the search should stop now,
+    //! otherwise `complete`
+    simplify_status interrupted() const;
 };
 
 //------------------------------------------------------------------------------
-//! transformation pattern for simplifying expressions
-struct transform
+//! counters describing a call to `simplify`
+struct simplify_statistics
 {
-    expression source;
-    expression target;
+    //! candidates expanded, or rounds of rule application for
+    //! `simplify_engine::egraph`
+    std::size_t expanded = 0;
+    std::size_t generated = 0;      //!< distinct rewrites added to the frontier
+    std::size_t frontier_peak = 0;  //!< largest number of pending candidates
+    //! expressions reached, or nodes in the e-graph for
+    //! `simplify_engine::egraph`
+    std::size_t closed = 0;
+    bool cached = false;            //!< result was found in `simplify_options::results`
+    simplify_status status = simplify_status::complete;
+    std::size_t reductions = 0;     //!< rewrites applied by `normalize`
+    std::size_t pruned = 0;         //!< candidates discarded for `simplify_options::beam_width`
+    std::size_t forgotten = 0;      //!< expressions forgotten for `simplify_options::max_memory`
+    std::size_t peak_memory = 0;    //!< most bytes of search state and expressions interned by it at once
+    //! `interned_bytes` after the call, it is shared with every other call
+    std::size_t interned_bytes = 0;
+    double seconds = 0;
+    //! counters from enumerating rewrites, not collected by
+    //! `simplify_engine::egraph`
+    rewrite_statistics rewrites;
 };
 
 //------------------------------------------------------------------------------
+expression simplify(expression const& expr, simplify_options const& options);
+//! simplify and replace `statistics` with counters for the call, which also
+//! times matching and substitution
+expression simplify(expression const& expr, simplify_options const& options, simplify_statistics& statistics);
 expression simplify(expression const& expr, std::size_t max_operations = SIZE_MAX, std::size_t max_iterations = SIZE_MAX);
 
+//------------------------------------------------------------------------------
+//! result of `simplify_async`
+struct simplify_result
+{
+    expression best;
+    simplify_statistics statistics;
+};
+
+//------------------------------------------------------------------------------
+//! simplify on a new thread, `simplify_options::on_improve` is called on that
+//! thread with each improvement as it is found and `simplify_options::cancel`
+//! stops the search early with the best expression so far
+std::future<simplify_result> simplify_async(expression const& expr, simplify_options const& options);
+
 } // namespace algebra
+
+//------------------------------------------------------------------------------
+namespace std {
+
+template<> struct hash<algebra::expression>
+{
+    std::size_t operator()(algebra::expression const& expr) const
+    {
+        return algebra::hash(expr);
+    }
+};
+
+} // namespace std
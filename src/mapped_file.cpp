@@ -0,0 +1,112 @@
+// mapped_file.cpp
+//
+
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define MAPPED_FILE_HAS_MMAP 1
+#else
+#   define MAPPED_FILE_HAS_MMAP 0
+#endif
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+mapped_file::mapped_file(char const* path)
+    : _data(nullptr)
+    , _size(0)
+    , _mapped(false)
+{
+#if MAPPED_FILE_HAS_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        _error = std::string("failed to open ") + path + ": " + std::strerror(errno);
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        _error = std::string("failed to stat ") + path + ": " + std::strerror(errno);
+    } else if (st.st_size > 0) {
+        void* data = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            ::madvise(data, std::size_t(st.st_size), MADV_SEQUENTIAL);
+            _data = static_cast<char const*>(data);
+            _size = std::size_t(st.st_size);
+            _mapped = true;
+        }
+    }
+    ::close(fd);
+    if (_mapped || !_error.empty() || st.st_size == 0) {
+        return;
+    }
+#endif
+
+    // fall back to reading, e.g. for pipes which can't be mapped
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        _error = std::string("failed to open ") + path;
+        return;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    _buffer = contents.str();
+    _data = _buffer.data();
+    _size = _buffer.size();
+}
+
+//------------------------------------------------------------------------------
+mapped_file::~mapped_file()
+{
+#if MAPPED_FILE_HAS_MMAP
+    if (_mapped) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+mapped_file::mapped_file(mapped_file&& other)
+    : _data(other._data)
+    , _size(other._size)
+    , _mapped(other._mapped)
+    , _buffer(std::move(other._buffer))
+    , _error(std::move(other._error))
+{
+    if (!_mapped) {
+        _data = _buffer.data();
+    }
+    other._data = nullptr;
+    other._size = 0;
+    other._mapped = false;
+}
+
+//------------------------------------------------------------------------------
+mapped_file& mapped_file::operator=(mapped_file&& other)
+{
+    // the previous mapping is released when `other` is destroyed
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_mapped, other._mapped);
+    std::swap(_buffer, other._buffer);
+    std::swap(_error, other._error);
+    if (!_mapped) {
+        _data = _buffer.data();
+    }
+    if (!other._mapped) {
+        other._data = other._buffer.data();
+    }
+    return *this;
+}
+
+} // namespace algebra
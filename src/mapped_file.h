@@ -0,0 +1,45 @@
+// mapped_file.h
+//
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! read-only view of a file's contents
+//!
+//! The file is memory-mapped where supported so large inputs are paged in on
+//! demand rather than copied, otherwise it is read into a buffer.
+class mapped_file
+{
+public:
+    explicit mapped_file(char const* path);
+    ~mapped_file();
+
+    mapped_file(mapped_file&& other);
+    mapped_file& operator=(mapped_file&& other);
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    //! false if the file could not be opened or read, see `error`
+    bool valid() const { return _error.empty(); }
+    std::string const& error() const { return _error; }
+
+    char const* data() const { return _data; }
+    std::size_t size() const { return _size; }
+    std::string_view view() const { return std::string_view(_data, _size); }
+
+protected:
+    char const* _data;
+    std::size_t _size;
+    //! true if `_data` is a mapping rather than pointing into `_buffer`
+    bool _mapped;
+    std::string _buffer;
+    std::string _error;
+};
+
+} // namespace algebra
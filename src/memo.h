@@ -0,0 +1,164 @@
+// memo.h
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! limits for a `memo` cache
+struct memo_config
+{
+    std::size_t max_entries = 1 << 16;  //!< maximum number of cached results
+    //! approximate maximum memory use of cached results, which excludes the
+    //! interned expressions they refer to, see `interned_bytes`
+    std::size_t max_bytes = 256 << 20;
+    std::size_t shards = 16;            //!< number of independently locked shards
+};
+
+//------------------------------------------------------------------------------
+//! counters for a `memo` cache
+struct memo_statistics
+{
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+};
+
+//------------------------------------------------------------------------------
+//! bounded, thread-safe memoization cache
+//!
+//! Keys are distributed over shards which are locked independently, and each
+//! shard evicts its least recently used entries once its share of the limits
+//! in `memo_config` is exceeded. Results are immutable and shared, so lookups
+//! never copy them and evicted results stay valid for as long as they are used.
+template<typename Key, typename Value, typename Hash = std::hash<Key>> class memo
+{
+public:
+    using result = std::shared_ptr<Value const>;
+
+    memo(memo_config const& config = {})
+    {
+        configure(config);
+    }
+
+    //! change limits, discards all cached results
+    void configure(memo_config const& config)
+    {
+        std::size_t count = config.shards ? config.shards : 1;
+        _shards = std::vector<shard>(count);
+        for (auto& s : _shards) {
+            s.max_entries = (config.max_entries + count - 1) / count;
+            s.max_bytes = (config.max_bytes + count - 1) / count;
+        }
+    }
+
+    //! return the cached result for `key`, or null if not cached
+    result find(Key const& key)
+    {
+        shard& s = get_shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) {
+            ++s.stats.misses;
+            return nullptr;
+        }
+        ++s.stats.hits;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return it->second->value;
+    }
+
+    //! cache a result whose approximate memory use is `bytes`, returns the
+    //! cached result which may differ from `value` if another thread inserted
+    //! the same key first
+    result insert(Key const& key, result value, std::size_t bytes)
+    {
+        shard& s = get_shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        if (it != s.map.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            return it->second->value;
+        }
+
+        s.lru.push_front({key, value, bytes});
+        s.map.emplace(key, s.lru.begin());
+        s.stats.bytes += bytes;
+
+        // evict least recently used entries, keeping at least the new one
+        while (s.lru.size() > 1 && (s.lru.size() > s.max_entries || s.stats.bytes > s.max_bytes)) {
+            s.stats.bytes -= s.lru.back().bytes;
+            s.map.erase(s.lru.back().key);
+            s.lru.pop_back();
+            ++s.stats.evictions;
+        }
+
+        return value;
+    }
+
+    //! discard all cached results, counters are not reset
+    void clear()
+    {
+        for (auto& s : _shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.map.clear();
+            s.lru.clear();
+            s.stats.bytes = 0;
+        }
+    }
+
+    //! return counters summed over all shards
+    memo_statistics statistics() const
+    {
+        memo_statistics out;
+        for (auto const& s : _shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            out.hits += s.stats.hits;
+            out.misses += s.stats.misses;
+            out.evictions += s.stats.evictions;
+            out.entries += s.lru.size();
+            out.bytes += s.stats.bytes;
+        }
+        return out;
+    }
+
+protected:
+    struct entry
+    {
+        Key key;
+        result value;
+        std::size_t bytes;
+    };
+
+    struct shard
+    {
+        mutable std::mutex mutex;
+        std::list<entry> lru;
+        std::unordered_map<Key, typename std::list<entry>::iterator, Hash> map;
+        std::size_t max_entries = 0;
+        std::size_t max_bytes = 0;
+        memo_statistics stats;
+    };
+
+    std::vector<shard> _shards;
+
+protected:
+    shard& get_shard(Key const& key)
+    {
+        // use high bits so shards are not correlated with buckets in `map`
+        std::uint64_t h = Hash()(key) * 0x9e3779b97f4a7c15ull;
+        return _shards[(h >> 32) % _shards.size()];
+    }
+};
+
+} // namespace algebra
@@ -4,72 +4,90 @@
 #include "parser.h"
 
 #include <cassert>
+#include <charconv>
+#include <climits>
+#include <optional>
 
 namespace algebra {
 namespace parser {
 
 //------------------------------------------------------------------------------
-struct token
+//! failed parse, formatted into a `parse_error` only if it is reported
+struct failure
 {
-    char const* begin;
-    char const* end;
-
-    char operator[](std::size_t index) const {
-        assert(end - begin > std::ptrdiff_t(index));
-        return begin[index];
-    }
-
-    bool operator==(char const* str) const {
-        assert(begin != end);
-        return strncmp(begin, str, end - begin) == 0;
-    }
-    bool operator!=(char const* str) const {
-        assert(begin != end);
-        return strncmp(begin, str, end - begin) != 0;
-    }
+    enum class kind
+    {
+        expected,           //!< expected `what` after `prev`, found `tok`
+        unexpected,         //!< expected `what`, found `tok`
+        syntax,             //!< `tok` can't begin an expression
+        invalid_literal,
+        invalid_character,
+    };
+
+    kind type;
+    char const* what;
+    //! offending token, or the last token at the end of input
+    token tok;
+    //! token preceding `tok`, empty at the start of input
+    token prev;
+    //! true if input ended before the expected token
+    bool at_end;
 
-    bool operator==(char ch) const {
-        return *begin == ch && end == begin + 1;
-    }
-    bool operator!=(char ch) const {
-        return  *begin != ch || end != begin + 1;
-    }
+    std::string message() const;
 };
 
-std::string operator+(char const* lhs, token const& rhs)
-{
-    return std::string(lhs) + std::string(rhs.begin, rhs.end);
-}
-
-std::string operator+(std::string const& lhs, token const& rhs)
+//------------------------------------------------------------------------------
+std::string failure::message() const
 {
-    return lhs + std::string(rhs.begin, rhs.end);
+    std::string found = "'" + std::string(tok.view()) + "'";
+    switch (type) {
+        case kind::expected:
+            if (prev.begin == prev.end) {
+                return at_end ? std::string("expected ") + what
+                              : std::string("expected ") + what + ", found " + found;
+            }
+            return std::string("expected ") + what + " after '" + std::string(prev.view()) + "'"
+                + (at_end ? "" : ", found " + found);
+        case kind::unexpected: return std::string("expected ") + what + ", found " + found;
+        case kind::syntax: return "syntax error: " + found;
+        case kind::invalid_literal: return "invalid literal";
+        case kind::invalid_character: return "invalid character " + found;
+        default: assert(0); return "";
+    }
 }
 
 //------------------------------------------------------------------------------
-struct error
+//! return a failure for `what` missing at `tokens`
+failure expected(char const* what, token const* tokens, token const* end)
 {
-    token tok;
-    std::string msg;
-};
+    if (tokens >= end) {
+        return {failure::kind::expected, what, *(tokens - 1), *(tokens - 1), true};
+    }
+    return {failure::kind::expected, what, *tokens, *(tokens - 1), false};
+}
 
-template<typename T> using result = std::variant<error, T>;
+template<typename T> using result = std::variant<failure, T>;
 
 //------------------------------------------------------------------------------
 using tokenized = std::vector<token>;
 
 //------------------------------------------------------------------------------
-result<tokenized> tokenize(char const* str)
+//! append the tokens of `str` to `tokens`
+std::optional<failure> tokenize(std::string_view text, tokenized& tokens)
 {
-    std::vector<token> tokens;
+    char const* str = text.data();
+    char const* const end = str + text.size();
+    auto is_digit = [&](char const* ch) { return ch < end && *ch >= '0' && *ch <= '9'; };
+    auto is_alpha = [&](char const* ch) { return ch < end && ((*ch >= 'a' && *ch <= 'z') || (*ch >= 'A' && *ch <= 'Z')); };
+
     while (true) {
         // skip leading whitespace
-        while (*str <= ' ') {
-            if (!*str) {
-                return tokens;
-            }
+        while (str < end && *str <= ' ') {
             ++str;
         }
+        if (str >= end) {
+            return std::nullopt;
+        }
 
         token t{str, str};
         switch (*str) {
@@ -88,24 +106,25 @@ result<tokenized> tokenize(char const* str)
                 continue;
         }
 
-        if (*str >= '0' && *str <= '9' || *str == '.') {
+        if (is_digit(str) || *str == '.') {
             bool has_dot = false;
-            while (*str >= '0' && *str <= '9' || (!has_dot && *str == '.')) {
+            while (is_digit(str) || (!has_dot && str < end && *str == '.')) {
                 if (*str == '.') {
-                    if (has_dot) {
-                        return error{{str, str+1}, "invalid literal"};
-                    }
                     has_dot = true;
                 }
                 ++t.end;
                 ++str;
             }
+            if (str < end && *str == '.') {
+                return failure{failure::kind::invalid_literal, "", {str, str + 1}, t, false};
+            }
             tokens.push_back(t);
             continue;
         }
 
-        if (*str >= 'a' && *str <= 'z' || *str >= 'A' && *str <= 'Z') {
-            while (*str >= 'a' && *str <= 'z' || *str >= 'A' && *str <= 'Z') {
+        // names may continue with digits and underscores, e.g. `velocity_x`
+        if (is_alpha(str)) {
+            while (is_alpha(str) || is_digit(str) || (str < end && *str == '_')) {
                 ++t.end;
                 ++str;
             }
@@ -113,7 +132,7 @@ result<tokenized> tokenize(char const* str)
             continue;
         }
 
-        return error{{str, str+1}, "invalid character '" + token{str, str+1} + "'"};
+        return failure{failure::kind::invalid_character, "", {str, str + 1}, t, false};
     }
 
     // never gets here
@@ -126,10 +145,8 @@ result<expression> parse_operand(token const*& tokens, token const* end);
 //------------------------------------------------------------------------------
 result<op_type> parse_operator(token const*& tokens, token const* end)
 {
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected operator after '" + *(tokens - 1) + "'"};
-    } else if (*tokens == ')' || *tokens == ',') {
-        return error{*tokens, "expected operator after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens == ')' || *tokens == ',') {
+        return expected("operator", tokens, end);
     }
 
     if (tokens[0] == '=') {
@@ -151,43 +168,37 @@ result<op_type> parse_operator(token const*& tokens, token const* end)
         ++tokens;
         return op_type::exponent;
     } else {
-        return error{*tokens, "expected operator, found '" + *tokens + "'"};
+        return failure{failure::kind::unexpected, "operator", *tokens, *(tokens - 1), false};
     }
 }
 
 //------------------------------------------------------------------------------
 result<expression> parse_binary_function(token const*& tokens, token const* end, op_type type)
 {
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected '(' after '" + *(tokens - 1) + "'"};
-    } else if (*tokens != '(') {
-        return error{*tokens, "expected '(' after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens != '(') {
+        return expected("'('", tokens, end);
     } else {
         ++tokens;
     }
 
     result<expression> lhs = parse_expression(tokens, end);
-    if (std::holds_alternative<error>(lhs)) {
-        return std::get<error>(lhs);
+    if (std::holds_alternative<failure>(lhs)) {
+        return std::get<failure>(lhs);
     }
 
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected ',' after '" + *(tokens - 1) + "'"};
-    } else if (*tokens != ',') {
-        return error{*tokens, "expected ',' after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens != ',') {
+        return expected("','", tokens, end);
     } else {
         ++tokens;
     }
 
     result<expression> rhs = parse_expression(tokens, end);
-    if (std::holds_alternative<error>(rhs)) {
-        return std::get<error>(rhs);
+    if (std::holds_alternative<failure>(rhs)) {
+        return std::get<failure>(rhs);
     }
 
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected ')' after '" + *(tokens - 1) + "'"};
-    } else if (*tokens != ')') {
-        return error{*tokens, "expected ')' after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens != ')') {
+        return expected("')'", tokens, end);
     } else {
         ++tokens;
     }
@@ -199,8 +210,8 @@ result<expression> parse_binary_function(token const*& tokens, token const* end,
 result<expression> parse_unary_function(token const*& tokens, token const* end, op_type type, expression const& rhs = empty{})
 {
     result<expression> arg = parse_operand(tokens, end);
-    if (std::holds_alternative<error>(arg)) {
-        return std::get<error>(arg);
+    if (std::holds_alternative<failure>(arg)) {
+        return std::get<failure>(arg);
     }
     return op{type, std::get<expression>(arg), rhs};
 }
@@ -208,21 +219,17 @@ result<expression> parse_unary_function(token const*& tokens, token const* end,
 //------------------------------------------------------------------------------
 result<expression> parse_operand_explicit(token const*& tokens, token const* end)
 {
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected expression after '" + *(tokens - 1) + "'"};
-    } else if (*tokens == ')' || *tokens == ',') {
-        return error{*tokens, "expected expression after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens == ')' || *tokens == ',') {
+        return expected("expression", tokens, end);
     }
 
     if (*tokens == '(') {
         result<expression> expr = parse_expression(++tokens, end);
-        if (std::holds_alternative<error>(expr)) {
-            return std::get<error>(expr);
+        if (std::holds_alternative<failure>(expr)) {
+            return std::get<failure>(expr);
         }
-        if (tokens >= end) {
-            return error{*(tokens - 1), "expected ')' after '" + *(tokens - 1) + "'"};
-        } else if (*tokens != ')') {
-            return error{*tokens, "expected ')' after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+        if (tokens >= end || *tokens != ')') {
+            return expected("')'", tokens, end);
         }
         ++tokens;
         return std::get<expression>(expr);
@@ -266,8 +273,10 @@ result<expression> parse_operand_explicit(token const*& tokens, token const* end
     //  values
     //
 
-    } else if (*tokens[0].begin >= '0' && *tokens[0].begin <= '9' || *tokens[0].begin == '.') {
-        value v = std::atof(tokens[0].begin);
+    } else if ((*tokens[0].begin >= '0' && *tokens[0].begin <= '9') || *tokens[0].begin == '.') {
+        // a lone '.' is zero
+        value v = 0;
+        std::from_chars(tokens[0].begin, tokens[0].end, v);
         ++tokens;
         return v;
 
@@ -275,8 +284,9 @@ result<expression> parse_operand_explicit(token const*& tokens, token const* end
     // derivative
     //
 
-    } else if (end - tokens > 2 && tokens[0] == 'd' && tokens[1] == '/' && tokens[2][0] == 'd') {
-        symbol s{tokens[2].begin + 1, tokens[2].end};
+    } else if (end - tokens > 2 && tokens[0] == 'd' && tokens[1] == '/'
+            && *tokens[2].begin == 'd' && tokens[2].end - tokens[2].begin > 1) {
+        symbol s{std::string_view(tokens[2].begin + 1, tokens[2].end - tokens[2].begin - 1)};
         tokens += 3;
         return parse_unary_function(tokens, end, op_type::derivative, s);
 
@@ -284,37 +294,21 @@ result<expression> parse_operand_explicit(token const*& tokens, token const* end
     //  symbols
     //
 
-    } else if (*tokens[0].begin >= 'a' && *tokens[0].begin <= 'z' || *tokens[0].begin >= 'A' && *tokens[0].begin <= 'Z') {
-        symbol s{tokens[0].begin, tokens[0].end};
+    } else if ((*tokens[0].begin >= 'a' && *tokens[0].begin <= 'z') || (*tokens[0].begin >= 'A' && *tokens[0].begin <= 'Z')) {
+        symbol s{tokens[0].view()};
         ++tokens;
         return s;
 
     } else {
-        return error{*tokens, "syntax error: '" + *tokens + "'"};
-    }
-}
-
-//------------------------------------------------------------------------------
-constexpr int op_precedence(op_type t)
-{
-    switch (t) {
-        case op_type::equality: return 16;
-        case op_type::sum: return 6;
-        case op_type::difference: return 6;
-        case op_type::product: return 5;
-        case op_type::quotient: return 5;
-        case op_type::exponent: return 4;
-        default: return 0;
+        return failure{failure::kind::syntax, "", *tokens, *(tokens - 1), false};
     }
 }
 
 //------------------------------------------------------------------------------
 result<expression> parse_operand(token const*& tokens, token const* end)
 {
-    if (tokens >= end) {
-        return error{*(tokens - 1), "expected expression after '" + *(tokens - 1) + "'"};
-    } else if (*tokens == ')' || *tokens == ',') {
-        return error{*tokens, "expected expression after '" + *(tokens - 1) + "', found '" + *tokens + "'"};
+    if (tokens >= end || *tokens == ')' || *tokens == ',') {
+        return expected("expression", tokens, end);
     }
 
     expression out;
@@ -327,8 +321,8 @@ result<expression> parse_operand(token const*& tokens, token const* end)
     }
 
     result<expression> operand = parse_operand_explicit(tokens, end);
-    if (std::holds_alternative<error>(operand)) {
-        return std::get<error>(operand);
+    if (std::holds_alternative<failure>(operand)) {
+        return std::get<failure>(operand);
     } else {
         out = std::get<expression>(operand);
     }
@@ -340,7 +334,7 @@ result<expression> parse_operand(token const*& tokens, token const* end)
         // do not parse `3-x` as `(3)(-x)`
         if (tokens < end && *tokens != '-') {
             result<expression> next = parse_expression(tokens, end, op_precedence(op_type::product));
-            if (std::holds_alternative<error>(next)
+            if (std::holds_alternative<failure>(next)
                 || std::holds_alternative<value>(std::get<expression>(next))) {
                 tokens = saved;
             } else {
@@ -361,16 +355,16 @@ result<expression> parse_operand(token const*& tokens, token const* end)
 result<expression> parse_expression(token const*& tokens, token const* end, int precedence)
 {
     result<expression> lhs = parse_operand(tokens, end);
-    if (std::holds_alternative<error>(lhs)) {
-        return std::get<error>(lhs);
+    if (std::holds_alternative<failure>(lhs)) {
+        return std::get<failure>(lhs);
     }
 
     while (tokens < end && *tokens != ')' && *tokens != ',') {
         token const* saved = tokens;
 
         result<op_type> lhs_op = parse_operator(tokens, end);
-        if (std::holds_alternative<error>(lhs_op)) {
-            return std::get<error>(lhs_op);
+        if (std::holds_alternative<failure>(lhs_op)) {
+            return std::get<failure>(lhs_op);
         }
 
         int lhs_precedence = op_precedence(std::get<op_type>(lhs_op));
@@ -380,8 +374,8 @@ result<expression> parse_expression(token const*& tokens, token const* end, int
         }
 
         result<expression> rhs = parse_expression(tokens, end, lhs_precedence);
-        if (std::holds_alternative<error>(rhs)) {
-            return std::get<error>(rhs);
+        if (std::holds_alternative<failure>(rhs)) {
+            return std::get<failure>(rhs);
         } else {
             lhs = op{std::get<op_type>(lhs_op), std::get<expression>(lhs), std::get<expression>(rhs)};
         }
@@ -395,39 +389,69 @@ result<expression> parse_expression(token const*& tokens, token const* end, int
     }
 }
 
-} // namespace parser
-
 //------------------------------------------------------------------------------
-void print_error(char const* str, parser::error const& err)
+expression context::parse(std::string_view str)
 {
-    std::ptrdiff_t offset = err.tok.begin - str;
-    std::ptrdiff_t length = err.tok.end - err.tok.begin;
-    for (std::ptrdiff_t ii = 0; ii < offset; ++ii) {
-        printf(" ");
+    // the first token is an empty sentinel at the start of input so there is
+    // always a previous token to report errors against
+    _tokens.clear();
+    _tokens.push_back({str.data(), str.data()});
+
+    std::optional<failure> err = tokenize(str, _tokens);
+    result<expression> expr = empty{};
+    if (!err) {
+        token const* begin = _tokens.data() + 1;
+        token const* end = _tokens.data() + _tokens.size();
+        expr = parse_expression(begin, end);
+        if (!std::holds_alternative<failure>(expr) && begin < end) {
+            // e.g. an unbalanced ')'
+            expr = failure{failure::kind::unexpected, "operator", *begin, *(begin - 1), false};
+        }
+    } else {
+        expr = *err;
     }
-    for (std::ptrdiff_t ii = 0; ii < length; ++ii) {
-        printf("^");
+
+    _valid = !std::holds_alternative<failure>(expr);
+    if (_valid) {
+        return std::get<expression>(expr);
     }
-    printf(" %s\n", err.msg.c_str());
+
+    failure const& f = std::get<failure>(expr);
+    _error.offset = std::size_t(f.tok.begin - str.data());
+    _error.length = std::size_t(f.tok.end - f.tok.begin);
+    _error.message = f.message();
+    return expression{};
 }
 
 //------------------------------------------------------------------------------
-expression parse(char const* str)
+std::size_t context::parse_lines(std::string_view text, std::function<void(std::size_t index, expression const& expr)> const& fn)
 {
-    parser::result<parser::tokenized> result = parser::tokenize(str);
-    if (std::holds_alternative<parser::tokenized>(result)) {
-        parser::tokenized const& tokens = std::get<parser::tokenized>(result);
-        parser::token const* begin = &tokens[0];
-        parser::result<expression> expr = parser::parse_expression(begin, begin + tokens.size());
-        if (std::holds_alternative<parser::error>(expr)) {
-            print_error(str, std::get<parser::error>(expr));
-        } else {
-            return std::get<expression>(expr);
+    std::size_t invalid = 0;
+    for (std::size_t index = 0; text.size(); ++index) {
+        std::size_t length = text.find('\n');
+        std::string_view line = text.substr(0, length);
+        text.remove_prefix(length == std::string_view::npos ? text.size() : length + 1);
+
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            _valid = true;
+            fn(index, expression{});
+            continue;
         }
-    } else if (std::holds_alternative<parser::error>(result)) {
-        print_error(str, std::get<parser::error>(result));
+
+        expression expr = parse(line);
+        invalid += !_valid;
+        fn(index, expr);
     }
-    return expression{};
+    return invalid;
+}
+
+} // namespace parser
+
+//------------------------------------------------------------------------------
+expression parse(std::string_view str)
+{
+    thread_local parser::context context;
+    return context.parse(str);
 }
 
 } // namespace algebra
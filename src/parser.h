@@ -4,9 +4,91 @@
 #pragma once
 #include "expression.h"
 
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace algebra {
+namespace parser {
+
+//------------------------------------------------------------------------------
+//! binding strength of binary operators, lower values bind more tightly
+constexpr int op_precedence(op_type t)
+{
+    switch (t) {
+        case op_type::equality: return 16;
+        case op_type::sum: return 6;
+        case op_type::difference: return 6;
+        case op_type::product: return 5;
+        case op_type::quotient: return 5;
+        case op_type::exponent: return 4;
+        default: return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+//! span of the source text
+struct token
+{
+    char const* begin;
+    char const* end;
+
+    std::string_view view() const { return std::string_view(begin, end - begin); }
+
+    bool operator==(char const* str) const { return view() == str; }
+    bool operator!=(char const* str) const { return view() != str; }
+
+    bool operator==(char ch) const { return end == begin + 1 && *begin == ch; }
+    bool operator!=(char ch) const { return end != begin + 1 || *begin != ch; }
+};
+
+//------------------------------------------------------------------------------
+//! description of a failed parse, `offset` and `length` locate the offending
+//! token in the parsed string
+struct parse_error
+{
+    std::size_t offset = 0;
+    std::size_t length = 0;
+    std::string message;
+};
+
+//------------------------------------------------------------------------------
+//! reusable parser state
+//!
+//! Tokens are views of the source text kept in a buffer which is reused by
+//! each call, so a context parsing many expressions stops allocating for them
+//! once the buffer has grown to fit the longest. Failures on speculative paths
+//! such as implicit multiplication are discarded without being formatted, the
+//! message is only built when the parse as a whole fails.
+class context
+{
+public:
+    //! returns an empty expression and sets `error` if `str` is not valid
+    expression parse(std::string_view str);
+
+    //! parse each line of `text` in order, calling `fn` with its zero-based
+    //! index and its expression, which is empty for blank lines and for lines
+    //! which are not valid. `valid` and `error` describe the line during each
+    //! call. Returns the number of invalid lines.
+    std::size_t parse_lines(std::string_view text, std::function<void(std::size_t index, expression const& expr)> const& fn);
+
+    //! false if the last parsed string was not valid
+    bool valid() const { return _valid; }
+    //! error from the last string which was not valid
+    parse_error const& error() const { return _error; }
+
+protected:
+    std::vector<token> _tokens;
+    bool _valid = true;
+    parse_error _error;
+};
+
+} // namespace parser
 
 //------------------------------------------------------------------------------
-expression parse(char const* str);
+//! parse `str` with a per-thread `parser::context`, returns an empty
+//! expression if it is not valid
+expression parse(std::string_view str);
 
 } // namespace algebra
@@ -0,0 +1,329 @@
+// persistent_cache.cpp
+//
+
+#include "persistent_cache.h"
+#include "dag.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#if __has_include(<unistd.h>)
+#   include <unistd.h>
+#endif
+
+namespace algebra {
+
+namespace {
+
+constexpr char cache_magic[4] = {'A', 'L', 'G', 'C'};
+//! changed with the layout and with anything else which changes results but
+//! is not covered by `rules_fingerprint` or the options of each entry
+constexpr std::uint32_t cache_version = 2;
+
+struct cache_header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t entry_count;
+    std::uint64_t rules;    //!< `rules_fingerprint` of the saving process
+};
+
+struct cache_entry
+{
+    std::uint64_t fingerprint;
+    std::uint64_t options;
+};
+
+static_assert(sizeof(cache_header) == 24, "unexpected header layout");
+static_assert(sizeof(cache_entry) == 16, "unexpected entry layout");
+
+//------------------------------------------------------------------------------
+std::uint64_t mix(std::uint64_t h, std::uint64_t v)
+{
+    // splitmix64 finalizer over the combined state
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+//------------------------------------------------------------------------------
+std::uint64_t bits(double v)
+{
+    // equal values must have equal fingerprints
+    v = v == 0.0 ? 0.0 : v;
+    std::uint64_t out;
+    std::memcpy(&out, &v, sizeof(out));
+    return out;
+}
+
+//------------------------------------------------------------------------------
+cache_entry load_entry(char const* entries, std::size_t index)
+{
+    cache_entry out;
+    std::memcpy(&out, entries + index * sizeof(cache_entry), sizeof(out));
+    return out;
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+std::uint64_t fingerprint(expression const& expr)
+{
+    expression_dag dag(expr);
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(dag.nodes().size());
+    for (auto const& n : dag.nodes()) {
+        std::uint64_t h = mix(0, n.expr.index());
+        if (std::holds_alternative<op>(n.expr)) {
+            h = mix(h, std::uint64_t(std::get<op>(n.expr).type));
+            h = mix(h, hashes[n.lhs]);
+            h = mix(h, n.rhs == expression_dag::no_node ? 0 : hashes[n.rhs]);
+        } else if (std::holds_alternative<constant>(n.expr)) {
+            h = mix(h, std::uint64_t(std::get<constant>(n.expr)));
+        } else if (std::holds_alternative<placeholder>(n.expr)) {
+            h = mix(h, std::uint64_t(std::get<placeholder>(n.expr)));
+        } else if (std::holds_alternative<value>(n.expr)) {
+            h = mix(h, bits(std::get<value>(n.expr)));
+        } else if (std::holds_alternative<symbol>(n.expr)) {
+            for (char ch : std::get<symbol>(n.expr).name()) {
+                h = mix(h, std::uint8_t(ch));
+            }
+        }
+        hashes.push_back(h);
+    }
+    return hashes[dag.root()];
+}
+
+//------------------------------------------------------------------------------
+std::uint64_t fingerprint(simplify_options const& options)
+{
+    std::uint64_t h = mix(0, std::uint64_t(options.engine));
+    for (double w : options.cost.weights) {
+        h = mix(h, bits(w));
+    }
+    h = mix(h, options.astar);
+    h = mix(h, options.normalize);
+    h = mix(h, options.max_operations);
+    h = mix(h, options.max_iterations);
+    h = mix(h, options.max_nodes);
+    h = mix(h, options.beam_width);
+    h = mix(h, options.max_memory);
+    // the search result depends on the number of threads
+    h = mix(h, std::max<std::size_t>(options.threads, 1));
+    return h;
+}
+
+//------------------------------------------------------------------------------
+std::uint64_t rules_fingerprint()
+{
+    static std::uint64_t const rules = []() {
+        resolve_transforms();
+        std::uint64_t h = mix(0, transforms.size());
+        for (auto const& tr : transforms) {
+            h = mix(h, fingerprint(tr.source.expr));
+            h = mix(h, fingerprint(tr.target.expr));
+            h = mix(h, tr.oriented);
+        }
+        // options only record the weights, not what they default to
+        for (double w : cost_model().weights) {
+            h = mix(h, bits(w));
+        }
+        return h;
+    }();
+    return rules;
+}
+
+//------------------------------------------------------------------------------
+persistent_cache::persistent_cache(char const* path)
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) {
+        return;
+    }
+
+    _file = std::make_unique<mapped_file>(path);
+    if (!_file->valid()) {
+        _error = _file->error();
+        return;
+    }
+
+    std::string_view data = _file->view();
+    cache_header header;
+    if (data.size() < sizeof(header)) {
+        _error = std::string(path) + " is not a cache";
+        return;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version) {
+        _error = std::string(path) + " is not a cache or has an unsupported version";
+        return;
+    }
+    if (header.rules != rules_fingerprint()) {
+        _error = std::string(path) + " was saved with different rules or cost model";
+        return;
+    }
+
+    _mapped = serialized_expressions(data.substr(sizeof(header)));
+    std::size_t entries = (sizeof(header) + _mapped.size() + 7) & ~std::size_t(7);
+    if (!_mapped.valid()
+        || _mapped.root_count() != header.entry_count * 2
+        || entries + header.entry_count * sizeof(cache_entry) > data.size()) {
+        _mapped = {};
+        _error = std::string(path) + " is truncated or corrupt";
+        return;
+    }
+
+    _entries = data.data() + entries;
+    _entry_count = std::size_t(header.entry_count);
+    for (std::size_t ii = 1; ii < _entry_count; ++ii) {
+        if (load_entry(_entries, ii - 1).fingerprint > load_entry(_entries, ii).fingerprint) {
+            _entries = nullptr;
+            _entry_count = 0;
+            _error = std::string(path) + " is not sorted";
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+expression persistent_cache::find_mapped(std::uint64_t fingerprint, std::uint64_t options, expression const& expr) const
+{
+    // binary search for the first entry with the fingerprint
+    std::size_t lo = 0;
+    std::size_t hi = _entry_count;
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (load_entry(_entries, mid).fingerprint < fingerprint) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < _entry_count; ++lo) {
+        cache_entry e = load_entry(_entries, lo);
+        if (e.fingerprint != fingerprint) {
+            break;
+        }
+        if (e.options == options && _mapped.decode(_mapped.root(lo * 2)) == expr) {
+            return _mapped.decode(_mapped.root(lo * 2 + 1));
+        }
+    }
+    return expression{};
+}
+
+//------------------------------------------------------------------------------
+expression persistent_cache::find(expression const& expr, simplify_options const& options) const
+{
+    std::uint64_t opts = fingerprint(options);
+    std::uint64_t key = mix(fingerprint(expr), opts);
+
+    expression out = find_mapped(key, opts, expr);
+    if (!std::holds_alternative<empty>(out)) {
+        return out;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto range = _inserted.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.options == opts && it->second.key == expr) {
+            return it->second.result;
+        }
+    }
+    return expression{};
+}
+
+//------------------------------------------------------------------------------
+void persistent_cache::insert(expression const& expr, simplify_options const& options, expression const& result)
+{
+    std::uint64_t opts = fingerprint(options);
+    std::uint64_t key = mix(fingerprint(expr), opts);
+    if (!std::holds_alternative<empty>(find_mapped(key, opts, expr))) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto range = _inserted.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.options == opts && it->second.key == expr) {
+            return;
+        }
+    }
+    _inserted.emplace(key, entry{opts, expr, result});
+}
+
+//------------------------------------------------------------------------------
+std::size_t persistent_cache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entry_count + _inserted.size();
+}
+
+//------------------------------------------------------------------------------
+bool persistent_cache::save(char const* path)
+{
+    std::vector<std::pair<std::uint64_t, entry>> entries;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries.reserve(_entry_count + _inserted.size());
+        for (std::size_t ii = 0; ii < _entry_count; ++ii) {
+            cache_entry e = load_entry(_entries, ii);
+            entries.push_back({e.fingerprint, {e.options, _mapped.decode(_mapped.root(ii * 2)), _mapped.decode(_mapped.root(ii * 2 + 1))}});
+        }
+        for (auto const& it : _inserted) {
+            entries.push_back(it);
+        }
+    }
+
+    // stable so the order of mapped entries is preserved
+    std::stable_sort(entries.begin(), entries.end(), [](auto const& lhs, auto const& rhs) {
+        return lhs.first < rhs.first;
+    });
+
+    std::vector<expression> roots;
+    roots.reserve(entries.size() * 2);
+    for (auto const& e : entries) {
+        roots.push_back(e.second.key);
+        roots.push_back(e.second.result);
+    }
+
+    cache_header header{{cache_magic[0], cache_magic[1], cache_magic[2], cache_magic[3]}, cache_version, entries.size(), rules_fingerprint()};
+    std::string out(reinterpret_cast<char const*>(&header), sizeof(header));
+    serialize(roots, out);
+    out.resize((out.size() + 7) & ~std::size_t(7), '\0');
+    for (auto const& e : entries) {
+        cache_entry ce{e.first, e.second.options};
+        out.append(reinterpret_cast<char const*>(&ce), sizeof(ce));
+    }
+
+    // write next to the destination so the rename can't cross file systems
+    std::string temp = std::string(path) + ".tmp";
+#if __has_include(<unistd.h>)
+    temp += std::to_string(::getpid());
+#endif
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file.write(out.data(), std::streamsize(out.size())) || !file.flush()) {
+            _error = "failed to write " + temp;
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        _error = "failed to replace " + std::string(path) + ": " + ec.message();
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace algebra
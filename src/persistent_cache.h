@@ -0,0 +1,95 @@
+// persistent_cache.h
+//
+
+#pragma once
+#include "expression.h"
+#include "mapped_file.h"
+#include "serialize.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! cache of simplified expressions which can be saved to a file and mapped
+//! read-only by later processes
+//!
+//! Results are keyed by the expression and a fingerprint of the options which
+//! affect the result, so a cache can be shared between configurations. Saved
+//! results are looked up by a binary search of the mapped file and only the
+//! nodes of matching entries are decoded, so opening a large cache is cheap
+//! and its pages are shared by every process mapping it. Thread-safe.
+//!
+//! The file is the encoding from `serialize` with a key and a result root per
+//! entry, preceded by a header and followed by the entries sorted by their
+//! fingerprints. The header records `rules_fingerprint`, files saved with
+//! other rules are rejected rather than returning stale results.
+class persistent_cache
+{
+public:
+    //! empty cache
+    persistent_cache() = default;
+    //! map results saved to `path`, a missing file is an empty cache
+    explicit persistent_cache(char const* path);
+
+    //! false if the file exists but could not be read or is not a valid
+    //! cache, see `error`
+    bool valid() const { return _error.empty(); }
+    std::string const& error() const { return _error; }
+
+    //! return the result of simplifying `expr` with `options` if either was
+    //! saved or inserted, otherwise an empty expression
+    expression find(expression const& expr, simplify_options const& options) const;
+    //! add a result to be saved, results which are already cached are kept
+    void insert(expression const& expr, simplify_options const& options, expression const& result);
+
+    //! number of mapped and inserted results
+    std::size_t size() const;
+
+    //! write every result to `path`, which is replaced atomically so other
+    //! processes can keep using a previous version they have mapped
+    bool save(char const* path);
+
+protected:
+    struct entry
+    {
+        std::uint64_t options;
+        expression key;
+        expression result;
+    };
+
+    std::unique_ptr<mapped_file> _file;
+    serialized_expressions _mapped;
+    //! sorted fingerprint and options of each mapped entry
+    char const* _entries = nullptr;
+    std::size_t _entry_count = 0;
+
+    mutable std::mutex _mutex;
+    //! results inserted since the file was mapped, keyed by fingerprint
+    std::unordered_multimap<std::uint64_t, entry> _inserted;
+
+    std::string _error;
+
+protected:
+    expression find_mapped(std::uint64_t fingerprint, std::uint64_t options, expression const& expr) const;
+};
+
+//------------------------------------------------------------------------------
+//! return a hash of `expr` which is stable across processes and builds
+std::uint64_t fingerprint(expression const& expr);
+
+//------------------------------------------------------------------------------
+//! return a hash of the fields of `options` which can change the result of
+//! `simplify`
+std::uint64_t fingerprint(simplify_options const& options);
+
+//------------------------------------------------------------------------------
+//! return a hash of the built-in transforms and the default cost weights,
+//! which every cached result depends on
+std::uint64_t rules_fingerprint();
+
+} // namespace algebra
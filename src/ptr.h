@@ -2,31 +2,473 @@
 //
 
 #pragma once
-#include <memory>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
-//! Wrapper for lazy shareable pointer
-template<typename T> class ptr
+//! Values of `T` which `ptr_table` keeps for the life of the process even if it
+//! reclaims others, specialized for types with a few values which are shared
+//! by nearly every other, so that copying pointers to them is not counted
+template<typename T> struct ptr_traits
+{
+    static bool permanent(T const&) { return false; }
+};
+
+//! Process-wide table of hash-consed values
+//!
+//! Every distinct value is stored exactly once and assigned an integer id.
+//! Values are packed into large blocks indexed by id rather than allocated
+//! individually, and distributed over independently locked shards by hash so
+//! that threads constructing values concurrently rarely contend. Interning
+//! throws `std::length_error` once every id is in use.
+//!
+//! If `reclaimed` is set each node counts the pointers referring to it, and
+//! once the last is gone the value is destroyed and its id and node reused,
+//! so the table holds only the values which are still reachable. Otherwise,
+//! and for `T()` and values which are `ptr_traits<T>::permanent`, values are
+//! kept for the life of the process. Those have ids from a separate range so
+//! pointers know from their id alone that they need not count references.
+template<typename T, bool reclaimed> class ptr_table
+{
+public:
+    //! id of `T()`
+    static std::uint32_t default_id()
+    {
+        shards();
+        return permanent_base;
+    }
+
+    //! first id of values which are never reclaimed, and the id of `T()`
+    static constexpr std::uint32_t permanent_base = std::uint32_t(1) << 31;
+
+    //! return the id of the given value with a reference for the caller,
+    //! inserting it if necessary
+    static std::uint32_t intern(T const& value)
+    {
+        std::uint32_t hash = fold(std::hash<T>()(value));
+        shard& s = shards()[hash % shard_count];
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        if (!s.slots.size()) {
+            s.slots.assign(64, empty_slot);
+        }
+
+        std::size_t mask = s.slots.size() - 1;
+        for (std::size_t index = home(hash, mask); ; index = (index + 1) & mask) {
+            std::uint32_t id = s.slots[index];
+            if (id == empty_slot) {
+                id = allocate(s, value, hash, !reclaimed || ptr_traits<T>::permanent(value));
+                s.slots[index] = id;
+                if (++s.size * 2 > s.slots.size()) {
+                    grow(s);
+                }
+                return id;
+            }
+            // a value whose last reference is being released is not revived,
+            // it is replaced by a new node and removed by the releasing thread
+            node& n = get(id);
+            if (n.hash == hash && n.value == value && acquire(id)) {
+                return id;
+            }
+        }
+    }
+
+    //! add a reference to an interned value
+    static void retain(std::uint32_t id)
+    {
+        if (reclaimed && id < permanent_base) {
+            get(id).refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    //! remove a reference, destroying the value if it was the last
+    static void release(std::uint32_t id)
+    {
+        if (!reclaimed || id >= permanent_base) {
+            return;
+        }
+        if (get(id).refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy(id);
+        }
+    }
+
+    static T const& get_value(std::uint32_t id)
+    {
+        return get(id).value;
+    }
+
+    static std::size_t get_hash(std::uint32_t id)
+    {
+        return get(id).hash;
+    }
+
+    //! number of values currently interned
+    static std::size_t count()
+    {
+        return live().load(std::memory_order_relaxed);
+    }
+
+    //! bytes of each value's node, excluding memory owned by the value
+    static std::size_t node_bytes()
+    {
+        return sizeof(node);
+    }
+
+    //! approximate bytes held by the blocks and indices of the table, which
+    //! grow with the largest number of values interned at once, excluding
+    //! memory owned by the values
+    static std::size_t bytes()
+    {
+        std::size_t const counted = std::min<std::size_t>(next_id(), permanent_base);
+        std::size_t const permanent = std::min<std::size_t>(next_permanent_id(), empty_slot) - permanent_base;
+        std::size_t const blocks = (counted + block_size - 1) / block_size + (permanent + block_size - 1) / block_size;
+        std::size_t bytes = blocks * block_size * sizeof(node);
+        for (auto& s : shards()) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            bytes += (s.slots.capacity() + s.free.capacity()) * sizeof(std::uint32_t);
+        }
+        return bytes;
+    }
+
+protected:
+    struct node
+    {
+        T value;
+        std::uint32_t hash;
+        std::atomic<std::uint32_t> refs;
+    };
+
+    //! values are stored in blocks of `block_size` nodes which are never
+    //! moved or freed, so references stay valid while other threads intern
+    static constexpr std::size_t block_bits = 12;
+    static constexpr std::size_t block_size = std::size_t(1) << block_bits;
+    static constexpr std::size_t block_count = std::size_t(1) << (32 - block_bits);
+
+    //! each shard indexes its values with an open-addressed table of ids and
+    //! keeps the ids it released for reuse
+    static constexpr std::size_t shard_count = 64;
+    static constexpr std::uint32_t empty_slot = UINT32_MAX;
+
+    struct shard
+    {
+        std::mutex mutex;
+        std::vector<std::uint32_t> slots;
+        std::vector<std::uint32_t> free;
+        std::size_t size = 0;
+    };
+
+protected:
+    static node& get(std::uint32_t id)
+    {
+        // ids are only obtained from `intern`, which happens-after the block
+        // was published, so the block pointer does not need to be acquired
+        node* block = blocks()[id >> block_bits].load(std::memory_order_relaxed);
+        return block[id & (block_size - 1)];
+    }
+
+    //! 32 bits of the hash, the shard uses the low bits and the index the rest
+    static std::uint32_t fold(std::size_t hash)
+    {
+        return static_cast<std::uint32_t>(hash ^ (hash >> (sizeof(hash) * 4)));
+    }
+
+    static std::size_t home(std::uint32_t hash, std::size_t mask)
+    {
+        return (hash / shard_count) & mask;
+    }
+
+    //! add a reference unless the last one is being released
+    static bool acquire(std::uint32_t id)
+    {
+        if (!reclaimed || id >= permanent_base) {
+            return true;
+        }
+        node& n = get(id);
+        std::uint32_t refs = n.refs.load(std::memory_order_relaxed);
+        while (refs) {
+            if (n.refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! remove a value whose last reference was released and reuse its id
+    static void destroy(std::uint32_t id)
+    {
+        node& n = get(id);
+        shard& s = shards()[n.hash % shard_count];
+        // destroying the value releases its operands, which may be in the
+        // same shard, so it is moved out and destroyed once the lock is not
+        // held
+        T value;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            erase(s, id, n.hash);
+            value = std::move(n.value);
+            n.~node();
+            s.free.push_back(id);
+        }
+        live().fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    //! construct a value in an unused node with the shard's lock held
+    static std::uint32_t allocate(shard& s, T const& value, std::uint32_t hash, bool permanent)
+    {
+        // each range of ids is checked in every build since the block table
+        // would be indexed out of range and nothing has been modified yet,
+        // the largest id is reserved for empty slots
+        std::size_t id;
+        if (permanent) {
+            id = next_permanent_id()++;
+            if (id >= empty_slot) {
+                throw std::length_error("ptr: interned value ids exhausted");
+            }
+        } else if (s.free.size()) {
+            id = s.free.back();
+            s.free.pop_back();
+        } else {
+            id = next_id()++;
+            if (id >= permanent_base) {
+                throw std::length_error("ptr: interned value ids exhausted");
+            }
+        }
+
+        std::atomic<node*>& block = blocks()[id >> block_bits];
+        node* storage = block.load(std::memory_order_acquire);
+        if (!storage) {
+            // first id in a block usually allocates it, but ids from different
+            // shards may race to do so
+            node* allocated = static_cast<node*>(::operator new(sizeof(node) * block_size));
+            if (block.compare_exchange_strong(storage, allocated, std::memory_order_acq_rel)) {
+                storage = allocated;
+            } else {
+                ::operator delete(allocated);
+            }
+        }
+
+        new (&storage[id & (block_size - 1)]) node{value, hash, {1}};
+        live().fetch_add(1, std::memory_order_relaxed);
+        return static_cast<std::uint32_t>(id);
+    }
+
+    //! remove an id from a shard's index, moving back the ids after it which
+    //! would otherwise no longer be found
+    static void erase(shard& s, std::uint32_t id, std::uint32_t hash)
+    {
+        std::size_t mask = s.slots.size() - 1;
+        std::size_t hole = home(hash, mask);
+        while (s.slots[hole] != id) {
+            hole = (hole + 1) & mask;
+        }
+        for (std::size_t index = (hole + 1) & mask; s.slots[index] != empty_slot; index = (index + 1) & mask) {
+            // an id can fill the hole if its home is not between the hole and it
+            std::size_t start = home(get(s.slots[index]).hash, mask);
+            if (((index - start) & mask) >= ((index - hole) & mask)) {
+                s.slots[hole] = s.slots[index];
+                hole = index;
+            }
+        }
+        s.slots[hole] = empty_slot;
+        --s.size;
+    }
+
+    //! double the capacity of a shard's index
+    static void grow(shard& s)
+    {
+        std::vector<std::uint32_t> slots(s.slots.size() * 2, empty_slot);
+        std::size_t mask = slots.size() - 1;
+        for (std::uint32_t id : s.slots) {
+            if (id != empty_slot) {
+                std::size_t index = home(get(id).hash, mask);
+                while (slots[index] != empty_slot) {
+                    index = (index + 1) & mask;
+                }
+                slots[index] = id;
+            }
+        }
+        s.slots = std::move(slots);
+    }
+
+    static std::array<std::atomic<node*>, block_count>& blocks()
+    {
+        static std::array<std::atomic<node*>, block_count> values{};
+        return values;
+    }
+
+    static std::array<shard, shard_count>& shards()
+    {
+        // never destroyed, values in other static objects may be released
+        // after this would have been
+        static std::array<shard, shard_count>* values = []() {
+            auto* out = new std::array<shard, shard_count>();
+            T value{};
+            std::uint32_t hash = fold(std::hash<T>()(value));
+            shard& s = (*out)[hash % shard_count];
+            s.slots.assign(64, empty_slot);
+            s.slots[home(hash, s.slots.size() - 1)] = allocate(s, value, hash, true);
+            s.size = 1;
+            return out;
+        }();
+        return *values;
+    }
+
+    static std::atomic<std::size_t>& next_id()
+    {
+        static std::atomic<std::size_t> id(0);
+        return id;
+    }
+
+    static std::atomic<std::size_t>& next_permanent_id()
+    {
+        static std::atomic<std::size_t> id(permanent_base);
+        return id;
+    }
+
+    static std::atomic<std::size_t>& live()
+    {
+        static std::atomic<std::size_t> count(0);
+        return count;
+    }
+};
+
+//! Copy semantics of `ptr`, reclaimed pointers hold a reference to their value
+template<typename T, bool reclaimed> class ptr_handle
+{
+protected:
+    explicit ptr_handle(std::uint32_t id)
+        : _id(id)
+    {}
+
+    std::uint32_t _id;
+};
+
+template<typename T> class ptr_handle<T, true>
+{
+protected:
+    using table = ptr_table<T, true>;
+
+    explicit ptr_handle(std::uint32_t id)
+        : _id(id)
+    {}
+    ptr_handle(ptr_handle const& other)
+        : _id(other._id)
+    {
+        table::retain(_id);
+    }
+    //! moved-from pointers refer to `T()`, which is interned before any
+    //! pointer which could be moved
+    ptr_handle(ptr_handle&& other) noexcept
+        : _id(other._id)
+    {
+        other._id = table::permanent_base;
+    }
+    ptr_handle& operator=(ptr_handle const& other)
+    {
+        table::retain(other._id);
+        table::release(_id);
+        _id = other._id;
+        return *this;
+    }
+    ptr_handle& operator=(ptr_handle&& other) noexcept
+    {
+        std::swap(_id, other._id);
+        return *this;
+    }
+    ~ptr_handle()
+    {
+        table::release(_id);
+    }
+
+    std::uint32_t _id;
+};
+
+//! Wrapper for hash-consed shareable pointer
+//!
+//! Every distinct value is stored exactly once in a `ptr_table` and assigned
+//! a 32-bit id, so comparing two pointers is equivalent to comparing the
+//! values they refer to. `T` must provide `std::hash<T>` and `operator==`,
+//! both of which may rely on nested `ptr` members instead of walking them.
+//! The hash of each value is computed once and cached.
+//!
+//! Values are reclaimed once no pointer refers to them unless `reclaimed` is
+//! false, in which case values are kept for the life of the process and the
+//! pointer is trivially copyable. `interned_bytes` reports the size of the
+//! table, which is shared by every search and cache.
+template<typename T, bool reclaimed = true> class ptr : public ptr_handle<T, reclaimed>
 {
 public:
     //! default construction
     ptr()
-        : _value(new T())
+        : ptr_handle<T, reclaimed>(table::default_id())
     {}
     //! implicit construction from value
-    ptr(T value)
-        : _value(new T(value))
+    ptr(T const& value)
+        : ptr_handle<T, reclaimed>(table::intern(value))
     {}
     //! value assignment
-    ptr<T>& operator=(T value)
+    ptr<T, reclaimed>& operator=(T const& value)
     {
-        _value = new T(value);
+        std::uint32_t id = table::intern(value);
+        table::release(this->_id);
+        this->_id = id;
+        return *this;
     }
     //! implicit cast to const value ref
     operator T const&() const
     {
-        return *_value.get();
+        return table::get_value(this->_id);
+    }
+    //! const value ref
+    T const& operator*() const
+    {
+        return table::get_value(this->_id);
+    }
+    //! stable identifier of the interned value, which may be reused once the
+    //! value is reclaimed
+    std::size_t id() const
+    {
+        return this->_id;
+    }
+    //! cached hash of the interned value
+    std::size_t hash() const
+    {
+        return table::get_hash(this->_id);
+    }
+    //! identity comparison, equivalent to value comparison
+    bool operator==(ptr<T, reclaimed> const& other) const
+    {
+        return this->_id == other._id;
+    }
+    bool operator!=(ptr<T, reclaimed> const& other) const
+    {
+        return this->_id != other._id;
+    }
+    //! number of distinct values currently interned
+    static std::size_t interned_count()
+    {
+        return table::count();
+    }
+    //! approximate bytes held by the blocks and indices of the table for `T`
+    static std::size_t interned_bytes()
+    {
+        return table::bytes();
+    }
+    //! bytes of the table for each distinct value interned
+    static std::size_t interned_node_bytes()
+    {
+        return table::node_bytes();
     }
 
 protected:
-    std::shared_ptr<T> _value;
+    using table = ptr_table<T, reclaimed>;
 };
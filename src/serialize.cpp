@@ -0,0 +1,260 @@
+// serialize.cpp
+//
+
+#include "serialize.h"
+#include "dag.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace algebra {
+
+// node kinds are the indices of the alternatives, which are part of the format
+static_assert(std::is_same_v<std::variant_alternative_t<0, expression_base>, empty>);
+static_assert(std::is_same_v<std::variant_alternative_t<1, expression_base>, op>);
+static_assert(std::is_same_v<std::variant_alternative_t<2, expression_base>, constant>);
+static_assert(std::is_same_v<std::variant_alternative_t<3, expression_base>, value>);
+static_assert(std::is_same_v<std::variant_alternative_t<4, expression_base>, symbol>);
+static_assert(std::is_same_v<std::variant_alternative_t<5, expression_base>, placeholder>);
+
+//------------------------------------------------------------------------------
+template<typename T> T load(char const* data)
+{
+    T out;
+    std::memcpy(&out, data, sizeof(T));
+    return out;
+}
+
+//------------------------------------------------------------------------------
+template<typename T> void append(std::string& out, T const& in)
+{
+    out.append(reinterpret_cast<char const*>(&in), sizeof(T));
+}
+
+//------------------------------------------------------------------------------
+void serialize(std::vector<expression> const& exprs, std::string& out)
+{
+    expression_dag dag;
+    std::vector<std::uint32_t> roots;
+    for (auto const& expr : exprs) {
+        roots.push_back(dag.add(expr));
+    }
+
+    // symbols are numbered in order of first use
+    std::unordered_map<std::size_t, std::uint32_t> symbol_index;
+    std::vector<symbol> symbols;
+    std::vector<serial::node> nodes;
+    for (auto const& n : dag.nodes()) {
+        serial::node out_node{std::uint8_t(n.expr.index()), 0, 0, 0, 0};
+        if (std::holds_alternative<op>(n.expr)) {
+            out_node.type = std::uint8_t(std::get<op>(n.expr).type);
+            out_node.a = n.lhs;
+            out_node.b = n.rhs == expression_dag::no_node ? serial::no_node : n.rhs;
+        } else if (std::holds_alternative<constant>(n.expr)) {
+            out_node.type = std::uint8_t(std::get<constant>(n.expr));
+        } else if (std::holds_alternative<placeholder>(n.expr)) {
+            out_node.type = std::uint8_t(std::get<placeholder>(n.expr));
+        } else if (std::holds_alternative<value>(n.expr)) {
+            std::uint64_t bits = load<std::uint64_t>(reinterpret_cast<char const*>(&std::get<value>(n.expr)));
+            out_node.a = std::uint32_t(bits);
+            out_node.b = std::uint32_t(bits >> 32);
+        } else if (std::holds_alternative<symbol>(n.expr)) {
+            symbol s = std::get<symbol>(n.expr);
+            auto it = symbol_index.emplace(s.id(), std::uint32_t(symbols.size())).first;
+            if (it->second == symbols.size()) {
+                symbols.push_back(s);
+            }
+            out_node.a = it->second;
+        }
+        nodes.push_back(out_node);
+    }
+
+    std::string names;
+    std::vector<std::uint32_t> offsets{0};
+    for (auto const& s : symbols) {
+        names += s.name();
+        offsets.push_back(std::uint32_t(names.size()));
+    }
+    names.resize((names.size() + 3) & ~std::size_t(3), '\0');
+
+    serial::header header{
+        {serial::magic[0], serial::magic[1], serial::magic[2], serial::magic[3]},
+        serial::version,
+        serial::byte_order,
+        std::uint32_t(symbols.size()),
+        std::uint32_t(names.size()),
+        std::uint32_t(nodes.size()),
+        std::uint32_t(roots.size()),
+        0,
+    };
+
+    out.reserve(out.size() + sizeof(header) + offsets.size() * 4 + names.size() + nodes.size() * sizeof(serial::node) + roots.size() * 4);
+    append(out, header);
+    for (auto offset : offsets) {
+        append(out, offset);
+    }
+    out += names;
+    for (auto const& n : nodes) {
+        append(out, n);
+    }
+    for (auto root : roots) {
+        append(out, root);
+    }
+}
+
+//------------------------------------------------------------------------------
+bool deserialize(std::string_view data, std::vector<expression>& exprs)
+{
+    serialized_expressions in(data);
+    if (!in.valid()) {
+        return false;
+    }
+    for (std::size_t ii = 0; ii < in.root_count(); ++ii) {
+        exprs.push_back(in.decode(in.root(ii)));
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+serialized_expressions::serialized_expressions(std::string_view data)
+{
+    if (data.size() < sizeof(serial::header)) {
+        return;
+    }
+    _header = load<serial::header>(data.data());
+    if (std::memcmp(_header.magic, serial::magic, sizeof(serial::magic)) != 0
+        || _header.version != serial::version
+        || _header.byte_order != serial::byte_order
+        || _header.symbol_bytes % 4) {
+        return;
+    }
+
+    // section sizes are checked in 64 bits so they can't overflow
+    std::uint64_t symbols = sizeof(serial::header);
+    std::uint64_t names = symbols + (std::uint64_t(_header.symbol_count) + 1) * 4;
+    std::uint64_t nodes = names + _header.symbol_bytes;
+    std::uint64_t roots = nodes + std::uint64_t(_header.node_count) * sizeof(serial::node);
+    std::uint64_t end = roots + std::uint64_t(_header.root_count) * 4;
+    if (end > data.size()) {
+        return;
+    }
+
+    _symbols = data.data() + symbols;
+    _names = data.data() + names;
+    _nodes = data.data() + nodes;
+    _roots = data.data() + roots;
+    _size = std::size_t(end);
+
+    // symbol offsets must be increasing and within the names
+    std::uint32_t offset = 0;
+    for (std::uint32_t ii = 0; ii <= _header.symbol_count; ++ii) {
+        std::uint32_t next = load<std::uint32_t>(_symbols + ii * 4);
+        if (next < offset || next > _header.symbol_bytes || (ii == 0 && next != 0)) {
+            return;
+        }
+        offset = next;
+    }
+
+    // each node may only refer to the nodes before it, so decoding terminates
+    for (std::uint32_t ii = 0; ii < _header.node_count; ++ii) {
+        serial::node n = get(ii);
+        switch (n.kind) {
+            case 0: // empty
+            case 3: // value
+                break;
+            case 1: // op
+                if (n.type >= op_type_count || n.a >= ii || (n.b >= ii && n.b != serial::no_node)) {
+                    return;
+                }
+                break;
+            case 2: // constant
+                if (n.type > std::uint8_t(constant::i)) {
+                    return;
+                }
+                break;
+            case 4: // symbol
+                if (n.a >= _header.symbol_count) {
+                    return;
+                }
+                break;
+            case 5: // placeholder
+                if (n.type >= placeholder_count) {
+                    return;
+                }
+                break;
+            default:
+                return;
+        }
+    }
+
+    for (std::uint32_t ii = 0; ii < _header.root_count; ++ii) {
+        if (root(ii) >= _header.node_count) {
+            return;
+        }
+    }
+
+    _valid = true;
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t serialized_expressions::root(std::size_t index) const
+{
+    assert(index < _header.root_count);
+    return load<std::uint32_t>(_roots + index * 4);
+}
+
+//------------------------------------------------------------------------------
+serial::node serialized_expressions::get(std::uint32_t index) const
+{
+    return load<serial::node>(_nodes + std::size_t(index) * sizeof(serial::node));
+}
+
+//------------------------------------------------------------------------------
+std::string_view serialized_expressions::symbol_name(std::uint32_t index) const
+{
+    std::uint32_t begin = load<std::uint32_t>(_symbols + index * 4);
+    std::uint32_t end = load<std::uint32_t>(_symbols + index * 4 + 4);
+    return std::string_view(_names + begin, end - begin);
+}
+
+//------------------------------------------------------------------------------
+expression serialized_expressions::decode(std::uint32_t index) const
+{
+    assert(_valid && index < _header.node_count);
+    std::unordered_map<std::uint32_t, expression> decoded;
+    return decode_r(index, decoded);
+}
+
+//------------------------------------------------------------------------------
+expression serialized_expressions::decode_r(std::uint32_t index, std::unordered_map<std::uint32_t, expression>& decoded) const
+{
+    auto it = decoded.find(index);
+    if (it != decoded.end()) {
+        return it->second;
+    }
+
+    serial::node n = get(index);
+    expression out;
+    switch (n.kind) {
+        case 1: {
+            expression lhs = decode_r(n.a, decoded);
+            expression rhs = n.b == serial::no_node ? expression{} : decode_r(n.b, decoded);
+            out = op{op_type(n.type), lhs, rhs};
+            break;
+        }
+        case 2: out = constant(n.type); break;
+        case 3: {
+            std::uint64_t bits = std::uint64_t(n.a) | std::uint64_t(n.b) << 32;
+            out = load<value>(reinterpret_cast<char const*>(&bits));
+            break;
+        }
+        case 4: out = symbol(symbol_name(n.a)); break;
+        case 5: out = placeholder(n.type); break;
+        default: break;
+    }
+
+    decoded.emplace(index, out);
+    return out;
+}
+
+} // namespace algebra
@@ -0,0 +1,119 @@
+// serialize.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//  Binary encoding of expressions
+//
+//  Expressions are encoded as a DAG so shared subexpressions are stored once.
+//  All fields are 32-bit words in the byte order of the writer, which is
+//  recorded in the header so other byte orders are rejected:
+//
+//      header      magic "ALGX", version, byte order mark, symbol count,
+//                  symbol bytes, node count, root count, reserved
+//      symbols     symbol count + 1 offsets into the names, then the names
+//                  padded to a multiple of four bytes
+//      nodes       node count records of three words, see `serialized_node`,
+//                  operands precede the operations using them
+//      roots       root count node indices
+//
+
+namespace serial {
+
+constexpr char magic[4] = {'A', 'L', 'G', 'X'};
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t byte_order = 0x01020304;
+//! operand index of unary operations
+constexpr std::uint32_t no_node = UINT32_MAX;
+
+struct header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t symbol_count;
+    std::uint32_t symbol_bytes;
+    std::uint32_t node_count;
+    std::uint32_t root_count;
+    std::uint32_t reserved;
+};
+
+//------------------------------------------------------------------------------
+//! encoded node, `kind` is the index of the alternative in `expression` and
+//! `type` the operation, constant or placeholder. Operations store operand
+//! indices in `a` and `b`, values the bits of the double and symbols their
+//! index in the symbol table in `a`.
+struct node
+{
+    std::uint8_t kind;
+    std::uint8_t type;
+    std::uint16_t reserved;
+    std::uint32_t a;
+    std::uint32_t b;
+};
+
+static_assert(sizeof(header) == 32, "unexpected header layout");
+static_assert(sizeof(node) == 12, "unexpected node layout");
+
+} // namespace serial
+
+//------------------------------------------------------------------------------
+//! append the encoding of `exprs` to `out`
+void serialize(std::vector<expression> const& exprs, std::string& out);
+
+//------------------------------------------------------------------------------
+//! decode the expressions encoded in `data`, returns false if it is not a
+//! valid encoding
+bool deserialize(std::string_view data, std::vector<expression>& exprs);
+
+//------------------------------------------------------------------------------
+//! validated view of encoded expressions which decodes nodes on demand
+//!
+//! Does not copy `data`, which must outlive the view, so a memory-mapped file
+//! can be queried without decoding the nodes which are never used.
+class serialized_expressions
+{
+public:
+    serialized_expressions() = default;
+    explicit serialized_expressions(std::string_view data);
+
+    //! false if `data` is truncated or inconsistent
+    bool valid() const { return _valid; }
+    //! number of bytes used by the encoding, which may be followed by other
+    //! data
+    std::size_t size() const { return _size; }
+
+    std::size_t node_count() const { return _header.node_count; }
+    std::size_t root_count() const { return _header.root_count; }
+    //! node index of a root
+    std::uint32_t root(std::size_t index) const;
+
+    //! decode the expression rooted at a node
+    expression decode(std::uint32_t index) const;
+
+protected:
+    serial::header _header = {};
+    char const* _symbols = nullptr;
+    char const* _names = nullptr;
+    char const* _nodes = nullptr;
+    char const* _roots = nullptr;
+    std::size_t _size = 0;
+    bool _valid = false;
+
+protected:
+    serial::node get(std::uint32_t index) const;
+    std::string_view symbol_name(std::uint32_t index) const;
+    expression decode_r(std::uint32_t index, std::unordered_map<std::uint32_t, expression>& decoded) const;
+};
+
+} // namespace algebra
@@ -0,0 +1,103 @@
+// simplify_context.cpp
+//
+
+#include "simplify_context.h"
+
+#include <algorithm>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+simplify_context::simplify_context(simplify_options const& options)
+    : _options(options)
+{}
+
+//------------------------------------------------------------------------------
+expression simplify_context::simplify(expression const& expr)
+{
+    return simplify_r(expr, std::max<std::size_t>(op_count(expr), 1));
+}
+
+//------------------------------------------------------------------------------
+expression simplify_context::best(expression const& expr) const
+{
+    auto it = _best.find(expr);
+    return it == _best.end() ? expression{} : it->second.best;
+}
+
+//------------------------------------------------------------------------------
+void simplify_context::clear()
+{
+    _best.clear();
+    _reused = 0;
+    _searched = 0;
+}
+
+//------------------------------------------------------------------------------
+expression simplify_context::simplify_r(expression const& expr, std::size_t root_ops)
+{
+    if (!std::holds_alternative<op>(expr)) {
+        return expr;
+    }
+    auto it = _best.find(expr);
+    if (it != _best.end()) {
+        ++_reused;
+        return it->second.best;
+    }
+
+    op const& expr_op = std::get<op>(expr);
+    expression lhs = simplify_r(expr_op.lhs, root_ops);
+    expression rhs = simplify_r(expr_op.rhs, root_ops);
+    expression start = lhs == expr_op.lhs && rhs == expr_op.rhs ? expr : expression(op{expr_op.type, lhs, rhs});
+
+    // operands may simplify to an operation which was already searched
+    expression best;
+    auto known = start != expr ? _best.find(start) : _best.end();
+    if (known != _best.end()) {
+        ++_reused;
+        best = known->second.best;
+    } else if (_options.interrupted() != simplify_status::complete) {
+        // out of time, the simplified operands are the best form found
+        return start;
+    } else {
+        // each operation gets the share of the budget of the whole request
+        // which its size is, so the root gets all of it
+        std::size_t const ops = op_count(expr);
+        simplify_options options = _options;
+        options.trace = _options.trace && ops == root_ops;
+        if (options.max_iterations != SIZE_MAX) {
+            options.max_iterations = std::max<std::size_t>(1, options.max_iterations * ops / root_ops);
+        }
+        best = algebra::simplify(start, options);
+        ++_searched;
+
+        // a search cut short is not the best form within the limits
+        if (_options.interrupted() != simplify_status::complete) {
+            return best;
+        }
+    }
+
+    // the result is its own best form, so an input equal to an earlier
+    // result is not searched again, and if an earlier search found a cheaper
+    // form of the result that form is used instead
+    entry form{best, _options.cost(best)};
+    auto prior = _best.find(best);
+    if (prior != _best.end() && prior->second.cost < form.cost) {
+        form = prior->second;
+    }
+    remember(expr, form);
+    remember(start, form);
+    remember(best, form);
+    return form.best;
+}
+
+//------------------------------------------------------------------------------
+void simplify_context::remember(expression const& expr, entry const& form)
+{
+    auto [it, inserted] = _best.emplace(expr, form);
+    if (!inserted && form.cost < it->second.cost) {
+        it->second = form;
+    }
+}
+
+} // namespace algebra
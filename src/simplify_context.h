@@ -0,0 +1,69 @@
+// simplify_context.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <unordered_map>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! simplifier which remembers the best form found for every subexpression
+//!
+//! Expressions are simplified bottom-up, each operation is searched once its
+//! operands have been replaced by their best forms. Subexpressions are
+//! interned so one seen in an earlier call is found by identity and its best
+//! form reused without searching, and an expression which differs from an
+//! earlier one in a single subterm only searches that subterm and the
+//! operations enclosing it. Each operation is searched with the share of
+//! `simplify_options::max_iterations` which its size is of the expression
+//! being simplified. Searching operations separately means the result can
+//! differ from a single `simplify` of the whole expression. Not thread-safe.
+class simplify_context
+{
+public:
+    explicit simplify_context(simplify_options const& options = {});
+
+    //! return the cheapest form found for `expr`, `simplify_options::trace`
+    //! only prints the search of the root. Once the deadline has passed or
+    //! the search is cancelled, operations are no longer searched or
+    //! remembered.
+    expression simplify(expression const& expr);
+
+    //! return the best form found for `expr`, or an empty expression if it
+    //! has not been simplified
+    expression best(expression const& expr) const;
+
+    simplify_options const& options() const { return _options; }
+    //! options may be changed between calls, e.g. to set a deadline for each
+    //! request, forms found with earlier options are still reused
+    simplify_options& options() { return _options; }
+    //! number of remembered subexpressions
+    std::size_t size() const { return _best.size(); }
+    //! operations whose best form was reused, and operations searched
+    std::size_t reused() const { return _reused; }
+    std::size_t searched() const { return _searched; }
+
+    //! forget every best form, e.g. to bound memory use
+    void clear();
+
+protected:
+    struct entry
+    {
+        expression best;
+        double cost;    //!< of `best`, so a cheaper form can replace it
+    };
+
+    simplify_options _options;
+    std::unordered_map<expression, entry> _best;
+    std::size_t _reused = 0;
+    std::size_t _searched = 0;
+
+protected:
+    expression simplify_r(expression const& expr, std::size_t root_ops);
+    //! remember `form` for `expr` unless a cheaper form already is
+    void remember(expression const& expr, entry const& form);
+};
+
+} // namespace algebra
@@ -0,0 +1,151 @@
+// thread_pool.cpp
+//
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace algebra {
+
+namespace {
+
+//! index of the queue owned by the current thread, or none for non-workers
+thread_local std::size_t current_queue = SIZE_MAX;
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+thread_pool::thread_pool(std::size_t threads)
+    : _queued(0)
+    , _next_queue(0)
+    , _stop(false)
+{
+    // always keep one queue so tasks can be submitted without workers
+    for (std::size_t ii = 0; ii < std::max<std::size_t>(threads, 1); ++ii) {
+        _queues.push_back(std::make_unique<queue>());
+    }
+    for (std::size_t ii = 0; ii < threads; ++ii) {
+        _threads.emplace_back(&thread_pool::run, this, ii);
+    }
+}
+
+//------------------------------------------------------------------------------
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+    for (auto& t : _threads) {
+        t.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+void thread_pool::submit(task fn)
+{
+    // workers push onto their own queue, others distribute round-robin
+    std::size_t index = current_queue;
+    if (index >= _queues.size()) {
+        index = _next_queue++ % _queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(fn));
+        std::lock_guard<std::mutex> count_lock(_mutex);
+        ++_queued;
+    }
+    _condition.notify_one();
+}
+
+//------------------------------------------------------------------------------
+void thread_pool::parallel_for(std::size_t count, std::function<void(std::size_t)> const& fn)
+{
+    // the count is only changed with the mutex held, and the last iteration
+    // notifies before releasing it, so the caller can't return and destroy
+    // them while they are still in use
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::size_t remaining = count;
+    for (std::size_t ii = 0; ii < count; ++ii) {
+        submit([&fn, &mutex, &finished, &remaining, ii]() {
+            fn(ii);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!--remaining) {
+                finished.notify_all();
+            }
+        });
+    }
+
+    // help with queued tasks, once none are left every remaining iteration
+    // is running on a worker and the caller sleeps until they finish
+    std::size_t index = current_queue < _queues.size() ? current_queue : 0;
+    for (task next; try_pop(index, next); next = nullptr) {
+        next();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&remaining]() { return !remaining; });
+}
+
+//------------------------------------------------------------------------------
+thread_pool& shared_thread_pool()
+{
+    static thread_pool pool(std::max<std::size_t>(std::thread::hardware_concurrency(), 2) - 1);
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+void thread_pool::run(std::size_t index)
+{
+    current_queue = index;
+    while (true) {
+        task next;
+        if (try_pop(index, next)) {
+            next();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this]() { return _stop || _queued; });
+        if (_stop && !_queued) {
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool thread_pool::try_pop(std::size_t index, task& fn)
+{
+    // queue locks are always taken before `_mutex`
+    // newest task from own queue
+    {
+        queue& q = *_queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.size()) {
+            fn = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            std::lock_guard<std::mutex> count_lock(_mutex);
+            --_queued;
+            return true;
+        }
+    }
+
+    // oldest task from any other queue
+    for (std::size_t ii = 1; ii < _queues.size(); ++ii) {
+        queue& q = *_queues[(index + ii) % _queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.size()) {
+            fn = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            std::lock_guard<std::mutex> count_lock(_mutex);
+            --_queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace algebra
@@ -0,0 +1,74 @@
+// thread_pool.h
+//
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! fixed-size pool of worker threads with work-stealing task queues
+//!
+//! Each worker prefers the most recently queued task on its own queue and
+//! steals the oldest task from another queue when its own is empty. Threads
+//! waiting on `parallel_for` run queued tasks until none are left and then
+//! block until the rest finish, so it is safe to call from inside a task.
+class thread_pool
+{
+public:
+    using task = std::function<void()>;
+
+    //! start `threads` worker threads, zero runs every task on the caller
+    thread_pool(std::size_t threads);
+    ~thread_pool();
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    //! number of worker threads
+    std::size_t size() const { return _threads.size(); }
+
+    //! queue a task to be run by any worker
+    void submit(task fn);
+
+    //! call `fn(ii)` for each `ii` in [0, count) and wait until all return
+    void parallel_for(std::size_t count, std::function<void(std::size_t)> const& fn);
+
+protected:
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::thread> _threads;
+    std::vector<std::unique_ptr<queue>> _queues;
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    //! tasks in all queues, changed with `_mutex` held together with the
+    //! lock of the queue so waiters never see a count the queues disagree with
+    std::size_t _queued;
+    std::atomic<std::size_t> _next_queue;
+    bool _stop;
+
+protected:
+    void run(std::size_t index);
+    //! pop from queue `index` or steal from any other queue
+    bool try_pop(std::size_t index, task& fn);
+};
+
+//------------------------------------------------------------------------------
+//! process-wide pool with a worker for each hardware thread but one, started
+//! on first use and shared by every caller which doesn't supply its own
+thread_pool& shared_thread_pool();
+
+} // namespace algebra
@@ -0,0 +1,998 @@
+// transform.cpp
+//
+
+#include "transform.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! built-in rules, `source = target` may be applied in either direction and
+//! `source => target` only from source to target, e.g. for identities whose
+//! reverse matches any subject or introduces a derivative
+constexpr char const* transform_strings[] = {
+    // associativity of addition
+    "(x + y) + z = x + (y + z)",
+
+    // associativity of multiplication
+    "(x * y) * z = x * (y * z)",
+
+    // commutativity of addition
+    "x + y = y + x",
+
+    // commutativity of multiplication
+    "x * y = y * x",
+
+    // distributivity of multiplication over addition
+    "a * (x + y) = a * x + a * y",
+
+    // additive identity
+    "x + 0 => x",
+
+    // multiplicative identity
+    "x * 1 => x",
+
+    // the multiplicative kernel `x * 0 => 0` is folded instead, which keeps
+    // an undefined factor
+
+    // additive inverse
+    "x + (-x) => 0",
+    "-x = 0 - x",
+    "x + (-y) = x - y",
+
+    // multiplicative inverse
+    "x * (x^-1) => 1",
+    "1/x = 1 / x",
+    "x * (1/y) = x / y",
+
+    "x + x = x * 2",
+    "x * x = x ^ 2",
+
+    //
+    //  exponentiation and logarithms
+    //
+
+    "log(x * y, b) = log(x, b) + log(y, b)",
+
+    // change of base
+    "log(x, b) = log(x, y) / log(b, y)",
+
+    "b ^ log(x, b) => x",
+
+    // exponentiation identity
+    "b ^ x * b ^ y = b ^ (x + y)",
+
+    "(b ^ x) ^ y = b ^ (x * y)",
+
+    // distributivity over multiplication
+    "(x * y) ^ n = (x ^ n) * (y ^ n)",
+
+    "x ^ 0 => 1",
+
+    // not oriented, `x ^ 1` is how products of powers are combined
+    "x ^ 1 = x",
+
+    "log(1, x) => 0",
+
+    //
+    //  complex numbers
+    //
+
+    // fundamental property of i
+    "i ^ 2 = -1",
+    // euler's formula
+    "e ^ (i * x) = cos(x) + i * sin(x)",
+
+    //
+    //  trigonometry
+    //
+
+    "sin(0) => 0",
+    "cos(0) => 1",
+    "sin(pi/2) => 1",
+    "cos(pi/2) => 0",
+
+    "tan(x) = sin(x) / cos(x)",
+    "sec(x) = 1 / cos(x)",
+    "csc(x) = 1 / sin(x)",
+    "cot(x) = 1 / tan(x)",
+    "1 = sin(x) ^ 2 + cos(x) ^ 2",
+
+    "sin(-x) = -sin(x)",
+    "cos(-x) => cos(x)",
+    "tan(-x) = -tan(x)",
+
+    "sin(pi/2 - x) = cos(x)",
+    "cos(pi/2 - x) = sin(x)",
+    "tan(pi/2 - x) = cot(x)",
+
+    "sin(pi - x) => sin(x)",
+    "cos(pi - x) = -cos(x)",
+    "tan(pi - x) = -tan(x)",
+
+    "sin(2pi - x) = sin(-x)",
+    "cos(2pi - x) = cos(-x)",
+    "tan(2pi - x) = tan(-x)",
+
+    "sin(x + y) = sin(x) * cos(y) + cos(x) * sin(y)",
+
+    "sin(x - y) = sin(x) * cos(y) - cos(x) * sin(y)",
+
+    "cos(x + y) = cos(x) * cos(y) - sin(x) * sin(y)",
+    "cos(x - y) = cos(x) * cos(y) + sin(x) * sin(y)",
+
+    "sin(2pi + x) => sin(x)",
+    "cos(2pi + x) => cos(x)",
+    "tan(2pi + x) => tan(x)",
+
+    "sin(2x) = 2 * sin(x) * cos(x)",
+    "cos(2x) = cos(x) ^ 2 - sin(x) ^ 2",
+    "cos(2x) = 2 * cos(x) ^ 2 - 1",
+
+    "sin(3x) = 3 * sin(x) - 4 * sin(x) ^ 3",
+    "cos(3x) = 4 * cos(x) ^ 3 - 3 * cos(x)",
+
+    "sin(x) ^ 2 = (1 - cos(2x)) / 2",
+    "cos(x) ^ 2 = (1 + cos(2x)) / 2",
+
+    //
+    //  differentiation
+    //
+
+    "d/dx(f + g) => d/dx(f) + d/dx(g)",
+    "d/dx(f - g) => d/dx(f) - d/dx(g)",
+
+    // product rule
+    "d/dx(f * g) => d/dx(f) * g + f * d/dx(g)",
+
+    // quotient rule
+    "d/dx(f / g) => (d/dx(f) * g - f * d/dx(g)) / g^2",
+
+    // chain rule
+    //"d/dx(f(g)) = d/dx(f)(g) * d/dx(g)",
+
+    // power rule
+    "d/dx(x ^ r) => r * x ^ (r - 1)", // (r != 0),
+
+    "d/dx(sin(x)) => cos(x)",
+    "d/dx(cos(x)) => -sin(x)",
+    "d/dx(tan(x)) => sec(x) ^ 2",
+
+    "d/dx(sin(f)) => d/dx(f) * cos(f)",
+    "d/dx(cos(f)) => d/dx(f) * -sin(f)",
+    "d/dx(tan(f)) => d/dx(f) * sec(f) ^ 2",
+};
+
+std::vector<transform> transforms;
+transform_index transforms_index;
+transform_index reductions_index;
+
+//------------------------------------------------------------------------------
+//! compile-time parser for `transform_strings`
+//!
+//! Accepts the same grammar as `parse` and converts symbols to placeholders as
+//! it goes. The result is a flat table of nodes which only needs to be interned
+//! at runtime. Malformed rules fail to compile.
+namespace rules {
+
+constexpr std::size_t npos = SIZE_MAX;
+
+//------------------------------------------------------------------------------
+enum class kind
+{
+    empty,
+    op,
+    constant,
+    value,
+    placeholder,
+};
+
+//------------------------------------------------------------------------------
+struct node
+{
+    rules::kind kind = kind::empty;
+    op_type type = op_type::equality;
+    constant cst = constant::undefined;
+    value val = 0;
+    placeholder ph = placeholder::a;
+    std::size_t lhs = npos;
+    std::size_t rhs = npos;
+};
+
+//------------------------------------------------------------------------------
+constexpr std::size_t rule_count = sizeof(transform_strings) / sizeof(transform_strings[0]);
+
+//------------------------------------------------------------------------------
+//! upper bound on the number of nodes in all rules, no token produces more
+//! than three nodes and no token is shorter than one character
+constexpr std::size_t node_capacity()
+{
+    std::size_t size = 0;
+    for (char const* str : transform_strings) {
+        while (*str++) {
+            size += 3;
+        }
+    }
+    return size;
+}
+
+//------------------------------------------------------------------------------
+template<std::size_t capacity> struct table
+{
+    std::array<node, capacity> nodes = {};
+    std::size_t size = 0;
+    std::array<std::size_t, rule_count> source = {};
+    std::array<std::size_t, rule_count> target = {};
+    std::array<bool, rule_count> oriented = {};
+};
+
+//------------------------------------------------------------------------------
+struct token
+{
+    std::size_t begin;
+    std::size_t end;
+};
+
+//------------------------------------------------------------------------------
+constexpr bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+constexpr bool is_alpha(char ch) { return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'); }
+
+//------------------------------------------------------------------------------
+template<std::size_t capacity> class rule_parser
+{
+public:
+    constexpr rule_parser(char const* str, table<capacity>& out)
+        : _str(str)
+        , _pos(0)
+        , _out(out)
+    {}
+
+    //! parse the entire string and return the index of the root node
+    constexpr std::size_t parse()
+    {
+        std::size_t root = parse_expression(INT_MAX);
+        if (!empty(lex(_pos))) {
+            throw "unexpected token";
+        }
+        return root;
+    }
+
+    //! true if the rule was written `source => target`
+    constexpr bool oriented() const { return _oriented; }
+
+protected:
+    char const* _str;
+    std::size_t _pos;
+    table<capacity>& _out;
+    bool _oriented = false;
+
+protected:
+    //! return the token starting at or after `pos`
+    constexpr token lex(std::size_t pos) const
+    {
+        while (_str[pos] && _str[pos] <= ' ') {
+            ++pos;
+        }
+
+        token t{pos, pos};
+        switch (_str[pos]) {
+            case '\0':
+                return t;
+            case '=':
+                t.end += _str[pos + 1] == '>' ? 2 : 1;
+                return t;
+            case '+':
+            case '-':
+            case '*':
+            case '/':
+            case '^':
+            case '(':
+            case ')':
+            case ',':
+                ++t.end;
+                return t;
+        }
+
+        if (is_digit(_str[pos]) || _str[pos] == '.') {
+            while (is_digit(_str[t.end]) || _str[t.end] == '.') {
+                ++t.end;
+            }
+        } else if (is_alpha(_str[pos])) {
+            while (is_alpha(_str[t.end])) {
+                ++t.end;
+            }
+        } else {
+            throw "invalid character";
+        }
+        return t;
+    }
+
+    constexpr bool empty(token t) const { return t.begin == t.end; }
+
+    constexpr bool equals(token t, char ch) const
+    {
+        return t.end == t.begin + 1 && _str[t.begin] == ch;
+    }
+
+    constexpr bool equals(token t, char const* str) const
+    {
+        for (std::size_t ii = t.begin; ii < t.end; ++ii, ++str) {
+            if (_str[ii] != *str) {
+                return false;
+            }
+        }
+        return !*str;
+    }
+
+    constexpr void expect(char ch)
+    {
+        token t = lex(_pos);
+        if (!equals(t, ch)) {
+            throw "unexpected token";
+        }
+        _pos = t.end;
+    }
+
+    constexpr std::size_t add(node n)
+    {
+        _out.nodes[_out.size] = n;
+        return _out.size++;
+    }
+
+    constexpr std::size_t add_op(op_type type, std::size_t lhs, std::size_t rhs = npos)
+    {
+        node n;
+        n.kind = kind::op;
+        n.type = type;
+        n.lhs = lhs;
+        n.rhs = rhs;
+        return add(n);
+    }
+
+    constexpr std::size_t add_constant(constant cst)
+    {
+        node n;
+        n.kind = kind::constant;
+        n.cst = cst;
+        return add(n);
+    }
+
+    //! symbols are converted to placeholders so they can be used for substitution
+    constexpr std::size_t add_placeholder(token t)
+    {
+        if (t.end != t.begin + 1 || _str[t.begin] < 'a' || _str[t.begin] > 'z') {
+            throw "invalid placeholder";
+        }
+        node n;
+        n.kind = kind::placeholder;
+        n.ph = static_cast<placeholder>(static_cast<int>(placeholder::a) + (_str[t.begin] - 'a'));
+        return add(n);
+    }
+
+    constexpr std::size_t add_value(token t)
+    {
+        value v = 0;
+        value scale = 1;
+        bool has_dot = false;
+        for (std::size_t ii = t.begin; ii < t.end; ++ii) {
+            if (_str[ii] == '.') {
+                if (has_dot) {
+                    throw "invalid literal";
+                }
+                has_dot = true;
+            } else {
+                v = v * 10 + (_str[ii] - '0');
+                if (has_dot) {
+                    scale *= 10;
+                }
+            }
+        }
+        node n;
+        n.kind = kind::value;
+        n.val = v / scale;
+        return add(n);
+    }
+
+    constexpr op_type parse_operator(token t)
+    {
+        if (equals(t, '=')) {
+            return op_type::equality;
+        } else if (equals(t, "=>")) {
+            _oriented = true;
+            return op_type::equality;
+        } else if (equals(t, '+')) {
+            return op_type::sum;
+        } else if (equals(t, '-')) {
+            return op_type::difference;
+        } else if (equals(t, '*')) {
+            return op_type::product;
+        } else if (equals(t, '/')) {
+            return op_type::quotient;
+        } else if (equals(t, '^')) {
+            return op_type::exponent;
+        } else {
+            throw "expected operator";
+        }
+    }
+
+    constexpr std::size_t parse_expression(int precedence)
+    {
+        std::size_t lhs = parse_operand();
+
+        for (token t = lex(_pos); !empty(t) && !equals(t, ')') && !equals(t, ','); t = lex(_pos)) {
+            op_type type = parse_operator(t);
+            int lhs_precedence = parser::op_precedence(type);
+            if (precedence <= lhs_precedence) {
+                break;
+            }
+            _pos = t.end;
+            lhs = add_op(type, lhs, parse_expression(lhs_precedence));
+        }
+
+        return lhs;
+    }
+
+    constexpr std::size_t parse_operand()
+    {
+        bool is_negative = false;
+
+        // check for negation
+        token t = lex(_pos);
+        if (equals(t, '-')) {
+            is_negative = true;
+            _pos = t.end;
+        }
+
+        std::size_t out = parse_operand_explicit();
+
+        // check for implicit multiplication, e.g. `3x`
+        if (_out.nodes[out].kind == kind::value || _out.nodes[out].kind == kind::constant) {
+            token next = lex(_pos);
+            if (!empty(next) && (equals(next, '(') || is_alpha(_str[next.begin]) || is_digit(_str[next.begin]))) {
+                std::size_t saved_pos = _pos;
+                std::size_t saved_size = _out.size;
+                std::size_t rhs = parse_expression(parser::op_precedence(op_type::product));
+                if (_out.nodes[rhs].kind == kind::value) {
+                    _pos = saved_pos;
+                    _out.size = saved_size;
+                } else {
+                    out = add_op(op_type::product, out, rhs);
+                }
+            }
+        }
+
+        // apply negation after implicit multiplication
+        if (is_negative) {
+            return add_op(op_type::negative, out);
+        } else {
+            return out;
+        }
+    }
+
+    constexpr std::size_t parse_operand_explicit()
+    {
+        token t = lex(_pos);
+        if (empty(t)) {
+            throw "expected expression";
+        }
+        _pos = t.end;
+
+        if (equals(t, '(')) {
+            std::size_t expr = parse_expression(INT_MAX);
+            expect(')');
+            return expr;
+
+        //
+        //  functions
+        //
+
+        } else if (equals(t, "ln")) {
+            return add_op(op_type::logarithm, parse_operand(), add_constant(constant::e));
+        } else if (equals(t, "log")) {
+            expect('(');
+            std::size_t lhs = parse_expression(INT_MAX);
+            expect(',');
+            std::size_t rhs = parse_expression(INT_MAX);
+            expect(')');
+            return add_op(op_type::logarithm, lhs, rhs);
+        } else if (equals(t, "sin")) {
+            return add_op(op_type::sine, parse_operand());
+        } else if (equals(t, "cos")) {
+            return add_op(op_type::cosine, parse_operand());
+        } else if (equals(t, "tan")) {
+            return add_op(op_type::tangent, parse_operand());
+        } else if (equals(t, "sec")) {
+            return add_op(op_type::secant, parse_operand());
+        } else if (equals(t, "csc")) {
+            return add_op(op_type::cosecant, parse_operand());
+        } else if (equals(t, "cot")) {
+            return add_op(op_type::cotangent, parse_operand());
+
+        //
+        //  constants
+        //
+
+        } else if (equals(t, "pi")) {
+            return add_constant(constant::pi);
+        } else if (equals(t, 'e')) {
+            return add_constant(constant::e);
+        } else if (equals(t, 'i')) {
+            return add_constant(constant::i);
+
+        //
+        //  values
+        //
+
+        } else if (is_digit(_str[t.begin]) || _str[t.begin] == '.') {
+            return add_value(t);
+        }
+
+        //
+        //  derivative
+        //
+
+        if (equals(t, 'd')) {
+            token slash = lex(_pos);
+            token var = lex(slash.end);
+            if (equals(slash, '/') && !empty(var) && _str[var.begin] == 'd') {
+                _pos = var.end;
+                std::size_t rhs = add_placeholder({var.begin + 1, var.end});
+                return add_op(op_type::derivative, parse_operand(), rhs);
+            }
+        }
+
+        //
+        //  symbols
+        //
+
+        if (is_alpha(_str[t.begin])) {
+            return add_placeholder(t);
+        } else {
+            throw "syntax error";
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+template<std::size_t capacity> constexpr table<capacity> compile()
+{
+    table<capacity> out;
+    for (std::size_t ii = 0; ii < rule_count; ++ii) {
+        rule_parser<capacity> parser(transform_strings[ii], out);
+        std::size_t root = parser.parse();
+        if (out.nodes[root].kind != kind::op || out.nodes[root].type != op_type::equality) {
+            throw "expected equality";
+        }
+        out.source[ii] = out.nodes[root].lhs;
+        out.target[ii] = out.nodes[root].rhs;
+        out.oriented[ii] = parser.oriented();
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! parse once with a conservative capacity to size the stored table exactly
+constexpr std::size_t node_count = compile<node_capacity()>().size;
+constexpr table<node_count> builtin = compile<node_count>();
+
+//------------------------------------------------------------------------------
+expression build(std::size_t index)
+{
+    if (index == npos) {
+        return empty{};
+    }
+
+    node const& n = builtin.nodes[index];
+    switch (n.kind) {
+        case kind::op: return op{n.type, build(n.lhs), build(n.rhs)};
+        case kind::constant: return n.cst;
+        case kind::value: return n.val;
+        case kind::placeholder: return n.ph;
+        default: return empty{};
+    }
+}
+
+} // namespace rules
+
+//------------------------------------------------------------------------------
+pattern::pattern(expression const& expr)
+    : expr(expr)
+    , placeholders(placeholder_mask(expr))
+    , stack_size(0)
+{
+    std::uint32_t bound = 0;
+    std::size_t pending = 1;
+    compile_r(expr, bound, pending);
+}
+
+//------------------------------------------------------------------------------
+void pattern::compile_r(expression const& expr, std::uint32_t& bound, std::size_t& pending)
+{
+    stack_size = std::max(stack_size, pending);
+    --pending;
+
+    // subexpressions without placeholders are compared in one step
+    if (!placeholder_mask(expr)) {
+        program.push_back({match_opcode::exact, {}, {}, expr});
+    } else if (std::holds_alternative<placeholder>(expr)) {
+        placeholder ph = std::get<placeholder>(expr);
+        std::uint32_t bit = placeholder_mask(expr);
+        program.push_back({(bound & bit) ? match_opcode::compare : match_opcode::bind, {}, ph, {}});
+        bound |= bit;
+    } else {
+        op const& expr_op = std::get<op>(expr);
+        program.push_back({match_opcode::operation, expr_op.type, {}, {}});
+        pending += 2;
+        compile_r(expr_op.lhs, bound, pending);
+        compile_r(expr_op.rhs, bound, pending);
+    }
+}
+
+//------------------------------------------------------------------------------
+transform::transform(expression const& source, expression const& target, bool oriented)
+    : source(source)
+    , target(target)
+    , forward(!(this->target.placeholders & ~this->source.placeholders))
+    , reverse(!oriented && !(this->source.placeholders & ~this->target.placeholders))
+    , oriented(oriented)
+    , reducing(oriented && forward && op_count(target) < op_count(source))
+    , permutation(canonical(source) == canonical(target))
+{
+    assert(forward || reverse);
+}
+
+//------------------------------------------------------------------------------
+bool match_r(expression const& lhs, expression const& rhs, bindings& placeholders)
+{
+    // interned expressions without placeholders are equal only if identical
+    if (!placeholder_mask(lhs) && !placeholder_mask(rhs)) {
+        return lhs == rhs;
+
+    // compare placeholders
+    } else if (std::holds_alternative<placeholder>(lhs) && std::holds_alternative<placeholder>(rhs)) {
+        return std::get<placeholder>(lhs) == std::get<placeholder>(rhs);
+    } else if (std::holds_alternative<placeholder>(lhs) || std::holds_alternative<placeholder>(rhs)) {
+        if (std::holds_alternative<placeholder>(lhs)) {
+            placeholder ph = std::get<placeholder>(lhs);
+            if (placeholders.bound(ph)) {
+                return match_r(placeholders[ph], rhs, placeholders);
+            } else {
+                placeholders.bind(ph, rhs);
+                return true;
+            }
+        } else {
+            return match_r(rhs, lhs, placeholders);
+        }
+
+    // compare ops
+    } else if (std::holds_alternative<op>(lhs) && std::holds_alternative<op>(rhs)) {
+        op const& lhs_op = std::get<op>(lhs);
+        op const& rhs_op = std::get<op>(rhs);
+
+        if (lhs_op.type != rhs_op.type) {
+            return false;
+        }
+
+        return match_r(lhs_op.lhs, rhs_op.lhs, placeholders)
+            && match_r(lhs_op.rhs, rhs_op.rhs, placeholders);
+
+    // no match
+    } else {
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool match(expression const& lhs, expression const& rhs, bindings& placeholders)
+{
+    std::size_t mark = placeholders.mark();
+    if (match_r(lhs, rhs, placeholders)) {
+        return true;
+    }
+    placeholders.undo(mark);
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool match(pattern const& pat, expression const& expr, bindings& placeholders)
+{
+    assert(!placeholder_mask(expr));
+
+    std::array<expression const*, max_pattern_stack> fixed;
+    std::vector<expression const*> allocated;
+    expression const** stack = fixed.data();
+    if (pat.stack_size > fixed.size()) {
+        allocated.resize(pat.stack_size);
+        stack = allocated.data();
+    }
+    std::size_t size = 0;
+    stack[size++] = &expr;
+
+    std::size_t mark = placeholders.mark();
+    for (auto const& ins : pat.program) {
+        expression const& next = *stack[--size];
+        switch (ins.code) {
+            case match_opcode::operation: {
+                if (!std::holds_alternative<op>(next) || std::get<op>(next).type != ins.type) {
+                    placeholders.undo(mark);
+                    return false;
+                }
+                op const& next_op = std::get<op>(next);
+                stack[size++] = &*next_op.rhs;
+                stack[size++] = &*next_op.lhs;
+                break;
+            }
+            case match_opcode::exact:
+                if (next != ins.expr) {
+                    placeholders.undo(mark);
+                    return false;
+                }
+                break;
+            case match_opcode::bind:
+                placeholders.bind(ins.ph, next);
+                break;
+            case match_opcode::compare:
+                if (next != placeholders[ins.ph]) {
+                    placeholders.undo(mark);
+                    return false;
+                }
+                break;
+        }
+    }
+
+    assert(size == 0);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+expression apply_transform_r(expression const& source, expression const& target, bindings const& placeholders)
+{
+    // replace placeholders
+    if (std::holds_alternative<placeholder>(target)) {
+        return placeholders[std::get<placeholder>(target)];
+    } else if (std::holds_alternative<op>(target)) {
+        op const& target_op = std::get<op>(target);
+        return op{target_op.type, apply_transform_r(source, target_op.lhs, placeholders),
+                                  apply_transform_r(source, target_op.rhs, placeholders)};
+    } else {
+        return target;
+    }
+}
+
+//------------------------------------------------------------------------------
+transform_index::key::key(expression const& expr)
+    : kind(expr.index())
+    , type(0)
+    , val(0)
+{
+    if (std::holds_alternative<op>(expr)) {
+        type = static_cast<int>(std::get<op>(expr).type);
+    } else if (std::holds_alternative<constant>(expr)) {
+        type = static_cast<int>(std::get<constant>(expr));
+    } else if (std::holds_alternative<value>(expr)) {
+        val = std::get<value>(expr);
+    }
+}
+
+//------------------------------------------------------------------------------
+bool transform_index::key::operator==(key const& other) const
+{
+    return kind == other.kind && type == other.type && val == other.val;
+}
+
+//------------------------------------------------------------------------------
+transform_index::transform_index()
+    : _nodes(1)
+{}
+
+//------------------------------------------------------------------------------
+void transform_index::insert(expression const& pattern, transform_ref ref)
+{
+    std::size_t node_index = insert_r(0, pattern);
+    _nodes[node_index].refs.push_back(ref);
+    _refs.push_back(ref);
+}
+
+//------------------------------------------------------------------------------
+std::size_t transform_index::insert_r(std::size_t node_index, expression const& pattern)
+{
+    // placeholders match any subexpression
+    if (std::holds_alternative<placeholder>(pattern)) {
+        if (_nodes[node_index].wildcard == npos) {
+            _nodes[node_index].wildcard = _nodes.size();
+            _nodes.emplace_back();
+        }
+        return _nodes[node_index].wildcard;
+    }
+
+    key k(pattern);
+    std::size_t child_index = npos;
+    for (auto const& edge : _nodes[node_index].children) {
+        if (edge.first == k) {
+            child_index = edge.second;
+            break;
+        }
+    }
+
+    if (child_index == npos) {
+        child_index = _nodes.size();
+        _nodes[node_index].children.emplace_back(k, child_index);
+        _nodes.emplace_back();
+    }
+
+    // operands follow the operator in preorder
+    if (std::holds_alternative<op>(pattern)) {
+        op const& pattern_op = std::get<op>(pattern);
+        child_index = insert_r(child_index, pattern_op.lhs);
+        child_index = insert_r(child_index, pattern_op.rhs);
+    }
+
+    return child_index;
+}
+
+//------------------------------------------------------------------------------
+void transform_index::retrieve(expression const& expr, std::vector<transform_ref>& refs) const
+{
+    // placeholders in the query can match any subpattern, which the index
+    // does not support, so return everything instead
+    if (placeholder_mask(expr)) {
+        refs.insert(refs.end(), _refs.begin(), _refs.end());
+        return;
+    }
+
+    std::vector<expression const*> pending{&expr};
+    retrieve_r(0, pending, refs);
+}
+
+//------------------------------------------------------------------------------
+void transform_index::retrieve_r(std::size_t node_index, std::vector<expression const*>& pending, std::vector<transform_ref>& refs) const
+{
+    node const& n = _nodes[node_index];
+
+    // query has been consumed so all patterns at this node are candidates
+    if (!pending.size()) {
+        refs.insert(refs.end(), n.refs.begin(), n.refs.end());
+        return;
+    }
+
+    expression const* expr = pending.back();
+    pending.pop_back();
+
+    // placeholders consume the entire subexpression
+    if (n.wildcard != npos) {
+        retrieve_r(n.wildcard, pending, refs);
+    }
+
+    key k(*expr);
+    for (auto const& edge : n.children) {
+        if (edge.first == k) {
+            if (std::holds_alternative<op>(*expr)) {
+                op const& expr_op = std::get<op>(*expr);
+                pending.push_back(&*expr_op.rhs);
+                pending.push_back(&*expr_op.lhs);
+                retrieve_r(edge.second, pending, refs);
+                pending.resize(pending.size() - 2);
+            } else {
+                retrieve_r(edge.second, pending, refs);
+            }
+            break;
+        }
+    }
+
+    pending.push_back(expr);
+}
+
+//------------------------------------------------------------------------------
+//! fold the subexpressions of a pattern which have no placeholders, so
+//! numbers in rules have the form subjects are folded to, e.g. `2pi`
+expression fold_constants(expression const& expr)
+{
+    if (!std::holds_alternative<op>(expr)) {
+        return expr;
+    } else if (!placeholder_mask(expr)) {
+        return fold(expr);
+    }
+    op const& expr_op = std::get<op>(expr);
+    return op{expr_op.type, fold_constants(expr_op.lhs), fold_constants(expr_op.rhs)};
+}
+
+//------------------------------------------------------------------------------
+bool resolve_transforms()
+{
+    // rules are parsed at compile time so only interning remains, and the
+    // initialization of function-local statics is thread-safe
+    static bool const resolved = []() {
+        for (std::size_t ii = 0; ii < rules::rule_count; ++ii) {
+            transforms.push_back({
+                fold_constants(canonical(rules::build(rules::builtin.source[ii]))),
+                fold_constants(canonical(rules::build(rules::builtin.target[ii]))),
+                rules::builtin.oriented[ii]});
+        }
+
+        for (std::size_t ii = 0; ii < transforms.size(); ++ii) {
+            if (transforms[ii].permutation) {
+                continue;
+            }
+            if (transforms[ii].forward) {
+                transforms_index.insert(transforms[ii].source.expr, {ii, false});
+            }
+            if (transforms[ii].reverse) {
+                transforms_index.insert(transforms[ii].target.expr, {ii, true});
+            }
+            if (transforms[ii].reducing) {
+                reductions_index.insert(transforms[ii].source.expr, {ii, false});
+            }
+        }
+
+        return true;
+    }();
+
+    return resolved;
+}
+
+//------------------------------------------------------------------------------
+bool rewritable(op_type type)
+{
+    // a source which is a bare placeholder keeps its subject intact beneath
+    // the identity it adds, which only the inverse transform can remove again
+    static std::array<bool, op_type_count> const types = []() {
+        resolve_transforms();
+
+        std::array<bool, op_type_count> out{};
+        for (auto const& tr : transforms) {
+            if (tr.forward && std::holds_alternative<op>(tr.source.expr)) {
+                out[static_cast<std::size_t>(std::get<op>(tr.source.expr).type)] = true;
+            }
+            if (tr.reverse && std::holds_alternative<op>(tr.target.expr)) {
+                out[static_cast<std::size_t>(std::get<op>(tr.target.expr).type)] = true;
+            }
+        }
+
+        // folded by `for_each_rewrite` when both operands are values
+        for (op_type folded : {op_type::sum, op_type::difference, op_type::product, op_type::quotient, op_type::exponent}) {
+            out[static_cast<std::size_t>(folded)] = true;
+        }
+        return out;
+    }();
+
+    return types[static_cast<std::size_t>(type)];
+}
+
+//------------------------------------------------------------------------------
+std::uint32_t pattern_arities(op_type type)
+{
+    static std::array<std::uint32_t, op_type_count> const arities = []() {
+        resolve_transforms();
+
+        std::array<std::uint32_t, op_type_count> out{};
+        auto insert = [&out](expression const& expr) {
+            if (std::holds_alternative<op>(expr) && associative(std::get<op>(expr).type)) {
+                op_type const type = std::get<op>(expr).type;
+                std::size_t const terms = term_count(type, expr);
+                if (terms > 2 && terms < 32) {
+                    out[static_cast<std::size_t>(type)] |= std::uint32_t(1) << terms;
+                }
+            }
+        };
+        for (auto const& tr : transforms) {
+            if (tr.permutation) {
+                continue;
+            }
+            if (tr.forward) {
+                insert(tr.source.expr);
+            }
+            if (tr.reverse) {
+                insert(tr.target.expr);
+            }
+        }
+        return out;
+    }();
+
+    return arities[static_cast<std::size_t>(type)];
+}
+
+} // namespace algebra
@@ -0,0 +1,223 @@
+// transform.h
+//
+
+#pragma once
+#include "expression.h"
+
+#include <array>
+#include <cassert>
+#include <vector>
+
+namespace algebra {
+
+//------------------------------------------------------------------------------
+//! number of pending subexpressions while matching a pattern which are kept on
+//! the stack, deeper patterns allocate
+constexpr std::size_t max_pattern_stack = 32;
+
+//------------------------------------------------------------------------------
+//! instructions of a flattened match program
+enum class match_opcode
+{
+    operation,      //!< subject is an op of `type`, operands are matched next
+    exact,          //!< subject is equal to `expr`, which has no placeholders
+    bind,           //!< bind subject to the unbound placeholder `ph`
+    compare,        //!< subject is equal to the value bound to `ph`
+};
+
+//------------------------------------------------------------------------------
+struct match_instruction
+{
+    match_opcode code;
+    op_type type;
+    placeholder ph;
+    expression expr;
+};
+
+//------------------------------------------------------------------------------
+//! pattern compiled into a linear sequence of match instructions
+//!
+//! Instructions consume subexpressions of the subject in preorder, so matching
+//! is a single loop over `program` with a stack of operands, which is only
+//! allocated if `stack_size` exceeds `max_pattern_stack`.
+struct pattern
+{
+    pattern(expression const& expr);
+
+    expression expr;
+    std::uint32_t placeholders; //!< bitmask of placeholders in `expr`
+    std::size_t stack_size;     //!< maximum number of pending subexpressions
+    std::vector<match_instruction> program;
+
+protected:
+    void compile_r(expression const& expr, std::uint32_t& bound, std::size_t& pending);
+};
+
+//------------------------------------------------------------------------------
+//! transformation pattern for simplifying expressions
+struct transform
+{
+    transform(expression const& source, expression const& target, bool oriented = false);
+
+    pattern source;
+    pattern target;
+    bool forward;   //!< every placeholder in `target` is bound by `source`
+    //! every placeholder in `source` is bound by `target` and the transform
+    //! is not oriented
+    bool reverse;
+    bool oriented;  //!< only applied from `source` to `target`
+    //! oriented, forward and `target` has fewer operations than `source`, so
+    //! it is applied by `normalize`
+    bool reducing;
+    //! `source` and `target` are the same sum or product up to the order and
+    //! grouping of terms, e.g. commutativity. Only applied by the e-graph,
+    //! `for_each_rewrite` matches modulo order instead.
+    bool permutation;
+};
+
+//------------------------------------------------------------------------------
+//! reference to a transform applied in one direction
+struct transform_ref
+{
+    std::size_t index;  //!< index into `transforms`
+    bool reverse;       //!< match `target` and substitute `source`
+};
+
+//------------------------------------------------------------------------------
+//! discrimination tree over transform patterns
+//!
+//! Patterns are stored by their preorder traversal with placeholders acting as
+//! wildcards, so retrieval only visits branches consistent with the shape of
+//! the query. Retrieved patterns are candidates which must still be verified
+//! with `match`, e.g. non-linear patterns like `x + (-x)` are not filtered.
+class transform_index
+{
+public:
+    transform_index();
+
+    //! add a pattern to the index
+    void insert(expression const& pattern, transform_ref ref);
+    //! append all references whose pattern could match `expr`
+    void retrieve(expression const& expr, std::vector<transform_ref>& refs) const;
+
+protected:
+    //! preorder symbol of an expression node, placeholders are not keyed
+    struct key
+    {
+        std::size_t kind;   //!< variant index
+        int type;           //!< op_type or constant
+        value val;          //!< scalar value
+
+        key(expression const& expr);
+        bool operator==(key const& other) const;
+    };
+
+    static constexpr std::size_t npos = SIZE_MAX;
+
+    struct node
+    {
+        std::vector<std::pair<key, std::size_t>> children;
+        std::size_t wildcard = npos;
+        std::vector<transform_ref> refs;
+    };
+
+    std::vector<node> _nodes;
+    //! every inserted reference, for queries containing placeholders
+    std::vector<transform_ref> _refs;
+
+protected:
+    std::size_t insert_r(std::size_t node_index, expression const& pattern);
+    void retrieve_r(std::size_t node_index, std::vector<expression const*>& pending, std::vector<transform_ref>& refs) const;
+};
+
+//------------------------------------------------------------------------------
+//! fixed-size frame of placeholder bindings
+//!
+//! Bound values are referenced rather than copied so binding never allocates.
+//! Bindings are recorded on an undo trail so that a failed match can restore
+//! the frame to an earlier state with `undo`.
+class bindings
+{
+public:
+    bindings()
+        : _mask(0)
+        , _trail_size(0)
+    {}
+
+    //! bitmask of bound placeholders
+    std::uint32_t mask() const { return _mask; }
+    //! return true if the placeholder has been bound
+    bool bound(placeholder ph) const { return _mask & bit(ph); }
+    //! return the value bound to the placeholder
+    expression const& operator[](placeholder ph) const
+    {
+        assert(bound(ph));
+        return *_values[static_cast<int>(ph)];
+    }
+    //! bind an unbound placeholder, `expr` must outlive the binding
+    void bind(placeholder ph, expression const& expr)
+    {
+        assert(!bound(ph));
+        _mask |= bit(ph);
+        _values[static_cast<int>(ph)] = &expr;
+        _trail[_trail_size++] = ph;
+    }
+    //! return the current position of the undo trail
+    std::size_t mark() const { return _trail_size; }
+    //! unbind all placeholders bound since `mark` was returned
+    void undo(std::size_t mark)
+    {
+        while (_trail_size > mark) {
+            _mask &= ~bit(_trail[--_trail_size]);
+        }
+    }
+
+protected:
+    std::uint32_t _mask;
+    std::array<expression const*, placeholder_count> _values;
+    std::array<placeholder, placeholder_count> _trail;
+    std::size_t _trail_size;
+
+protected:
+    static std::uint32_t bit(placeholder ph) { return 1u << static_cast<int>(ph); }
+};
+
+//------------------------------------------------------------------------------
+//! unify two expressions, either of which may contain placeholders, leaves
+//! `placeholders` unchanged on failure
+bool match(expression const& lhs, expression const& rhs, bindings& placeholders);
+
+//------------------------------------------------------------------------------
+//! match an expression without placeholders against a compiled pattern,
+//! leaves `placeholders` unchanged on failure
+bool match(pattern const& pat, expression const& expr, bindings& placeholders);
+
+//------------------------------------------------------------------------------
+//! substitute bound placeholders into `target`
+expression apply_transform_r(expression const& source, expression const& target, bindings const& placeholders);
+
+//------------------------------------------------------------------------------
+//! built-in transforms, valid after calling `resolve_transforms`
+extern std::vector<transform> transforms;
+//! index over the source and target patterns of `transforms`, except those
+//! which are `permutation`s
+extern transform_index transforms_index;
+//! index over the source patterns of `reducing` transforms
+extern transform_index reductions_index;
+
+//------------------------------------------------------------------------------
+//! parse built-in transforms and build their index
+bool resolve_transforms();
+
+//------------------------------------------------------------------------------
+//! return true if some built-in transform can rewrite an op of `type` at the
+//! root, excluding those which only wrap their subject, e.g. `x => x + 0`
+bool rewritable(op_type type);
+
+//------------------------------------------------------------------------------
+//! bitmask of the numbers of terms, three or more, of the indexed patterns
+//! which are sums or products of `type`. `for_each_rewrite` matches those
+//! against as many terms of a subject, pairs are always tried.
+std::uint32_t pattern_arities(op_type type);
+
+} // namespace algebra
@@ -0,0 +1,355 @@
+// vecmath.cpp
+//
+
+#include "vecmath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace algebra {
+namespace vecmath {
+
+//------------------------------------------------------------------------------
+//  The helpers below avoid calls to <cmath> and conversions between integers
+//  and doubles, which most instruction sets can't vectorize without extensions
+
+//! adding and subtracting this rounds to the nearest integer for |x| < 2^51
+constexpr double round_magic = 6755399441055744.0;
+
+//------------------------------------------------------------------------------
+inline std::uint64_t bits(double x)
+{
+    std::uint64_t out;
+    std::memcpy(&out, &x, sizeof(out));
+    return out;
+}
+
+//------------------------------------------------------------------------------
+inline double from_bits(std::uint64_t x)
+{
+    double out;
+    std::memcpy(&out, &x, sizeof(out));
+    return out;
+}
+
+//------------------------------------------------------------------------------
+inline double round_nearest(double x)
+{
+    return (x + round_magic) - round_magic;
+}
+
+//------------------------------------------------------------------------------
+//! integer `x` for |x| < 2^51 in two's complement
+inline std::uint64_t to_integer(double x)
+{
+    return bits(x + round_magic) - bits(round_magic);
+}
+
+//------------------------------------------------------------------------------
+//! integer `x` for |x| < 2^51 in two's complement, as a double
+inline double from_integer(std::uint64_t x)
+{
+    return from_bits(x + bits(round_magic)) - round_magic;
+}
+
+//------------------------------------------------------------------------------
+//! `a` where `mask` is set and `b` elsewhere, `mask` is all ones or zero
+inline double select(std::uint64_t mask, double a, double b)
+{
+    return from_bits((bits(a) & mask) | (bits(b) & ~mask));
+}
+
+//------------------------------------------------------------------------------
+//! negate `x` if the low bit of `sign` is set
+inline double flip_sign(double x, std::uint64_t sign)
+{
+    return from_bits(bits(x) ^ (sign << 63));
+}
+
+//------------------------------------------------------------------------------
+//! inputs are processed in chunks which are copied first so that the exact
+//! functions can be applied to inputs that were overwritten in place
+constexpr std::size_t chunk_size = 256;
+
+//------------------------------------------------------------------------------
+//! apply `approx` to each input and then `exact` to those outside `domain`
+template<typename Approx, typename Domain, typename Exact>
+inline void map(double const* x, double* out, std::size_t n, Approx approx, Domain domain, Exact exact)
+{
+    double in[chunk_size];
+    for (std::size_t base = 0; base < n; base += chunk_size) {
+        std::size_t const count = std::min(chunk_size, n - base);
+        std::copy(x + base, x + base + count, in);
+        double* o = out + base;
+
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            o[ii] = approx(in[ii]);
+        }
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            if (!domain(in[ii])) {
+                o[ii] = exact(in[ii]);
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//! 2^n for an integral `n` in the range of normal exponents, other values
+//! give meaningless results but are well defined
+inline double exp2_int(double n)
+{
+    return from_bits((to_integer(n) + 1023) << 52);
+}
+
+//------------------------------------------------------------------------------
+template<std::size_t N> inline double polevl(double x, double const (&c)[N])
+{
+    double y = c[0];
+    for (std::size_t ii = 1; ii < N; ++ii) {
+        y = y * x + c[ii];
+    }
+    return y;
+}
+
+//------------------------------------------------------------------------------
+//! polynomial with an implicit leading coefficient of one
+template<std::size_t N> inline double p1evl(double x, double const (&c)[N])
+{
+    double y = x + c[0];
+    for (std::size_t ii = 1; ii < N; ++ii) {
+        y = y * x + c[ii];
+    }
+    return y;
+}
+
+//------------------------------------------------------------------------------
+constexpr double sin_coefficients[] = {
+     1.58962301576546568060E-10,
+    -2.50507477628578072866E-8,
+     2.75573136213857245213E-6,
+    -1.98412698295895385996E-4,
+     8.33333333332211858878E-3,
+    -1.66666666666666307295E-1,
+};
+
+constexpr double cos_coefficients[] = {
+    -1.13585365213876817300E-11,
+     2.08757008419747316778E-9,
+    -2.75573141792967388112E-7,
+     2.48015872888517045348E-5,
+    -1.38888888888730564116E-3,
+     4.16666666666665929218E-2,
+};
+
+//! pi/2 split into three parts for extended precision range reduction
+constexpr double pio2_1 = 2 * 7.85398125648498535156E-1;
+constexpr double pio2_2 = 2 * 3.77489470793079817668E-8;
+constexpr double pio2_3 = 2 * 2.69515142907905952645E-15;
+
+constexpr double sincos_limit = 134217728.0;
+
+//------------------------------------------------------------------------------
+//! reduce |x| to [-pi/4, pi/4] and evaluate both polynomials on the remainder,
+//! |x| is the remainder plus `quadrant` times pi/2
+inline void sincos_reduced(double x, double& s, double& c, std::uint64_t& quadrant)
+{
+    double ax = std::fabs(x);
+    double q = round_nearest(ax * 6.36619772367581343076E-1);
+    double z = ((ax - q * pio2_1) - q * pio2_2) - q * pio2_3;
+    double zz = z * z;
+    s = z + z * zz * polevl(zz, sin_coefficients);
+    c = 1.0 - 0.5 * zz + zz * zz * polevl(zz, cos_coefficients);
+    quadrant = to_integer(q);
+}
+
+//------------------------------------------------------------------------------
+//  sin(z + q pi/2) is s, c, -s, -c and cos(z + q pi/2) is c, -s, -c, s for
+//  quadrants q = 0, 1, 2, 3, and sine is odd
+
+//------------------------------------------------------------------------------
+inline double sin_reduced(double x)
+{
+    double s, c;
+    std::uint64_t q;
+    sincos_reduced(x, s, c, q);
+    return flip_sign(select(0 - (q & 1), c, s), (q >> 1) ^ (bits(x) >> 63));
+}
+
+//------------------------------------------------------------------------------
+inline double cos_reduced(double x)
+{
+    double s, c;
+    std::uint64_t q;
+    sincos_reduced(x, s, c, q);
+    return flip_sign(select(0 - (q & 1), s, c), (q + 1) >> 1);
+}
+
+//------------------------------------------------------------------------------
+inline bool sincos_domain(double x)
+{
+    return std::fabs(x) < sincos_limit;
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void sincos(double const* x, double* sin_out, double* cos_out, std::size_t n)
+{
+    double in[chunk_size];
+    for (std::size_t base = 0; base < n; base += chunk_size) {
+        std::size_t const count = std::min(chunk_size, n - base);
+        std::copy(x + base, x + base + count, in);
+        double* so = sin_out + base;
+        double* co = cos_out + base;
+
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            double s, c;
+            std::uint64_t q;
+            sincos_reduced(in[ii], s, c, q);
+
+            std::uint64_t swap = 0 - (q & 1);
+            so[ii] = flip_sign(select(swap, c, s), (q >> 1) ^ (bits(in[ii]) >> 63));
+            co[ii] = flip_sign(select(swap, s, c), (q + 1) >> 1);
+        }
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            if (!sincos_domain(in[ii])) {
+                so[ii] = std::sin(in[ii]);
+                co[ii] = std::cos(in[ii]);
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void sin(double const* x, double* out, std::size_t n)
+{
+    map(x, out, n, sin_reduced, sincos_domain, [](double xi) { return std::sin(xi); });
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void cos(double const* x, double* out, std::size_t n)
+{
+    map(x, out, n, cos_reduced, sincos_domain, [](double xi) { return std::cos(xi); });
+}
+
+//------------------------------------------------------------------------------
+constexpr double exp_p[] = {
+    1.26177193074810590878E-4,
+    3.02994407707441961300E-2,
+    9.99999999999999999910E-1,
+};
+
+constexpr double exp_q[] = {
+    3.00198505138664455042E-6,
+    2.52448340349684104192E-3,
+    2.27265548208155028766E-1,
+    2.00000000000000000009E0,
+};
+
+//------------------------------------------------------------------------------
+inline double exp_reduced(double x)
+{
+    // exp(x) = 2^n exp(r) with |r| <= ln(2)/2
+    double n = round_nearest(x * 1.4426950408889634073599);
+    double r = x - n * 6.93145751953125E-1;
+    r = r - n * 1.42860682030941723212E-6;
+
+    double rr = r * r;
+    double p = r * polevl(rr, exp_p);
+    double e = 1.0 + 2.0 * (p / (polevl(rr, exp_q) - p));
+    return e * exp2_int(n);
+}
+
+//------------------------------------------------------------------------------
+inline bool exp_domain(double x)
+{
+    return x > -708.0 && x < 709.0;
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void exp(double const* x, double* out, std::size_t n)
+{
+    map(x, out, n, exp_reduced, exp_domain, [](double xi) { return std::exp(xi); });
+}
+
+//------------------------------------------------------------------------------
+constexpr double log_even[] = {
+    1.479819860511658591e-01,
+    1.818357216161805012e-01,
+    2.857142874366239149e-01,
+    6.666666666666735130e-01,
+};
+
+constexpr double log_odd[] = {
+    1.531383769920937332e-01,
+    2.222219843214978396e-01,
+    3.999999999940941908e-01,
+};
+
+//------------------------------------------------------------------------------
+//! true if `x` is positive, finite and normal
+inline bool log_domain(double x)
+{
+    return x >= 2.2250738585072014e-308 && x <= 1.7976931348623157e308;
+}
+
+//------------------------------------------------------------------------------
+inline double log_reduced(double x)
+{
+    // x = 2^k z with sqrt(1/2) <= z < sqrt(2), found by offsetting the bits of
+    // x by those of sqrt(1/2) so the exponent field rounds at the boundary
+    std::uint64_t ix = bits(x);
+    std::uint64_t tmp = ix - 0x3fe6a09e667f3bcdull;
+    double k = from_integer(std::uint64_t(std::int64_t(tmp) >> 52));
+    double z = from_bits(ix - (tmp & 0xfff0000000000000ull));
+
+    // log(z) = 2 atanh(f / (2 + f)) with f = z - 1, which is a series in s^2
+    // whose tail is a minimax polynomial (fdlibm)
+    double f = z - 1.0;
+    double s = f / (2.0 + f);
+    double ss = s * s;
+    double ssss = ss * ss;
+    double r = ss * polevl(ssss, log_even) + ssss * polevl(ssss, log_odd);
+    double hfsq = 0.5 * f * f;
+    return k * 6.93147180369123816490e-01 - ((hfsq - (s * (hfsq + r) + k * 1.90821492927058770002e-10)) - f);
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void log(double const* x, double* out, std::size_t n)
+{
+    map(x, out, n, log_reduced, log_domain, [](double xi) { return std::log(xi); });
+}
+
+//------------------------------------------------------------------------------
+VECMATH_TARGETS
+void pow(double const* x, double const* y, double* out, std::size_t n)
+{
+    double xin[chunk_size];
+    double yin[chunk_size];
+    double t[chunk_size];
+    for (std::size_t base = 0; base < n; base += chunk_size) {
+        std::size_t const count = std::min(chunk_size, n - base);
+        std::copy(x + base, x + base + count, xin);
+        std::copy(y + base, y + base + count, yin);
+        double* o = out + base;
+
+        // exp(y log(x)), the exponent is kept so that it can be range checked
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            t[ii] = yin[ii] * log_reduced(xin[ii]);
+            o[ii] = exp_reduced(t[ii]);
+        }
+        for (std::size_t ii = 0; ii < count; ++ii) {
+            if (!log_domain(xin[ii]) || !exp_domain(t[ii])) {
+                o[ii] = std::pow(xin[ii], yin[ii]);
+            }
+        }
+    }
+}
+
+} // namespace vecmath
+} // namespace algebra
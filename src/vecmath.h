@@ -0,0 +1,47 @@
+// vecmath.h
+//
+
+#pragma once
+#include <cstddef>
+
+namespace algebra {
+namespace vecmath {
+
+//------------------------------------------------------------------------------
+//  Elementwise approximations of transcendental functions over arrays
+//
+//  Each function is a branch-free loop over `n` contiguous values so compilers
+//  can vectorize it for the target instruction set, followed by a scalar pass
+//  which defers to <cmath> for the few inputs outside the reduced range. `out`
+//  may alias an input. Polynomials are from Cephes (sin, cos, exp) and fdlibm
+//  (log), and the bounds below were measured against glibc over uniformly
+//  distributed inputs:
+//
+//      sin, cos    2 ulp for |x| < 2^27, <cmath> otherwise
+//      exp         2 ulp for -708 < x < 709, <cmath> otherwise
+//      log         1 ulp for positive normal x, <cmath> otherwise
+//      pow         exp(y log(x)) for positive normal x, about
+//                  (2 |y log(x)| + 2) ulp since the errors of the logarithm
+//                  and the product are scaled by exp, <cmath> otherwise
+//
+//  On x86-64 with GCC each function is also compiled for AVX2 and AVX-512 and
+//  the variant is chosen at load time, other targets are vectorized for the
+//  instruction set they are compiled for, e.g. NEON on AArch64.
+//
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#   define VECMATH_TARGETS __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#   define VECMATH_TARGETS
+#endif
+
+void sin(double const* x, double* out, std::size_t n);
+void cos(double const* x, double* out, std::size_t n);
+//! sine and cosine of `x` with a single range reduction
+void sincos(double const* x, double* sin_out, double* cos_out, std::size_t n);
+void exp(double const* x, double* out, std::size_t n);
+void log(double const* x, double* out, std::size_t n);
+void pow(double const* x, double const* y, double* out, std::size_t n);
+
+} // namespace vecmath
+} // namespace algebra
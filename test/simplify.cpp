@@ -1,21 +1,221 @@
 // simplify.cpp
 //
 
+#include "batch.h"
 #include "expression.h"
 #include "parser.h"
+#include "persistent_cache.h"
+#include "simplify_context.h"
+#include "transform.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 
 //------------------------------------------------------------------------------
-int main()
+//! print a marker under the offending token of the line above
+void print_error(algebra::parser::parse_error const& err, std::ostream& out)
 {
+    out << std::string(err.offset, ' ') << std::string(err.length ? err.length : 1, '^')
+        << ' ' << err.message << std::endl;
+}
+
+//------------------------------------------------------------------------------
+//! parse `line`, printing a marker under the offending token if it is invalid
+algebra::expression parse(algebra::parser::context& context, std::string const& line)
+{
+    algebra::expression expr = context.parse(line);
+    if (!context.valid()) {
+        print_error(context.error(), std::cout);
+    }
+    return expr;
+}
+
+//------------------------------------------------------------------------------
+//! print counters for a call to `simplify` and the rules which matched least
+//! often relative to how often they were tried
+void print_statistics(algebra::simplify_statistics const& stats)
+{
+    auto const& rw = stats.rewrites;
+    std::fprintf(stderr, "reduced %zu, expanded %zu, generated %zu, frontier peak %zu, closed %zu, pruned %zu, forgotten %zu, "
+                         "search memory %zu KiB, interned %zu KiB, memo %zu/%zu, "
+                         "match %.3f ms, rewrite %.3f ms, total %.3f ms%s%s\n",
+        stats.reductions, stats.expanded, stats.generated, stats.frontier_peak, stats.closed,
+        stats.pruned, stats.forgotten, stats.peak_memory / 1024, stats.interned_bytes / 1024,
+        rw.memo_hits, rw.memo_hits + rw.memo_misses,
+        rw.match_seconds * 1e3, rw.rewrite_seconds * 1e3, stats.seconds * 1e3,
+        stats.cached ? " (cached)" : "",
+        stats.status == algebra::simplify_status::deadline ? " (deadline)"
+            : stats.status == algebra::simplify_status::iterations ? " (iterations)" : "");
+
+    std::vector<std::size_t> rules;
+    for (std::size_t ii = 0; ii < rw.attempts.size(); ++ii) {
+        if (rw.attempts[ii]) {
+            rules.push_back(ii);
+        }
+    }
+    std::sort(rules.begin(), rules.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return rw.attempts[lhs] - rw.matches[lhs] > rw.attempts[rhs] - rw.matches[rhs];
+    });
+    for (std::size_t ii = 0; ii < rules.size() && ii < 5; ++ii) {
+        algebra::transform const& tr = algebra::transforms[rules[ii]];
+        std::fprintf(stderr, "    %6zu/%-6zu %s => %s\n", rw.matches[rules[ii]], rw.attempts[rules[ii]],
+            algebra::to_string(tr.source.expr).c_str(), algebra::to_string(tr.target.expr).c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+//! parse a non-negative integer argument, returns false if `text` is not one
+bool parse_count(char const* text, long& out)
+{
+    if (!text || !std::isdigit(static_cast<unsigned char>(*text))) {
+        return false;
+    }
+    char* end = nullptr;
+    out = std::strtol(text, &end, 10);
+    return !*end;
+}
+
+//------------------------------------------------------------------------------
+//! simplify every line of stdin on a pool of workers, printing results in order
+int batch(algebra::simplify_options const& simplify_options, std::size_t workers)
+{
+    std::ios::sync_with_stdio(false);
+
+    algebra::batch_options options;
+    options.simplify = simplify_options;
+    options.workers = workers;
+
+    algebra::parser::context context;
+    algebra::simplify_batch(
+        [&context](algebra::expression& expr) {
+            std::string line;
+            if (!std::getline(std::cin, line)) {
+                return false;
+            }
+            expr = line.size() ? context.parse(line) : algebra::expression{};
+            // the writer owns stdout, errors go to stderr after the line
+            // they refer to
+            if (line.size() && !context.valid()) {
+                std::cerr << line << '\n';
+                print_error(context.error(), std::cerr);
+            }
+            return true;
+        },
+        [](algebra::expression const& expr) {
+            std::cout << algebra::to_string(expr) << '\n';
+        },
+        options);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    char const* const usage =
+        "usage: simplify [--egraph] [--stats] [--incremental] [--timeout ms] [--beam width] [--memory bytes]\n"
+        "                [--cache file] [--batch [workers]]";
+    algebra::simplify_options options;
+    options.max_operations = 32;
+    options.max_iterations = 256;
+    options.trace = true;
+
+    bool stats = false;
+    // lines are simplified with one context which reuses earlier subterms
+    bool incremental = false;
+    // each line is given this long, measured from when it is read
+    long timeout = 0;
+    // results are loaded at startup and saved with any new ones on exit
+    char const* results_path = nullptr;
+    // simplify lines on a pool of workers, zero uses one per hardware thread
+    bool batched = false;
+    long workers = 0;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        char const* flag = argv[arg];
+        char const* value = arg + 1 < argc ? argv[arg + 1] : nullptr;
+        long count = 0;
+        if (std::strcmp(flag, "--egraph") == 0) {
+            options.engine = algebra::simplify_engine::egraph;
+        } else if (std::strcmp(flag, "--stats") == 0) {
+            stats = true;
+        } else if (std::strcmp(flag, "--incremental") == 0) {
+            incremental = true;
+        } else if (std::strcmp(flag, "--timeout") == 0 && parse_count(value, timeout)) {
+            ++arg;
+        } else if (std::strcmp(flag, "--beam") == 0 && parse_count(value, count)) {
+            // bound the frontier and the memory of each search
+            options.beam_width = std::size_t(count);
+            ++arg;
+        } else if (std::strcmp(flag, "--memory") == 0 && parse_count(value, count)) {
+            options.max_memory = std::size_t(count);
+            ++arg;
+        } else if (std::strcmp(flag, "--cache") == 0 && value) {
+            results_path = value;
+            ++arg;
+        } else if (std::strcmp(flag, "--batch") == 0) {
+            batched = true;
+            // the number of workers is optional
+            if (parse_count(value, workers)) {
+                ++arg;
+            }
+        } else {
+            std::cerr << "unknown or incomplete argument " << flag << '\n' << usage << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<algebra::persistent_cache> results;
+    if (results_path) {
+        results = std::make_unique<algebra::persistent_cache>(results_path);
+        if (!results->valid()) {
+            std::cerr << results->error() << std::endl;
+            return 1;
+        }
+        options.results = results.get();
+    }
+    auto save = [&]() {
+        if (results && !results->save(results_path)) {
+            std::cerr << results->error() << std::endl;
+            return 1;
+        }
+        return 0;
+    };
+
+    if (batched) {
+        batch(options, std::size_t(workers));
+        return save();
+    }
+
+    algebra::parser::context context;
+    algebra::simplify_context incremental_context(options);
     while (true) {
         std::string line; std::getline(std::cin, line);
         if (line == "") {
-            return 0;
+            if (incremental) {
+                std::fprintf(stderr, "searched %zu, reused %zu\n", incremental_context.searched(), incremental_context.reused());
+            }
+            return save();
         }
 
-        algebra::simplify(algebra::parse(line.c_str()), 32, 256);
+        if (timeout) {
+            options.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+            incremental_context.options().deadline = options.deadline;
+        }
+        if (incremental) {
+            incremental_context.simplify(parse(context, line));
+        } else if (stats) {
+            algebra::simplify_statistics statistics;
+            algebra::simplify(parse(context, line), options, statistics);
+            print_statistics(statistics);
+        } else {
+            algebra::simplify(parse(context, line), options);
+        }
     }
 }
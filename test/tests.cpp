@@ -0,0 +1,524 @@
+// tests.cpp
+//
+
+#include "differentiate.h"
+#include "evaluate.h"
+#include "expression.h"
+#include "parser.h"
+#include "persistent_cache.h"
+#include "serialize.h"
+#include "transform.h"
+#include "vecmath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/resource.h>)
+#   include <sys/resource.h>
+#   define TESTS_HAVE_RUSAGE 1
+#else
+#   define TESTS_HAVE_RUSAGE 0
+#endif
+
+//------------------------------------------------------------------------------
+//! number of failed checks, the process fails if any did
+std::size_t failures = 0;
+
+//------------------------------------------------------------------------------
+void check(bool passed, std::string const& what)
+{
+    if (!passed) {
+        std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+//------------------------------------------------------------------------------
+//! reductions and folding alone simplify these, without searching
+void test_normalize()
+{
+    char const* const zero[] = {"y * 0", "0 * y", "x*0*y*z*w", "(x + y) * 0 * z", "0 * (2 + x)"};
+    for (auto text : zero) {
+        algebra::expression expr = algebra::normalize(algebra::parse(text));
+        check(expr == algebra::expression(0.0), std::string("normalize(") + text + ") is " + algebra::to_string(expr));
+    }
+
+    // division by zero is not evaluated in floating point, and zero doesn't
+    // cancel it
+    char const* const undefined[] = {"0 / 0", "1 / 0", "2.5 / 0"};
+    for (auto text : undefined) {
+        algebra::expression expr = algebra::normalize(algebra::parse(text));
+        check(expr == algebra::expression(algebra::constant::undefined), std::string("normalize(") + text + ") is " + algebra::to_string(expr));
+    }
+    algebra::expression cancelled = algebra::normalize(algebra::parse("0 * (1 / 0)"));
+    check(cancelled != algebra::expression(0.0), "normalize(0 * (1 / 0)) is 0");
+
+    // NaN is not equal to itself as a double but is interned once
+    double const nan = std::numeric_limits<double>::quiet_NaN();
+    algebra::expression const x = algebra::symbol("x");
+    std::size_t const interned = ptr<algebra::expression>::interned_count();
+    algebra::expression first = algebra::op{algebra::op_type::sum, algebra::expression(nan), x};
+    algebra::expression second = algebra::op{algebra::op_type::sum, algebra::expression(-nan), x};
+    check(first == second && ptr<algebra::expression>::interned_count() <= interned + 2, "NaN values were interned separately");
+
+    struct
+    {
+        char const* text;
+        char const* normal;
+    } const cases[] = {
+        {"x + 0", "x"},
+        {"1 * x", "x"},
+        {"2 * x * 3", "6 * x"},
+        {"x * y", "x * y"},
+    };
+    for (auto const& c : cases) {
+        algebra::expression expr = algebra::normalize(algebra::parse(c.text));
+        algebra::expression normal = algebra::canonical(algebra::parse(c.normal));
+        check(algebra::canonical(expr) == normal, std::string("normalize(") + c.text + ") is " + algebra::to_string(expr));
+    }
+}
+
+//------------------------------------------------------------------------------
+//! every operation has a printed form
+void test_to_string()
+{
+    algebra::expression const x = algebra::symbol("x");
+    struct
+    {
+        algebra::op_type type;
+        char const* text;
+    } const cases[] = {
+        {algebra::op_type::arcsine, "asin(x)"},
+        {algebra::op_type::arccosine, "acos(x)"},
+        {algebra::op_type::arctangent, "atan(x)"},
+        {algebra::op_type::arcsecant, "asec(x)"},
+        {algebra::op_type::arccosecant, "acsc(x)"},
+        {algebra::op_type::arccotangent, "acot(x)"},
+        {algebra::op_type::derivative, "d/dx(x)"},
+        {algebra::op_type::integral, "int(x, x)"},
+        {algebra::op_type::differential, "d(x)"},
+    };
+    for (auto const& c : cases) {
+        std::string text = algebra::to_string(algebra::op{c.type, x, x});
+        check(text == c.text, "to_string is " + text + ", expected " + c.text);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! improvements are reported as they are found, including by `normalize`
+void test_on_improve()
+{
+    algebra::simplify_options options;
+    options.max_iterations = 16;
+    std::vector<std::string> improvements;
+    options.on_improve = [&](algebra::expression const& expr, double) {
+        improvements.push_back(algebra::to_string(expr));
+    };
+
+    algebra::expression best = algebra::simplify(algebra::parse("x * 0 + y"), options);
+    check(best == algebra::expression(algebra::symbol("y")), "simplify(x * 0 + y) is " + algebra::to_string(best));
+    check(improvements.size() == 1 && improvements[0] == "y", "normalized start was not reported");
+}
+
+//------------------------------------------------------------------------------
+//! saved results are found by later processes, unless the rules differ
+void test_persistent_cache()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "algebra_tests.cache").string();
+    std::filesystem::remove(path);
+
+    algebra::simplify_options options;
+    algebra::expression expr = algebra::parse("x + 0");
+    algebra::expression result = algebra::symbol("x");
+    {
+        algebra::persistent_cache cache(path.c_str());
+        check(cache.valid() && cache.size() == 0, "missing file is not an empty cache");
+        cache.insert(expr, options, result);
+        check(cache.save(path.c_str()), "failed to save cache: " + cache.error());
+    }
+    {
+        algebra::persistent_cache cache(path.c_str());
+        check(cache.valid() && cache.size() == 1, "saved cache is not valid: " + cache.error());
+        check(cache.find(expr, options) == result, "saved result was not found");
+        options.max_iterations += 1;
+        check(std::holds_alternative<algebra::empty>(cache.find(expr, options)), "result was found with other options");
+    }
+    {
+        // offset of the rules fingerprint in the header
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(16);
+        file.put('\xff');
+    }
+    {
+        algebra::persistent_cache cache(path.c_str());
+        check(!cache.valid(), "cache saved with other rules was accepted");
+    }
+    std::filesystem::remove(path);
+}
+
+//------------------------------------------------------------------------------
+//! true if `a` and `b` are within `tolerance` relative to their magnitude
+bool close(double a, double b, double tolerance)
+{
+    return std::abs(a - b) <= tolerance * std::max(1.0, std::max(std::abs(a), std::abs(b)));
+}
+
+//------------------------------------------------------------------------------
+//! expressions with each operation with a numeric derivative, in x and y
+std::vector<algebra::expression> differentiable()
+{
+    algebra::expression const product = algebra::parse("x * y");
+    algebra::expression const sum = algebra::parse("x + y");
+
+    std::vector<algebra::expression> out;
+    for (std::size_t ii = std::size_t(algebra::op_type::sum); ii <= std::size_t(algebra::op_type::arccotangent); ++ii) {
+        algebra::op_type type = algebra::op_type(ii);
+        switch (type) {
+            case algebra::op_type::sum:
+            case algebra::op_type::difference:
+            case algebra::op_type::product:
+            case algebra::op_type::quotient:
+            case algebra::op_type::exponent:
+            case algebra::op_type::logarithm:
+                out.push_back(algebra::op{type, product, sum});
+                break;
+            case algebra::op_type::arcsecant:
+            case algebra::op_type::arccosecant:
+                // outside of (-1, 1)
+                out.push_back(algebra::op{type, sum});
+                break;
+            default:
+                out.push_back(algebra::op{type, product});
+                break;
+        }
+    }
+    out.push_back(algebra::parse("sin(x * y)^2 / (1 + x^y) - ln(x) * cos(y)"));
+    out.push_back(algebra::parse("d/dx(x^3 * y)"));
+    return out;
+}
+
+//------------------------------------------------------------------------------
+//! derivatives agree with finite differences and with reverse mode gradients
+void test_differentiate()
+{
+    algebra::symbol const x("x");
+    algebra::symbol const y("y");
+    double const inputs[2] = {0.7, 1.3};
+    double const h = 1e-6;
+
+    for (auto const& expr : differentiable()) {
+        // programs can't evaluate derivative operations
+        algebra::program f(algebra::eliminate_derivatives(expr), {x, y});
+        algebra::program dx(algebra::differentiate(expr, x), {x, y});
+        algebra::program dy(algebra::differentiate(expr, y), {x, y});
+        check(f.valid() && dx.valid() && dy.valid(), "cannot evaluate derivatives of " + algebra::to_string(expr));
+
+        double const x1[2] = {inputs[0] + h, inputs[1]};
+        double const x0[2] = {inputs[0] - h, inputs[1]};
+        double const y1[2] = {inputs[0], inputs[1] + h};
+        double const y0[2] = {inputs[0], inputs[1] - h};
+        double fx = (f(x1) - f(x0)) / (2 * h);
+        double fy = (f(y1) - f(y0)) / (2 * h);
+        check(close(dx(inputs), fx, 1e-6), "d/dx(" + algebra::to_string(expr) + ") differs from finite differences");
+        check(close(dy(inputs), fy, 1e-6), "d/dy(" + algebra::to_string(expr) + ") differs from finite differences");
+
+        double gradient[2];
+        double v = f.gradient(inputs, gradient);
+        check(close(v, f(inputs), 1e-15), "gradient of " + algebra::to_string(expr) + " evaluates a different value");
+        check(close(gradient[0], dx(inputs), 1e-12) && close(gradient[1], dy(inputs), 1e-12),
+            "gradient of " + algebra::to_string(expr) + " differs from differentiate");
+    }
+}
+
+//------------------------------------------------------------------------------
+//! encoded expressions are decoded unchanged and damaged encodings are rejected
+void test_serialize()
+{
+    std::vector<algebra::expression> roots = differentiable();
+    roots.push_back(algebra::expression(2.5));
+    roots.push_back(algebra::expression(algebra::constant::pi));
+    roots.push_back(algebra::parse("longer_name + x = y"));
+    roots.push_back(roots[0]);
+
+    std::string data;
+    algebra::serialize(roots, data);
+
+    std::vector<algebra::expression> decoded;
+    check(algebra::deserialize(data, decoded) && decoded == roots, "deserialize(serialize(roots)) differs from roots");
+    algebra::serialized_expressions view(data);
+    check(view.valid() && view.size() == data.size() && view.root_count() == roots.size(), "serialized view is not valid");
+    for (std::size_t ii = 0; ii < roots.size() && view.valid(); ++ii) {
+        check(view.decode(view.root(ii)) == roots[ii], "decoded root differs from " + algebra::to_string(roots[ii]));
+    }
+
+    for (std::size_t size = 0; size < data.size(); ++size) {
+        if (algebra::serialized_expressions(std::string_view(data).substr(0, size)).valid()) {
+            check(false, "encoding truncated to " + std::to_string(size) + " bytes was accepted");
+            break;
+        }
+    }
+
+    algebra::serial::header header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    std::size_t const nodes = sizeof(header) + (header.symbol_count + 1) * 4 + header.symbol_bytes;
+    auto rejected = [&](std::size_t offset, std::uint32_t word) {
+        std::string corrupt = data;
+        std::memcpy(&corrupt[offset], &word, sizeof(word));
+        return !algebra::serialized_expressions(corrupt).valid();
+    };
+
+    check(rejected(0, 0), "encoding with a bad magic was accepted");
+    check(rejected(offsetof(algebra::serial::header, version), algebra::serial::version + 1), "encoding with a bad version was accepted");
+    check(rejected(offsetof(algebra::serial::header, byte_order), 0x04030201), "encoding with a bad byte order was accepted");
+    check(rejected(data.size() - 4, header.node_count), "encoding with a bad root was accepted");
+    for (std::uint32_t ii = 0; ii < header.node_count; ++ii) {
+        std::size_t offset = nodes + ii * sizeof(algebra::serial::node);
+        algebra::serial::node n;
+        std::memcpy(&n, &data[offset], sizeof(n));
+        std::uint32_t kind = 0xff;
+        check(rejected(offset, kind), "encoding with a bad node kind was accepted");
+        if (n.kind == 1) {
+            // operands must precede the operation
+            check(rejected(offset + offsetof(algebra::serial::node, a), ii), "encoding with a cyclic node was accepted");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//! distance between `a` and `b` in units in the last place
+std::uint64_t ulps(double a, double b)
+{
+    if (a == b) {
+        return 0;
+    }
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b) ? 0 : UINT64_MAX;
+    }
+    // map the bits to integers ordered like the doubles they represent
+    auto ordered = [](double v) {
+        std::int64_t i;
+        std::memcpy(&i, &v, sizeof(i));
+        return i < 0 ? INT64_MIN - i : i;
+    };
+    std::int64_t ia = ordered(a);
+    std::int64_t ib = ordered(b);
+    return ia < ib ? std::uint64_t(ib) - std::uint64_t(ia) : std::uint64_t(ia) - std::uint64_t(ib);
+}
+
+//------------------------------------------------------------------------------
+//! approximations are within the bounds documented in vecmath.h
+void test_vecmath()
+{
+    std::size_t const n = 1 << 16;
+    std::mt19937_64 rng(1);
+    std::vector<double> x(n);
+    std::vector<double> y(n);
+    std::vector<double> out(n);
+    std::vector<double> out2(n);
+
+    auto uniform = [&](std::vector<double>& v, double lo, double hi) {
+        std::uniform_real_distribution<double> dist(lo, hi);
+        for (auto& e : v) {
+            e = dist(rng);
+        }
+        // outside of the reduced range and special values
+        v[0] = 0.0;
+        v[1] = -0.0;
+        v[2] = INFINITY;
+        v[3] = -INFINITY;
+        v[4] = NAN;
+        v[5] = 1e300;
+    };
+    auto max_ulps = [&](std::vector<double> const& result, double (*reference)(double)) {
+        std::uint64_t max = 0;
+        for (std::size_t ii = 0; ii < n; ++ii) {
+            max = std::max(max, ulps(result[ii], reference(x[ii])));
+        }
+        return max;
+    };
+
+    uniform(x, -1e3, 1e3);
+    algebra::vecmath::sin(x.data(), out.data(), n);
+    check(max_ulps(out, std::sin) <= 2, "vecmath::sin error is " + std::to_string(max_ulps(out, std::sin)) + " ulp");
+    algebra::vecmath::cos(x.data(), out.data(), n);
+    check(max_ulps(out, std::cos) <= 2, "vecmath::cos error is " + std::to_string(max_ulps(out, std::cos)) + " ulp");
+    algebra::vecmath::sincos(x.data(), out.data(), out2.data(), n);
+    check(max_ulps(out, std::sin) <= 2 && max_ulps(out2, std::cos) <= 2, "vecmath::sincos differs from sin and cos");
+
+    uniform(x, -708.0, 709.0);
+    algebra::vecmath::exp(x.data(), out.data(), n);
+    check(max_ulps(out, std::exp) <= 2, "vecmath::exp error is " + std::to_string(max_ulps(out, std::exp)) + " ulp");
+
+    uniform(x, 0.0, 1e6);
+    x[6] = -1.0;
+    x[7] = 1e-310;
+    algebra::vecmath::log(x.data(), out.data(), n);
+    check(max_ulps(out, std::log) <= 1, "vecmath::log error is " + std::to_string(max_ulps(out, std::log)) + " ulp");
+
+    uniform(x, 0.0, 1e3);
+    std::uniform_real_distribution<double> exponents(-10.0, 10.0);
+    for (auto& e : y) {
+        e = exponents(rng);
+    }
+    algebra::vecmath::pow(x.data(), y.data(), out.data(), n);
+    bool within = true;
+    for (std::size_t ii = 0; ii < n; ++ii) {
+        double bound = std::isfinite(x[ii]) && x[ii] > 0.0 ? 2 * std::abs(y[ii] * std::log(x[ii])) + 2 : 0;
+        within &= ulps(out[ii], std::pow(x[ii], y[ii])) <= std::ceil(bound);
+    }
+    check(within, "vecmath::pow error is larger than documented");
+}
+
+//------------------------------------------------------------------------------
+//! patterns deeper than the fixed match stack still match
+void test_match()
+{
+    algebra::expression pat = algebra::placeholder::a;
+    algebra::expression expr = algebra::symbol("x");
+    for (std::size_t ii = 0; ii < 2 * algebra::max_pattern_stack; ++ii) {
+        pat = algebra::op{algebra::op_type::sum, pat, algebra::expression(double(ii))};
+        expr = algebra::op{algebra::op_type::sum, expr, algebra::expression(double(ii))};
+    }
+
+    algebra::pattern compiled(pat);
+    check(compiled.stack_size > algebra::max_pattern_stack, "pattern is not deeper than the fixed stack");
+    algebra::bindings placeholders;
+    check(algebra::match(compiled, expr, placeholders), "deep pattern did not match");
+    check(placeholders.bound(algebra::placeholder::a) && placeholders[algebra::placeholder::a] == algebra::expression(algebra::symbol("x")),
+        "deep pattern bound the wrong subexpression");
+}
+
+//------------------------------------------------------------------------------
+//! patterns of three terms match any three terms of a sum or product, in any
+//! order and grouping
+void test_terms()
+{
+    struct
+    {
+        char const* text;
+        char const* best;
+    } const cases[] = {
+        {"2 * sin(x) * cos(x)", "sin(2 * x)"},
+        {"cos(x) * 2 * sin(x)", "sin(2 * x)"},
+        {"y * 2 * sin(x) * cos(x)", "y * sin(2 * x)"},
+    };
+    for (auto const& c : cases) {
+        algebra::simplify_options options;
+        options.max_iterations = 64;
+        algebra::expression best = algebra::simplify(algebra::parse(c.text), options);
+        algebra::expression expected = algebra::canonical(algebra::parse(c.best));
+        check(best == expected, std::string("simplify(") + c.text + ") is " + algebra::to_string(best) + ", not " + c.best);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! operations interned while searching are reclaimed once the search and its
+//! cache no longer refer to them
+void test_reclaim()
+{
+    algebra::expression expr = algebra::parse("(x + 1) * (x - 1) * sin(y) ^ 2 + (x * x - 1) * cos(y) ^ 2");
+    std::size_t const before = ptr<algebra::expression>::interned_count();
+    std::size_t during = 0;
+    {
+        algebra::memo<algebra::expression, algebra::rewrite_set> cache;
+        algebra::simplify_options options;
+        options.max_iterations = 64;
+        options.cache = &cache;
+        options.on_expand = [&](algebra::expression const&, double) {
+            during = std::max(during, ptr<algebra::expression>::interned_count());
+        };
+        algebra::simplify(expr, options);
+    }
+    std::size_t const after = ptr<algebra::expression>::interned_count();
+    check(during > before + 500, "search interned too few expressions to measure");
+    check(after <= before + (during - before) / 16, "interned expressions were not reclaimed: "
+        + std::to_string(before) + " before, " + std::to_string(during) + " during, " + std::to_string(after) + " after");
+}
+
+//------------------------------------------------------------------------------
+//! peak resident set size of the process in kilobytes, zero if unknown
+std::size_t peak_rss_kb()
+{
+#if TESTS_HAVE_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#   if defined(__APPLE__)
+        return std::size_t(usage.ru_maxrss) / 1024;
+#   else
+        return std::size_t(usage.ru_maxrss);
+#   endif
+    }
+#endif
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//! a long search under a small budget doesn't grow the process, unbounded it
+//! takes about 8 MB of search state and interned expressions
+void test_max_memory()
+{
+    algebra::expression expr = algebra::parse("((((z + y) * (z + y)) * z) / ((y ^ 2) + (cos(y) * (4 ^ 2)))) ^ 2"
+        " / ((ln(y * 9) * sin(y + z) + (z + z * y) ^ 2) - z * y * (6 + z) * x * ((x ^ 2) ^ 3 + y))");
+    algebra::memo_config config;
+    config.max_bytes = 1 << 20;
+    algebra::memo<algebra::expression, algebra::rewrite_set> cache(config);
+    algebra::simplify_options options;
+    options.max_operations = 64;
+    options.max_iterations = 1024;
+    options.max_memory = 256 << 10;
+    options.cache = &cache;
+
+    std::size_t const before = peak_rss_kb();
+    algebra::simplify_statistics stats;
+    algebra::simplify(expr, options, stats);
+    std::size_t const after = peak_rss_kb();
+    check(stats.forgotten > 0, "search did not fill the memory budget");
+    check(after <= before + 4 * 1024, "peak RSS grew by " + std::to_string(after - before) + " KB under a 256 KB budget");
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // usage: tests [name]
+    struct
+    {
+        char const* name;
+        void (*run)();
+    } const tests[] = {
+        {"normalize", test_normalize},
+        {"to_string", test_to_string},
+        {"on_improve", test_on_improve},
+        {"persistent_cache", test_persistent_cache},
+        {"differentiate", test_differentiate},
+        {"serialize", test_serialize},
+        {"vecmath", test_vecmath},
+        {"match", test_match},
+        {"terms", test_terms},
+        {"reclaim", test_reclaim},
+        {"max_memory", test_max_memory},
+    };
+
+    algebra::resolve_transforms();
+    bool found = false;
+    for (auto const& t : tests) {
+        if (argc < 2 || std::strcmp(argv[1], t.name) == 0) {
+            t.run();
+            found = true;
+        }
+    }
+    if (!found) {
+        std::fprintf(stderr, "unknown test %s\n", argv[1]);
+        return 1;
+    }
+    return failures ? 1 : 0;
+}